@@ -0,0 +1,176 @@
+/*
+ *  apex.c
+ *  Stepping and state queries of the libapex interface, on top of the
+ *  pipeline loop in cpu.c
+ */
+#include <stdlib.h>
+
+#include "apex.h"
+
+/*
+ * Directs the simulation output of cpu (traces, final dumps) to out and
+ * its diagnostics to err. A NULL stream leaves that one unchanged.
+ */
+void
+APEX_cpu_set_output(APEX_CPU* cpu, FILE* out, FILE* err)
+{
+  if (out) {
+    cpu->out = out;
+  }
+  if (err) {
+    cpu->err = err;
+  }
+}
+
+/*
+ * Advances the pipeline by at most cycles cycles. Returns CPU_STOP_CYCLES
+ * once they have all run, or the CPU_STOP_* reason it stopped earlier.
+ */
+int
+APEX_cpu_step(APEX_CPU* cpu, int cycles)
+{
+  if (cycles <= 0) {
+    return CPU_STOP_CYCLES;
+  }
+
+  int req_cyc = cpu->req_cyc;
+  cpu->req_cyc = cpu->clock + cycles;
+  int stop = APEX_cpu_simulate(cpu);
+  cpu->req_cyc = req_cyc;
+  return stop;
+}
+
+/*
+ * Runs the pipeline until cond(cpu, arg) returns non-zero after a cycle,
+ * or until another stop condition of cpu is met. Returns the CPU_STOP_*
+ * reason, CPU_STOP_CONDITION when cond stopped the run.
+ */
+int
+APEX_cpu_run_until(APEX_CPU* cpu, APEX_Stop_Condition cond, void* arg)
+{
+  cpu->until_fn = cond;
+  cpu->until_arg = arg;
+  int stop = APEX_cpu_simulate(cpu);
+  cpu->until_fn = NULL;
+  cpu->until_arg = NULL;
+  return stop;
+}
+
+/* Reads register reg into *value. Returns -1 if there is no such
+ * register.
+ */
+int
+APEX_cpu_read_register(const APEX_CPU* cpu, int reg, int* value)
+{
+  if (reg < 0 || reg >= (int)(sizeof(cpu->regs) / sizeof(cpu->regs[0]))) {
+    return -1;
+  }
+  *value = cpu->regs[reg];
+  return 0;
+}
+
+/* Reads the data memory word at address into *value. Returns -1 if the
+ * address is out of range.
+ */
+int
+APEX_cpu_read_memory(const APEX_CPU* cpu, int address, int* value)
+{
+  if (address < 0 || address >= DATA_MEMORY_SIZE) {
+    return -1;
+  }
+  *value = cpu->data_memory[address];
+  return 0;
+}
+
+void
+APEX_cpu_get_stats(const APEX_CPU* cpu, APEX_CPU_Stats* stats)
+{
+  stats->clock = cpu->clock;
+  stats->pc = cpu->pc;
+  stats->zero = cpu->zero;
+  stats->ins_completed = cpu->ins_completed;
+  stats->stall_cycles = cpu->stall_cycles;
+}
+
+/*
+ * Gives cpu empty caches built from caches, replacing any it had. With
+ * an I-cache, each cycle fetches up to fetch_width instructions into a
+ * queue of fetch_queue entries. Returns -1 on an invalid fetch setting
+ * or allocation failure, leaving cpu without caches.
+ */
+int
+APEX_cpu_set_caches(APEX_CPU* cpu, const APEX_Cache_Hierarchy* caches,
+                    int fetch_width, int fetch_queue)
+{
+  APEX_cache_destroy(cpu->dcache);
+  APEX_cache_destroy(cpu->icache);
+  cpu->dcache = NULL;
+  cpu->icache = NULL;
+
+  if (caches->levels) {
+    cpu->dcache = APEX_cache_create_hierarchy(caches);
+    if (!cpu->dcache) {
+      return -1;
+    }
+  }
+  if (caches->has_l1i) {
+    if (fetch_width < 1 || fetch_queue < fetch_width) {
+      APEX_cache_destroy(cpu->dcache);
+      cpu->dcache = NULL;
+      return -1;
+    }
+    cpu->icache = APEX_cache_create(&caches->l1i, NULL,
+                                    caches->memory_latency);
+    if (!cpu->icache) {
+      APEX_cache_destroy(cpu->dcache);
+      cpu->dcache = NULL;
+      return -1;
+    }
+    cpu->fetch_width = fetch_width;
+    cpu->fetch_queue_size = fetch_queue;
+    cpu->fetch_count = 0;
+    cpu->fetch_wait = 0;
+  }
+  return 0;
+}
+
+/*
+ * Gives cpu a branch predictor with empty tables built from config,
+ * replacing any it had, or removes it when config is NULL. Returns -1
+ * on an invalid config or allocation failure, leaving cpu without one.
+ */
+int
+APEX_cpu_set_bpred(APEX_CPU* cpu, const APEX_Bpred_Config* config)
+{
+  APEX_bpred_destroy(cpu->bpred);
+  cpu->bpred = NULL;
+
+  if (config) {
+    cpu->bpred = APEX_bpred_create(config);
+    if (!cpu->bpred) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Gives cpu a copy of the functional unit latencies in table, or one
+ * cycle everywhere when table is NULL. Returns -1 on allocation failure,
+ * leaving cpu with one cycle everywhere.
+ */
+int
+APEX_cpu_set_latencies(APEX_CPU* cpu, const APEX_Latency_Table* table)
+{
+  free(cpu->latency);
+  cpu->latency = NULL;
+
+  if (table) {
+    cpu->latency = malloc(sizeof(*cpu->latency));
+    if (!cpu->latency) {
+      return -1;
+    }
+    *cpu->latency = *table;
+  }
+  return 0;
+}
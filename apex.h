@@ -0,0 +1,67 @@
+#ifndef _APEX_H_
+#define _APEX_H_
+/**
+ *  apex.h
+ *  Public interface of libapex. Every APEX_CPU is self-contained : it
+ *  writes only to its own out and err streams and shares nothing
+ *  mutable with other instances, so a process may run any number of
+ *  them on any number of threads, one thread per CPU at a time. A
+ *  program's loads and stores reach only its data memory : one out of
+ *  range stops the run with CPU_STOP_FAULT.
+ *
+ *  Lifecycle :
+ *    APEX_cpu_open_file / APEX_cpu_open_buffer / APEX_cpu_create
+ *    APEX_cpu_step / APEX_cpu_run_until / APEX_cpu_simulate
+ *    APEX_cpu_stop
+ */
+#include "bpred.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "counters.h"
+#include "cpu.h"
+#include "functional.h"
+#include "latency.h"
+#include "multicore.h"
+#include "ooo.h"
+#include "superscalar.h"
+#include "trace.h"
+
+/* Counters and architectural state outside the register file */
+typedef struct APEX_CPU_Stats
+{
+  int clock;            // Cycles simulated
+  int pc;               // Next pc to fetch
+  int zero;             // Zero flag
+  int ins_completed;    // Instructions committed
+  int stall_cycles;     // Cycles that ended with decode stalled
+} APEX_CPU_Stats;
+
+void
+APEX_cpu_set_output(APEX_CPU* cpu, FILE* out, FILE* err);
+
+int
+APEX_cpu_step(APEX_CPU* cpu, int cycles);
+
+int
+APEX_cpu_run_until(APEX_CPU* cpu, APEX_Stop_Condition cond, void* arg);
+
+int
+APEX_cpu_read_register(const APEX_CPU* cpu, int reg, int* value);
+
+int
+APEX_cpu_read_memory(const APEX_CPU* cpu, int address, int* value);
+
+void
+APEX_cpu_get_stats(const APEX_CPU* cpu, APEX_CPU_Stats* stats);
+
+int
+APEX_cpu_set_caches(APEX_CPU* cpu, const APEX_Cache_Hierarchy* caches,
+                    int fetch_width, int fetch_queue);
+
+int
+APEX_cpu_set_bpred(APEX_CPU* cpu, const APEX_Bpred_Config* config);
+
+int
+APEX_cpu_set_latencies(APEX_CPU* cpu, const APEX_Latency_Table* table);
+
+#endif
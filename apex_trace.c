@@ -0,0 +1,240 @@
+/*
+ *  apex_trace.c
+ *  Offline viewer for binary pipeline traces written by apex_sim. Renders
+ *  a cycle range either in the display layout of the simulator or as a
+ *  pipeline diagram with one row per instruction address.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// ./apex_trace trace.bin
+// ./apex_trace trace.bin text 100 200
+// ./apex_trace trace.bin diagram 1 64
+
+/* Cycles per block of the pipeline diagram */
+#define DIAGRAM_CYCLES 16
+
+/* Rows of the pipeline diagram, one per instruction address */
+#define DIAGRAM_ROWS 4096
+
+enum
+{
+  VIEW_TEXT,
+  VIEW_DIAGRAM
+};
+
+/* Stage order of the display layout */
+static const int display_order[NUM_STAGES] = {
+  WB, MEM2, MEM1, EX2, EX1, DRF, F
+};
+
+static const char* const stage_short[NUM_STAGES] = {
+  [F]    = "F",
+  [DRF]  = "DRF",
+  [EX1]  = "EX1",
+  [EX2]  = "EX2",
+  [MEM1] = "MEM1",
+  [MEM2] = "MEM2",
+  [WB]   = "WB",
+};
+
+static void
+print_text(const APEX_Trace_Record* rec)
+{
+  APEX_trace_print_banner(stdout, rec->clock);
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    int stage = display_order[i];
+    APEX_trace_print_latch(stdout, stage, &rec->latch[stage]);
+  }
+}
+
+/* A row of the diagram : where one instruction address was each cycle */
+typedef struct Diagram_Row
+{
+  int pc;
+  int opcode;
+  signed char stage[DIAGRAM_CYCLES];    // Last stage holding pc, -1 if none
+  unsigned char stalled[DIAGRAM_CYCLES];
+} Diagram_Row;
+
+typedef struct Diagram
+{
+  int first_clock;
+  int num_cycles;
+  int num_rows;
+  int forward_reg[DIAGRAM_CYCLES];      // -1 when nothing was forwarded
+  Diagram_Row rows[DIAGRAM_ROWS];
+} Diagram;
+
+static Diagram_Row*
+find_row(Diagram* d, int pc, int opcode)
+{
+  for (int r = 0; r < d->num_rows; ++r) {
+    if (d->rows[r].pc == pc) {
+      return &d->rows[r];
+    }
+  }
+  if (d->num_rows == DIAGRAM_ROWS) {
+    return NULL;
+  }
+
+  Diagram_Row* row = &d->rows[d->num_rows++];
+  row->pc = pc;
+  row->opcode = opcode;
+  memset(row->stage, -1, sizeof(row->stage));
+  memset(row->stalled, 0, sizeof(row->stalled));
+  return row;
+}
+
+static int
+compare_rows(const void* a, const void* b)
+{
+  return ((const Diagram_Row*)a)->pc - ((const Diagram_Row*)b)->pc;
+}
+
+static void
+add_to_diagram(Diagram* d, const APEX_Trace_Record* rec)
+{
+  int col = d->num_cycles++;
+
+  if (col == 0) {
+    d->first_clock = rec->clock;
+  }
+  d->forward_reg[col] = (rec->events & TRACE_FORWARD) ? rec->forward_reg : -1;
+
+  for (int stage = F; stage < NUM_STAGES; ++stage) {
+    const APEX_Trace_Latch* latch = &rec->latch[stage];
+    if (!(latch->flags & TRACE_ACTIVE) || latch->opcode == OP_NONE ||
+        latch->opcode == OP_FLUSH || latch->pc == 0) {
+      continue;
+    }
+    Diagram_Row* row = find_row(d, latch->pc, latch->opcode);
+    if (row) {
+      row->stage[col] = stage;
+      row->stalled[col] = (latch->flags & TRACE_STALLED) != 0;
+    }
+  }
+}
+
+static void
+print_diagram(Diagram* d)
+{
+  if (!d->num_cycles) {
+    return;
+  }
+  qsort(d->rows, d->num_rows, sizeof(d->rows[0]), compare_rows);
+
+  printf("%-12s", "pc");
+  for (int c = 0; c < d->num_cycles; ++c) {
+    printf(" %5d", d->first_clock + c);
+  }
+  printf("\n");
+
+  for (int r = 0; r < d->num_rows; ++r) {
+    const Diagram_Row* row = &d->rows[r];
+    printf("%-5d %-6s", row->pc, APEX_opcode_info[row->opcode].name);
+    for (int c = 0; c < d->num_cycles; ++c) {
+      if (row->stage[c] < 0) {
+        printf(" %5s", ".");
+      }
+      else {
+        printf(" %4s%c", stage_short[(int)row->stage[c]],
+               row->stalled[c] ? '*' : ' ');
+      }
+    }
+    printf("\n");
+  }
+
+  printf("%-12s", "forward");
+  for (int c = 0; c < d->num_cycles; ++c) {
+    if (d->forward_reg[c] < 0) {
+      printf(" %5s", ".");
+    }
+    else {
+      printf("   R%-2d", d->forward_reg[c]);
+    }
+  }
+  printf("\n\n");
+
+  d->num_cycles = 0;
+  d->num_rows = 0;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr,
+      "APEX_Help : Usage %s <trace_file> [text|diagram] "
+      "[first_cycle] [last_cycle]\n",
+      argv[0]);
+    exit(1);
+  }
+
+  int view = VIEW_TEXT;
+  if (argc > 2) {
+    if (strcmp(argv[2], "diagram") == 0) {
+      view = VIEW_DIAGRAM;
+    }
+    else if (strcmp(argv[2], "text") != 0) {
+      fprintf(stderr, "APEX_Error : Unknown view %s\n", argv[2]);
+      exit(1);
+    }
+  }
+  long first = argc > 3 ? atol(argv[3]) : 1;
+  long last = argc > 4 ? atol(argv[4]) : -1;
+
+  FILE* fp = fopen(argv[1], "rb");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open trace file %s\n", argv[1]);
+    exit(1);
+  }
+
+  APEX_Trace_Header header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, APEX_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.record_size != sizeof(APEX_Trace_Record) ||
+      header.num_stages != NUM_STAGES) {
+    fprintf(stderr, "APEX_Error : %s is not an APEX pipeline trace\n", argv[1]);
+    fclose(fp);
+    exit(1);
+  }
+
+  Diagram* diagram = NULL;
+  if (view == VIEW_DIAGRAM) {
+    diagram = calloc(1, sizeof(*diagram));
+    if (!diagram) {
+      fclose(fp);
+      exit(1);
+    }
+  }
+
+  APEX_Trace_Record rec;
+  while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+    if (rec.clock < first) {
+      continue;
+    }
+    if (last >= 0 && rec.clock > last) {
+      break;
+    }
+    if (view == VIEW_TEXT) {
+      print_text(&rec);
+    }
+    else {
+      add_to_diagram(diagram, &rec);
+      if (diagram->num_cycles == DIAGRAM_CYCLES) {
+        print_diagram(diagram);
+      }
+    }
+  }
+  if (diagram) {
+    print_diagram(diagram);
+    free(diagram);
+  }
+
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,474 @@
+/*
+ *  bpred.c
+ *  Branch predictors behind one interface : each kind supplies how it
+ *  predicts a BZ / BNZ and how it learns the outcome, while the BTB, the
+ *  queue of predictions in flight and the statistics are shared.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+
+const char* const APEX_bpred_names[NUM_BPRED_KINDS] = {
+  [BPRED_NOT_TAKEN] = "nottaken",
+  [BPRED_BIMODAL]   = "bimodal",
+  [BPRED_GSHARE]    = "gshare",
+  [BPRED_TAGE]      = "tage",
+};
+
+/* Width of a TAGE tag, stored with a valid bit above it */
+enum
+{
+  TAGE_TAG_BITS = 8,
+  TAGE_VALID = 1 << TAGE_TAG_BITS
+};
+
+static int
+is_power_of_two(int value)
+{
+  return value > 0 && (value & (value - 1)) == 0;
+}
+
+/*
+ * Parses KIND[:TABLE_BITS[:HISTORY_BITS]] into config, KIND being one of
+ * APEX_bpred_names. Tables default to 1024 entries, gshare to as many
+ * history bits as index bits and TAGE to a longest history of 32. The
+ * BTB gets 64 entries. Returns -1 on a malformed spec.
+ */
+int
+APEX_bpred_parse(const char* spec, APEX_Bpred_Config* config)
+{
+  APEX_Bpred_Config parsed = {
+    .kind = -1,
+    .table_bits = 10,
+    .btb_entries = 64,
+  };
+  size_t len = strcspn(spec, ":");
+  for (int k = 0; k < NUM_BPRED_KINDS; ++k) {
+    if (strlen(APEX_bpred_names[k]) == len &&
+        strncmp(spec, APEX_bpred_names[k], len) == 0) {
+      parsed.kind = k;
+    }
+  }
+  if (parsed.kind < 0) {
+    return -1;
+  }
+
+  int* fields[] = { &parsed.table_bits, &parsed.history_bits };
+  const char* p = spec + len;
+  for (int i = 0; i < 2 && *p == ':'; ++i) {
+    char* end;
+    long value = strtol(p + 1, &end, 10);
+    if (end == p + 1 || value < 1 || value > 64) {
+      return -1;
+    }
+    *fields[i] = (int)value;
+    p = end;
+  }
+  if (*p != '\0') {
+    return -1;
+  }
+
+  if (!parsed.history_bits) {
+    parsed.history_bits = parsed.kind == BPRED_TAGE ? 32 : parsed.table_bits;
+  }
+  if (parsed.table_bits > 24 ||
+      (parsed.kind == BPRED_GSHARE &&
+       parsed.history_bits > parsed.table_bits) ||
+      (parsed.kind == BPRED_TAGE &&
+       parsed.history_bits < (1 << (BPRED_TAGE_TABLES - 1)))) {
+    return -1;
+  }
+
+  *config = parsed;
+  return 0;
+}
+
+/* Folds the newest length bits of history into width bits */
+static uint32_t
+fold_history(uint64_t history, int length, int width)
+{
+  if (length < 64) {
+    history &= ((uint64_t)1 << length) - 1;
+  }
+  uint32_t folded = 0;
+  while (history) {
+    folded ^= (uint32_t)history & ((1u << width) - 1);
+    history >>= width;
+  }
+  return folded;
+}
+
+/* 2-bit saturating counters, taken from 2 up */
+static void
+train_counter(uint8_t* counter, int taken)
+{
+  if (taken && *counter < 3) {
+    (*counter)++;
+  }
+  else if (!taken && *counter > 0) {
+    (*counter)--;
+  }
+}
+
+/*
+ * Direction predictors. predict() fills the indices lookup needs to
+ * train the same entries once the branch resolves, so later branches
+ * changing the history in between do no harm.
+ */
+static int
+predict_not_taken(APEX_Bpred* bp, int pc, APEX_Bpred_Lookup* lookup)
+{
+  return 0;
+}
+
+static void
+update_not_taken(APEX_Bpred* bp, const APEX_Bpred_Lookup* lookup, int taken)
+{
+}
+
+static int
+predict_bimodal(APEX_Bpred* bp, int pc, APEX_Bpred_Lookup* lookup)
+{
+  lookup->index[0] = ((uint32_t)pc >> 2) & bp->table_mask;
+  return bp->counters[lookup->index[0]] >= 2;
+}
+
+static void
+update_counter(APEX_Bpred* bp, const APEX_Bpred_Lookup* lookup, int taken)
+{
+  train_counter(&bp->counters[lookup->index[0]], taken);
+}
+
+static int
+predict_gshare(APEX_Bpred* bp, int pc, APEX_Bpred_Lookup* lookup)
+{
+  uint32_t history = fold_history(bp->history, bp->config.history_bits,
+                                  bp->config.table_bits);
+  lookup->index[0] = (((uint32_t)pc >> 2) ^ history) & bp->table_mask;
+  return bp->counters[lookup->index[0]] >= 2;
+}
+
+/* The longest tagged match predicts, the next longest (or the base) is
+ * the alternate prediction
+ */
+static int
+predict_tage(APEX_Bpred* bp, int pc, APEX_Bpred_Lookup* lookup)
+{
+  uint32_t word = (uint32_t)pc >> 2;
+  int taken = predict_bimodal(bp, pc, lookup);
+
+  lookup->provider = -1;
+  lookup->alt_taken = taken;
+  for (int t = 0; t < BPRED_TAGE_TABLES; ++t) {
+    int length = bp->tage_history[t];
+    uint32_t index = word ^ fold_history(bp->history, length,
+                                         bp->config.table_bits);
+    uint32_t tag = word ^ fold_history(bp->history, length, TAGE_TAG_BITS) ^
+                   (fold_history(bp->history, length,
+                                 TAGE_TAG_BITS - 1) << 1);
+    lookup->index[1 + t] = index & bp->table_mask;
+    lookup->tag[t] = (uint16_t)((tag & (TAGE_VALID - 1)) | TAGE_VALID);
+
+    const APEX_Tage_Entry* entry = &bp->tage[t][lookup->index[1 + t]];
+    if (entry->tag == lookup->tag[t]) {
+      lookup->provider = t;
+      lookup->alt_taken = taken;
+      taken = entry->counter >= 0;
+    }
+  }
+  return taken;
+}
+
+static void
+update_tage(APEX_Bpred* bp, const APEX_Bpred_Lookup* lookup, int taken)
+{
+  int provider = lookup->provider;
+  if (provider < 0) {
+    update_counter(bp, lookup, taken);
+  }
+  else {
+    APEX_Tage_Entry* entry = &bp->tage[provider][lookup->index[1 + provider]];
+    if (entry->tag == lookup->tag[provider]) {
+      if (taken && entry->counter < 3) {
+        entry->counter++;
+      }
+      else if (!taken && entry->counter > -4) {
+        entry->counter--;
+      }
+      /* Useful when it differs from the alternate and is right */
+      if (lookup->taken != lookup->alt_taken) {
+        if (lookup->taken == taken && entry->useful < 3) {
+          entry->useful++;
+        }
+        else if (lookup->taken != taken && entry->useful > 0) {
+          entry->useful--;
+        }
+      }
+    }
+  }
+
+  /* A misprediction allocates an entry of longer history */
+  if (lookup->taken != taken) {
+    int allocated = 0;
+    for (int t = provider + 1; t < BPRED_TAGE_TABLES && !allocated; ++t) {
+      APEX_Tage_Entry* entry = &bp->tage[t][lookup->index[1 + t]];
+      if (entry->useful == 0) {
+        entry->tag = lookup->tag[t];
+        entry->counter = taken ? 0 : -1;
+        allocated = 1;
+      }
+    }
+    for (int t = provider + 1; t < BPRED_TAGE_TABLES && !allocated; ++t) {
+      APEX_Tage_Entry* entry = &bp->tage[t][lookup->index[1 + t]];
+      entry->useful--;
+    }
+  }
+
+  /* Age useful bits now and then, so stale entries can be replaced */
+  if ((++bp->tage_updates & 0x3ffff) == 0) {
+    for (int t = 0; t < BPRED_TAGE_TABLES; ++t) {
+      for (uint32_t i = 0; i <= bp->table_mask; ++i) {
+        bp->tage[t][i].useful >>= 1;
+      }
+    }
+  }
+}
+
+typedef int (*APEX_Bpred_Predict)(APEX_Bpred* bp, int pc,
+                                  APEX_Bpred_Lookup* lookup);
+typedef void (*APEX_Bpred_Update)(APEX_Bpred* bp,
+                                  const APEX_Bpred_Lookup* lookup, int taken);
+
+static const struct
+{
+  APEX_Bpred_Predict predict;
+  APEX_Bpred_Update update;
+} predictors[NUM_BPRED_KINDS] = {
+  [BPRED_NOT_TAKEN] = { predict_not_taken, update_not_taken },
+  [BPRED_BIMODAL]   = { predict_bimodal, update_counter },
+  [BPRED_GSHARE]    = { predict_gshare, update_counter },
+  [BPRED_TAGE]      = { predict_tage, update_tage },
+};
+
+/*
+ * Creates a predictor with empty tables : counters weakly not taken, no
+ * tagged entry and no BTB entry. Returns NULL on an invalid config or
+ * allocation failure.
+ */
+APEX_Bpred*
+APEX_bpred_create(const APEX_Bpred_Config* config)
+{
+  if (config->kind < 0 || config->kind >= NUM_BPRED_KINDS ||
+      config->table_bits < 1 || config->table_bits > 24 ||
+      config->history_bits < 1 || config->history_bits > 64 ||
+      !is_power_of_two(config->btb_entries)) {
+    return NULL;
+  }
+
+  APEX_Bpred* bp = calloc(1, sizeof(*bp));
+  if (!bp) {
+    return NULL;
+  }
+  size_t entries = (size_t)1 << config->table_bits;
+  int failed = 0;
+
+  bp->config = *config;
+  bp->table_mask = (uint32_t)entries - 1;
+  bp->counters = malloc(entries);
+  failed |= !bp->counters;
+  if (bp->counters) {
+    memset(bp->counters, 1, entries);
+  }
+  if (config->kind == BPRED_TAGE) {
+    for (int t = 0; t < BPRED_TAGE_TABLES; ++t) {
+      int length = config->history_bits >> (BPRED_TAGE_TABLES - 1 - t);
+      bp->tage_history[t] = length;
+      bp->tage[t] = calloc(entries, sizeof(*bp->tage[t]));
+      failed |= !bp->tage[t];
+    }
+  }
+  bp->btb_mask = (uint32_t)config->btb_entries - 1;
+  bp->btb_pc = calloc(config->btb_entries, sizeof(*bp->btb_pc));
+  bp->btb_target = calloc(config->btb_entries, sizeof(*bp->btb_target));
+  failed |= !bp->btb_pc || !bp->btb_target;
+  failed |= APEX_bpred_reserve(bp, BPRED_INFLIGHT) < 0;
+
+  if (failed) {
+    APEX_bpred_destroy(bp);
+    return NULL;
+  }
+  return bp;
+}
+
+void
+APEX_bpred_destroy(APEX_Bpred* bp)
+{
+  if (!bp) {
+    return;
+  }
+  free(bp->counters);
+  for (int t = 0; t < BPRED_TAGE_TABLES; ++t) {
+    free(bp->tage[t]);
+  }
+  free(bp->btb_pc);
+  free(bp->btb_target);
+  free(bp->inflight);
+  free(bp);
+}
+
+/*
+ * Grows the queue of predictions to hold at least inflight of them, the
+ * most branches an engine keeps between fetch and resolution. Returns -1
+ * on allocation failure, leaving the queue as it was.
+ */
+int
+APEX_bpred_reserve(APEX_Bpred* bp, int inflight)
+{
+  if (inflight <= bp->inflight_size) {
+    return 0;
+  }
+  APEX_Bpred_Lookup* queue = calloc(inflight, sizeof(*queue));
+  if (!queue) {
+    return -1;
+  }
+  for (int i = 0; i < bp->inflight_count; ++i) {
+    queue[i] = bp->inflight[(bp->inflight_head + i) % bp->inflight_size];
+  }
+  free(bp->inflight);
+  bp->inflight = queue;
+  bp->inflight_size = inflight;
+  bp->inflight_head = 0;
+  return 0;
+}
+
+/* 1 when no prediction can be queued : fetch waits for a branch to
+ * resolve rather than predict another
+ */
+int
+APEX_bpred_full(const APEX_Bpred* bp)
+{
+  return bp->inflight_count == bp->inflight_size;
+}
+
+/*
+ * Forgets the queued predictions, e.g. once a checkpoint is restored :
+ * the next unqueued branches to resolve were predicted before and have
+ * no lookup to train with.
+ */
+void
+APEX_bpred_restart(APEX_Bpred* bp, int unqueued)
+{
+  bp->inflight_count = 0;
+  bp->unqueued = unqueued;
+}
+
+/*
+ * Predicts the pc fetched after the control instruction at pc : a BZ or
+ * BNZ (conditional) predicted taken, or a JUMP, goes to its BTB target,
+ * anything else falls through. The prediction is queued until
+ * APEX_bpred_resolve() sees the branch execute, so the queue must not be
+ * full : nothing is ever dropped to make room.
+ */
+int
+APEX_bpred_predict(APEX_Bpred* bp, int pc, int conditional)
+{
+  int slot = (bp->inflight_head + bp->inflight_count) % bp->inflight_size;
+  APEX_Bpred_Lookup* lookup = &bp->inflight[slot];
+  bp->inflight_count++;
+
+  lookup->pc = pc;
+  lookup->taken = conditional ?
+                  predictors[bp->config.kind].predict(bp, pc, lookup) : 1;
+
+  uint32_t entry = ((uint32_t)pc >> 2) & bp->btb_mask;
+  bp->btb_lookups++;
+  if (bp->btb_pc[entry] == pc) {
+    bp->btb_hits++;
+    if (lookup->taken) {
+      lookup->next_pc = bp->btb_target[entry];
+      return lookup->next_pc;
+    }
+  }
+  lookup->next_pc = pc + 4;
+  return lookup->next_pc;
+}
+
+/*
+ * Trains the predictor with the control instruction at pc, which went
+ * on to next_pc after fetch went on at predicted_pc, -1 when only the
+ * queued prediction knows where. Branches resolve in fetch order, so
+ * its lookup is the oldest queued, unless an unqueued branch is due.
+ * Returns 1 on a misprediction : everything fetched after it is on the
+ * wrong path and every prediction still queued is dropped.
+ */
+int
+APEX_bpred_resolve(APEX_Bpred* bp, int pc, int conditional, int next_pc,
+                   int predicted_pc)
+{
+  const APEX_Bpred_Lookup* lookup = NULL;
+  if (bp->unqueued > 0) {
+    bp->unqueued--;
+  }
+  else if (bp->inflight_count > 0 &&
+           bp->inflight[bp->inflight_head].pc == pc) {
+    lookup = &bp->inflight[bp->inflight_head];
+    bp->inflight_head = (bp->inflight_head + 1) % bp->inflight_size;
+    bp->inflight_count--;
+  }
+
+  int taken = next_pc != pc + 4;
+  int predicted = predicted_pc;
+  if (predicted < 0 && lookup) {
+    predicted = lookup->next_pc;
+  }
+  bp->branches++;
+  bp->taken += taken;
+  if (conditional) {
+    if (lookup) {
+      predictors[bp->config.kind].update(bp, lookup, taken);
+    }
+    bp->history = (bp->history << 1) | (uint64_t)taken;
+  }
+  if (taken) {
+    uint32_t entry = ((uint32_t)pc >> 2) & bp->btb_mask;
+    bp->btb_pc[entry] = pc;
+    bp->btb_target[entry] = next_pc;
+  }
+
+  if (predicted != next_pc) {
+    bp->mispredicts++;
+    bp->inflight_count = 0;
+    bp->unqueued = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Cycles saved over flushing behind every taken BZ, BNZ and JUMP, as a
+ * pipeline without prediction does : each such branch costs
+ * BPRED_PENALTY cycles there, each misprediction costs as much here
+ */
+long long
+APEX_bpred_cycles_saved(const APEX_Bpred* bp)
+{
+  return (long long)BPRED_PENALTY * (bp->taken - bp->mispredicts);
+}
+
+/* Prints one line : accuracy, BTB hit rate and cycles saved */
+void
+APEX_bpred_report(const APEX_Bpred* bp, FILE* out)
+{
+  const APEX_Bpred_Config* config = &bp->config;
+  fprintf(out,
+          "APEX_CPU : %s predictor %d entries, %d-entry BTB : %lld branches, "
+          "%lld mispredicted, accuracy %.2f%%, BTB hit rate %.2f%%, "
+          "%lld cycles saved\n",
+          APEX_bpred_names[config->kind], 1 << config->table_bits,
+          config->btb_entries, bp->branches, bp->mispredicts,
+          bp->branches ? 100.0 * (bp->branches - bp->mispredicts) /
+                         bp->branches : 0.0,
+          bp->btb_lookups ? 100.0 * bp->btb_hits / bp->btb_lookups : 0.0,
+          APEX_bpred_cycles_saved(bp));
+}
@@ -0,0 +1,121 @@
+#ifndef _APEX_BPRED_H_
+#define _APEX_BPRED_H_
+/**
+ *  bpred.h
+ *  Branch prediction for fetch : a direction predictor for BZ / BNZ and
+ *  a branch target buffer (BTB) for every control instruction, queried
+ *  as each one is fetched and trained when execute2 resolves it.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+/* Direction predictors */
+enum
+{
+  BPRED_NOT_TAKEN,  // Static, always falls through
+  BPRED_BIMODAL,    // 2-bit counters indexed by pc
+  BPRED_GSHARE,     // 2-bit counters indexed by pc xor global history
+  BPRED_TAGE,       // Bimodal base and tagged tables of geometric history
+  NUM_BPRED_KINDS
+};
+
+enum
+{
+  BPRED_TAGE_TABLES = 4,
+  BPRED_INFLIGHT = 8,       // Queue of a new predictor, ample for scalar
+  BPRED_PENALTY = 2         // Latches a redirect from execute2 squashes
+};
+
+typedef struct APEX_Bpred_Config
+{
+  int kind;             // BPRED_*
+  int table_bits;       // log2 of the entries of each table
+  int history_bits;     // Global history of gshare, longest of TAGE
+  int btb_entries;      // A power of two
+} APEX_Bpred_Config;
+
+/* What fetch predicted for the branch at pc, kept until it resolves */
+typedef struct APEX_Bpred_Lookup
+{
+  int pc;
+  int next_pc;          // Predicted pc after the branch
+  int taken;
+  int provider;         // TAGE table that predicted, -1 for the base
+  int alt_taken;        // Prediction without the provider
+  uint32_t index[1 + BPRED_TAGE_TABLES];  // Base, then tagged tables
+  uint16_t tag[BPRED_TAGE_TABLES];
+} APEX_Bpred_Lookup;
+
+typedef struct APEX_Tage_Entry
+{
+  uint16_t tag;
+  int8_t counter;       // -4 .. 3, taken when >= 0
+  uint8_t useful;       // 0 .. 3
+} APEX_Tage_Entry;
+
+typedef struct APEX_Bpred
+{
+  APEX_Bpred_Config config;
+  uint32_t table_mask;
+  uint64_t history;     // Outcomes of resolved BZ / BNZ, newest in bit 0
+  uint8_t* counters;    // 2-bit counters : bimodal, gshare or TAGE base
+  APEX_Tage_Entry* tage[BPRED_TAGE_TABLES];
+  int tage_history[BPRED_TAGE_TABLES];
+  unsigned int tage_updates;
+
+  /* Direct-mapped BTB, keyed by the full pc (0 when invalid) */
+  int* btb_pc;
+  int* btb_target;
+  uint32_t btb_mask;
+
+  /* Predictions in fetch order, oldest at inflight_head. The oldest
+   * unqueued branches in flight resolve first, with no lookup.
+   */
+  APEX_Bpred_Lookup* inflight;
+  int inflight_size;
+  int inflight_head;
+  int inflight_count;
+  int unqueued;
+
+  /* Statistics */
+  long long branches;       // Resolved control instructions
+  long long taken;          // Of which taken
+  long long mispredicts;
+  long long btb_lookups;
+  long long btb_hits;
+} APEX_Bpred;
+
+extern const char* const APEX_bpred_names[NUM_BPRED_KINDS];
+
+int
+APEX_bpred_parse(const char* spec, APEX_Bpred_Config* config);
+
+APEX_Bpred*
+APEX_bpred_create(const APEX_Bpred_Config* config);
+
+void
+APEX_bpred_destroy(APEX_Bpred* bp);
+
+int
+APEX_bpred_reserve(APEX_Bpred* bp, int inflight);
+
+int
+APEX_bpred_full(const APEX_Bpred* bp);
+
+void
+APEX_bpred_restart(APEX_Bpred* bp, int unqueued);
+
+int
+APEX_bpred_predict(APEX_Bpred* bp, int pc, int conditional);
+
+int
+APEX_bpred_resolve(APEX_Bpred* bp, int pc, int conditional, int next_pc,
+                   int predicted_pc);
+
+long long
+APEX_bpred_cycles_saved(const APEX_Bpred* bp);
+
+void
+APEX_bpred_report(const APEX_Bpred* bp, FILE* out);
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ *  cache.c
+ *  Set-associative data caches with a tag store sized and searched for
+ *  speed : power-of-two sets, each set's ways in one contiguous run of
+ *  32-bit tags, and recency kept by the order of the ways rather than by
+ *  per-line counters.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+const char* const APEX_cache_replacement_names[NUM_CACHE_REPLACEMENTS] = {
+  [CACHE_LRU]    = "lru",
+  [CACHE_FIFO]   = "fifo",
+  [CACHE_RANDOM] = "random",
+};
+
+static int
+is_power_of_two(int value)
+{
+  return value > 0 && (value & (value - 1)) == 0;
+}
+
+/*
+ * Parses SIZE:ASSOC:LINE:LATENCY[:POLICY...] into config, where each
+ * optional POLICY is a replacement name, wb / wt (write back, write
+ * through) or wa / nwa (write allocate or not). Defaults are lru, wb and
+ * wa. Returns -1 on a malformed spec or an impossible geometry.
+ */
+int
+APEX_cache_parse(const char* spec, APEX_Cache_Config* config)
+{
+  APEX_Cache_Config parsed = {
+    .replacement = CACHE_LRU,
+    .write_back = 1,
+    .write_allocate = 1,
+  };
+  int* fields[] = { &parsed.size, &parsed.assoc, &parsed.line_size,
+                    &parsed.latency };
+  const char* p = spec;
+
+  for (int i = 0; i < 4; ++i) {
+    char* end;
+    long value = strtol(p, &end, 10);
+    if (end == p || value < 0 || value > (1 << 24)) {
+      return -1;
+    }
+    *fields[i] = (int)value;
+    if (i < 3 && *end != ':') {
+      return -1;
+    }
+    p = *end == ':' ? end + 1 : end;
+  }
+  if (p > spec && p[-1] == ':' && *p == '\0') {
+    return -1;
+  }
+
+  while (*p) {
+    size_t len = strcspn(p, ":");
+    int known = 0;
+    for (int r = 0; r < NUM_CACHE_REPLACEMENTS; ++r) {
+      if (strlen(APEX_cache_replacement_names[r]) == len &&
+          strncmp(p, APEX_cache_replacement_names[r], len) == 0) {
+        parsed.replacement = r;
+        known = 1;
+      }
+    }
+    if (len == 2 && strncmp(p, "wb", 2) == 0) {
+      parsed.write_back = 1;
+      known = 1;
+    } else if (len == 2 && strncmp(p, "wt", 2) == 0) {
+      parsed.write_back = 0;
+      known = 1;
+    } else if (len == 2 && strncmp(p, "wa", 2) == 0) {
+      parsed.write_allocate = 1;
+      known = 1;
+    } else if (len == 3 && strncmp(p, "nwa", 3) == 0) {
+      parsed.write_allocate = 0;
+      known = 1;
+    }
+    if (!known) {
+      return -1;
+    }
+    p += len;
+    if (*p == ':') {
+      p++;
+      if (*p == '\0') {
+        return -1;
+      }
+    }
+  }
+
+  /* Lines hold whole words and sets come in powers of two */
+  if (!is_power_of_two(parsed.line_size) || parsed.line_size < 4 ||
+      parsed.assoc < 1 || parsed.latency < 1 ||
+      parsed.size % (parsed.assoc * parsed.line_size) != 0 ||
+      !is_power_of_two(parsed.size / (parsed.assoc * parsed.line_size))) {
+    return -1;
+  }
+
+  *config = parsed;
+  return 0;
+}
+
+/*
+ * Creates an empty cache in front of next, or in front of a main memory
+ * of memory_latency cycles when next is NULL. The cache takes ownership
+ * of next. Returns NULL on an invalid config or allocation failure.
+ */
+APEX_Cache*
+APEX_cache_create(const APEX_Cache_Config* config, APEX_Cache* next,
+                  int memory_latency)
+{
+  int sets = config->size / (config->assoc * config->line_size);
+  if (sets < 1 || !is_power_of_two(sets) ||
+      !is_power_of_two(config->line_size)) {
+    return NULL;
+  }
+
+  APEX_Cache* cache = calloc(1, sizeof(*cache));
+  if (!cache) {
+    return NULL;
+  }
+  size_t lines = (size_t)sets * config->assoc;
+  cache->tags = calloc(lines, sizeof(*cache->tags));
+  cache->dirty = calloc(lines, sizeof(*cache->dirty));
+  if (!cache->tags || !cache->dirty) {
+    free(cache->tags);
+    free(cache->dirty);
+    free(cache);
+    return NULL;
+  }
+
+  cache->config = *config;
+  cache->next = next;
+  cache->memory_latency = memory_latency;
+  while ((1 << cache->line_shift) < config->line_size) {
+    cache->line_shift++;
+  }
+  cache->set_mask = (uint32_t)sets - 1;
+  cache->random = 0x9e3779b9u;
+  return cache;
+}
+
+/*
+ * Creates the levels of hierarchy, returning its L1. Returns NULL when
+ * it has no level or on failure.
+ */
+APEX_Cache*
+APEX_cache_create_hierarchy(const APEX_Cache_Hierarchy* hierarchy)
+{
+  APEX_Cache* cache = NULL;
+  for (int i = hierarchy->levels - 1; i >= 0; --i) {
+    APEX_Cache* level = APEX_cache_create(&hierarchy->level[i], cache,
+                                          hierarchy->memory_latency);
+    if (!level) {
+      APEX_cache_destroy(cache);
+      return NULL;
+    }
+    cache = level;
+  }
+  return cache;
+}
+
+/* Destroys cache and every level behind it */
+void
+APEX_cache_destroy(APEX_Cache* cache)
+{
+  while (cache) {
+    APEX_Cache* next = cache->next;
+    free(cache->tags);
+    free(cache->dirty);
+    free(cache);
+    cache = next;
+  }
+}
+
+/* Latency of a read at the level behind cache */
+static int
+next_level_read(APEX_Cache* cache, int address)
+{
+  if (cache->next) {
+    return APEX_cache_access(cache->next, address, 0);
+  }
+  return cache->memory_latency;
+}
+
+/* Writes behind cache are buffered : they update the next level but
+ * never hold the pipeline
+ */
+static void
+next_level_write(APEX_Cache* cache, int address)
+{
+  if (cache->next) {
+    APEX_cache_access(cache->next, address, 1);
+  }
+}
+
+/* Makes way the first of its set, shifting the ways before it down */
+static void
+move_to_front(uint32_t* tags, uint8_t* dirty, int way)
+{
+  uint32_t tag = tags[way];
+  uint8_t bit = dirty[way];
+  memmove(tags + 1, tags, way * sizeof(*tags));
+  memmove(dirty + 1, dirty, way * sizeof(*dirty));
+  tags[0] = tag;
+  dirty[0] = bit;
+}
+
+/*
+ * Looks up the data word at address for a load (write = 0) or a store,
+ * updating tags and statistics along the hierarchy. Returns the cycles
+ * the access takes, at least the hit latency.
+ */
+int
+APEX_cache_access(APEX_Cache* cache, int address, int write)
+{
+  const APEX_Cache_Config* config = &cache->config;
+  uint32_t line = ((uint32_t)address << 2) >> cache->line_shift;
+  uint32_t tag = line + 1;
+  int assoc = config->assoc;
+  uint32_t* tags = cache->tags + (size_t)(line & cache->set_mask) * assoc;
+  uint8_t* dirty = cache->dirty + (size_t)(line & cache->set_mask) * assoc;
+  int latency = config->latency;
+
+  if (write) {
+    cache->writes++;
+  } else {
+    cache->reads++;
+  }
+
+  for (int way = 0; way < assoc; ++way) {
+    if (tags[way] != tag) {
+      continue;
+    }
+    if (config->replacement == CACHE_LRU && way > 0) {
+      move_to_front(tags, dirty, way);
+      way = 0;
+    }
+    if (write) {
+      if (config->write_back) {
+        dirty[way] = 1;
+      } else {
+        next_level_write(cache, address);
+      }
+    }
+    cache->cycles += latency;
+    return latency;
+  }
+
+  if (write) {
+    cache->write_misses++;
+    if (!config->write_allocate) {
+      next_level_write(cache, address);
+      cache->cycles += latency;
+      return latency;
+    }
+  } else {
+    cache->read_misses++;
+  }
+
+  /* Evict : the last way under LRU and FIFO, an invalid way or else any
+   * way under random
+   */
+  int victim = assoc - 1;
+  if (config->replacement == CACHE_RANDOM) {
+    victim = 0;
+    while (victim < assoc && tags[victim]) {
+      victim++;
+    }
+    if (victim == assoc) {
+      cache->random ^= cache->random << 13;
+      cache->random ^= cache->random >> 17;
+      cache->random ^= cache->random << 5;
+      victim = (int)(cache->random % (uint32_t)assoc);
+    }
+  }
+  if (tags[victim] && dirty[victim]) {
+    cache->writebacks++;
+    uint32_t evicted = (tags[victim] - 1) << cache->line_shift;
+    next_level_write(cache, (int)(evicted >> 2));
+  }
+
+  latency += next_level_read(cache, address);
+
+  if (config->replacement != CACHE_RANDOM) {
+    move_to_front(tags, dirty, victim);
+    victim = 0;
+  }
+  tags[victim] = tag;
+  dirty[victim] = 0;
+  if (write) {
+    if (config->write_back) {
+      dirty[victim] = 1;
+    } else {
+      next_level_write(cache, address);
+    }
+  }
+
+  cache->cycles += latency;
+  return latency;
+}
+
+/*
+ * Prints one line per level : accesses, hit rate, misses per thousand
+ * instructions and average memory access time as seen by that level.
+ * side follows the level in its name, e.g. "I" for L1I.
+ */
+void
+APEX_cache_report(const APEX_Cache* cache, const char* side, FILE* out,
+                  long long instructions)
+{
+  for (int level = 1; cache; cache = cache->next, ++level) {
+    long long accesses = cache->reads + cache->writes;
+    long long misses = cache->read_misses + cache->write_misses;
+    const APEX_Cache_Config* config = &cache->config;
+    fprintf(out,
+            "APEX_CPU : L%d%s %dB %d-way %dB lines %s %s%s : %lld accesses, "
+            "hit rate %.2f%%, %.2f MPKI, %lld writebacks, AMAT %.2f cycles\n",
+            level, side, config->size, config->assoc, config->line_size,
+            APEX_cache_replacement_names[config->replacement],
+            config->write_back ? "wb" : "wt",
+            config->write_allocate ? " wa" : " nwa", accesses,
+            accesses ? 100.0 * (accesses - misses) / accesses : 0.0,
+            instructions ? 1000.0 * misses / instructions : 0.0,
+            cache->writebacks,
+            accesses ? (double)cache->cycles / accesses : 0.0);
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+/**
+ *  cache.h
+ *  Timing model of a data cache hierarchy. Only tags are kept, the data
+ *  itself stays in data memory, so a cache changes when an access
+ *  completes but never what it returns.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+/* Cache levels in front of main memory, L1 and L2 */
+enum
+{
+  APEX_CACHE_MAX_LEVELS = 2
+};
+
+/* Replacement policies */
+enum
+{
+  CACHE_LRU,
+  CACHE_FIFO,
+  CACHE_RANDOM,
+  NUM_CACHE_REPLACEMENTS
+};
+
+typedef struct APEX_Cache_Config
+{
+  int size;             // Bytes, data words are 4 bytes
+  int assoc;            // Ways per set
+  int line_size;        // Bytes per line
+  int latency;          // Cycles of a hit
+  int replacement;      // CACHE_LRU, CACHE_FIFO or CACHE_RANDOM
+  int write_back;       // Write back dirty lines, else write through
+  int write_allocate;   // Allocate on a write miss
+} APEX_Cache_Config;
+
+/* A whole hierarchy : data caches, level[0] being L1, and an optional
+ * L1 instruction cache, both in front of the same main memory
+ */
+typedef struct APEX_Cache_Hierarchy
+{
+  int levels;           // 0 for no data cache
+  APEX_Cache_Config level[APEX_CACHE_MAX_LEVELS];
+  int has_l1i;
+  APEX_Cache_Config l1i;
+  int memory_latency;   // Cycles of a main memory access
+} APEX_Cache_Hierarchy;
+
+typedef struct APEX_Cache
+{
+  APEX_Cache_Config config;
+  struct APEX_Cache* next;  // Next level, NULL for main memory
+  int memory_latency;       // Cycles of a main memory access, when next is NULL
+
+  int line_shift;           // log2(line_size)
+  uint32_t set_mask;        // Sets - 1
+
+  /* Tag store : the ways of a set are contiguous, each holding its line
+   * number + 1 (0 when invalid). Way 0 is the most recently used line
+   * under LRU, the most recently filled one under FIFO.
+   */
+  uint32_t* tags;
+  uint8_t* dirty;
+  uint32_t random;          // xorshift state of CACHE_RANDOM
+
+  /* Statistics */
+  long long reads;
+  long long writes;
+  long long read_misses;
+  long long write_misses;
+  long long writebacks;     // Dirty lines written to the next level
+  long long cycles;         // Sum of access latencies, for AMAT
+} APEX_Cache;
+
+extern const char* const APEX_cache_replacement_names[NUM_CACHE_REPLACEMENTS];
+
+int
+APEX_cache_parse(const char* spec, APEX_Cache_Config* config);
+
+APEX_Cache*
+APEX_cache_create(const APEX_Cache_Config* config, APEX_Cache* next,
+                  int memory_latency);
+
+APEX_Cache*
+APEX_cache_create_hierarchy(const APEX_Cache_Hierarchy* hierarchy);
+
+void
+APEX_cache_destroy(APEX_Cache* cache);
+
+int
+APEX_cache_access(APEX_Cache* cache, int address, int write);
+
+void
+APEX_cache_report(const APEX_Cache* cache, const char* side, FILE* out,
+                  long long instructions);
+
+#endif
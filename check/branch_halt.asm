@@ -0,0 +1,7 @@
+MOVC,R1,#2
+ADDL,R1,R1,#-1
+STORE,R1,R0,#0
+STORE,R1,R0,#1
+STORE,R1,R0,#2
+BNZ,#-16
+HALT
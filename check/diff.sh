@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# Differential check, run by "make check" : every program runs on each
+# functional engine and on the scalar, superscalar and out-of-order
+# pipelines, whose final register file and data memory must match the
+# switch interpreter's. Status bits are left out, only the ISA state is
+# compared.
+#
+#   check/diff.sh <apex_sim> <program>...
+#
+sim=$1
+shift
+dir=$(dirname "$0")
+
+# Run type and options of each configuration checked
+configs="threaded
+jit
+simulate
+simulate --bpred gshare:10:8
+simulate --bpred tage --btb 16
+simulate --latencies $dir/units.lat
+simulate --l1 256:2:16:2 --l2 1024:4:32:6 --dram-latency 20
+simulate --l1i 256:2:16:3 --fetch-width 2 --bpred bimodal
+simulate --width 2
+simulate --width 4 --mem 2 --bpred tage
+simulate --width 8 --bpred gshare
+simulate --width 8 --bpred tage
+ooo
+ooo --width 4 --rob 16 --bpred gshare
+ooo --width 4 --bpred gshare"
+
+state() {
+  prog=$1
+  type=$2
+  shift 2
+  "$sim" "$prog" "$type" 0 none "$@" 2>&1 |
+    sed -n '/Register Value/,$p' | sed 's/ >> status=.*//'
+}
+
+runs=0
+failed=0
+for prog in "$@"; do
+  expected=$(state "$prog" functional)
+  if [ -z "$expected" ]; then
+    echo "FAIL $prog : functional produced no final state"
+    failed=$((failed + 1))
+    continue
+  fi
+  while read -r type options; do
+    runs=$((runs + 1))
+    # Options are split on purpose
+    # shellcheck disable=SC2086
+    if [ "$(state "$prog" "$type" $options)" != "$expected" ]; then
+      echo "FAIL $prog : $type${options:+ $options}"
+      failed=$((failed + 1))
+    fi
+  done <<EOF
+$configs
+EOF
+done
+
+echo "check : $runs runs, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,9 @@
+MOVC,R1,#4000
+MOVC,R2,#12345
+STORE,R2,R1,#95
+LOAD,R3,R1,#95
+ADD,R4,R3,R2
+STORE,R4,R1,#100
+STORE,R2,R1,#101
+MOVC,R5,#7
+HALT
@@ -0,0 +1,8 @@
+MOVC,R1,#3
+MOVC,R2,#7
+STORE,R2,R1,#-1
+LDR,R3,R1,R2
+SUB,R4,R0,R1
+LOAD,R5,R4,#2
+MOVC,R6,#1
+HALT
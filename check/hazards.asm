@@ -0,0 +1,17 @@
+MOVC,R1,#3
+MOVC,R2,#20
+STORE,R1,R2,#0
+LOAD,R3,R2,#0
+ADD,R4,R3,R3
+MUL,R5,R4,R4
+STR,R5,R2,R1
+LDR,R6,R2,R1
+SUB,R7,R6,R5
+BZ,#8
+HALT
+XOR,R8,R6,R4
+AND,R9,R8,R6
+OR,R10,R9,R1
+ADDL,R11,R10,#-35
+BNZ,#-8
+HALT
@@ -0,0 +1,5 @@
+MOVC,R1,#4012
+JUMP,R1,#0
+MOVC,R2,#7
+MOVC,R3,#9
+HALT
@@ -0,0 +1,14 @@
+MOVC,R1,#5
+MOVC,R2,#1
+MOVC,R3,#0
+MOVC,R8,#4016
+SUB,R1,R1,R2
+BZ,#24
+MUL,R4,R1,R1
+ADD,R3,R3,R4
+STORE,R3,R1,#10
+JUMP,R8,#0
+MOVC,R9,#99
+LOAD,R5,R0,#14
+ADDL,R6,R5,#1
+HALT
@@ -0,0 +1,20 @@
+MOVC,R1,#35
+MOVC,R2,#1
+MOVC,R3,#0
+MOVC,R4,#3
+MOVC,R5,#1
+MOVC,R6,#5
+MOVC,R7,#5
+AND,R8,R1,R4
+BZ,#8
+ADDL,R3,R3,#1
+BNZ,#4
+BZ,#4
+BZ,#4
+AND,R8,R1,R6
+BNZ,#8
+ADDL,R3,R3,#3
+SUB,R1,R1,R2
+BNZ,#-40
+STORE,R3,R0,#10
+HALT
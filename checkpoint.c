@@ -0,0 +1,284 @@
+/*
+ *  checkpoint.c
+ *  Checkpoint file, in host byte order :
+ *
+ *    APEX_Checkpoint_Header
+ *    APEX_Checkpoint_State
+ *    stage[NUM_STAGES]        raw CPU_Stage latches
+ *    cpi_by_pc[code_size + 1] CPI stack rows, int64 per slot
+ *    data memory runs         { uint32 start, uint32 count, int32 words[count] }
+ *                             for each run of non-zero words, in address order
+ *
+ *  The header carries the layout sizes and a hash of code memory, so a
+ *  checkpoint is only restored into the build and program that wrote it.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "APEXCKPT"
+
+/* Bump when the file layout changes */
+#define CHECKPOINT_VERSION 9
+
+typedef struct APEX_Checkpoint_Header
+{
+  char magic[8];            // CHECKPOINT_MAGIC
+  uint32_t version;         // CHECKPOINT_VERSION
+  uint32_t state_size;      // sizeof(APEX_Checkpoint_State)
+  uint32_t stage_size;      // sizeof(CPU_Stage)
+  uint32_t num_stages;      // NUM_STAGES
+  uint32_t memory_size;     // DATA_MEMORY_SIZE
+  uint32_t num_runs;        // Data memory runs that follow the CPI rows
+  uint32_t code_size;       // Instructions in code memory
+  uint32_t code_hash;       // FNV-1a of code memory
+} APEX_Checkpoint_Header;
+
+/* Architectural state and counters, everything except latches and
+ * data memory
+ */
+typedef struct APEX_Checkpoint_State
+{
+  int32_t clock;
+  int32_t zero;
+  int32_t pc;
+  int32_t finished;
+  int32_t faulted;
+  int32_t mem_wait;
+  int32_t fetch_pc;
+  int32_t fetch_count;
+  int32_t fetch_wait;
+  int32_t regs[16];
+  int32_t reg_writers[16];
+  int32_t ins_completed;
+  int32_t stall_cycles;
+  int32_t mem_stall_cycles;
+  int32_t fetch_stall_cycles;
+  int32_t ex_stall_cycles;
+  int32_t forwarded[NUM_STAGES];
+  int32_t stall_reg;
+  int32_t reg_stall_cycles[16];
+  int32_t opcode_stall_cycles[NUM_OPCODES];
+  APEX_Counters counters;
+} APEX_Checkpoint_State;
+
+static uint32_t
+hash_code(const APEX_CPU* cpu)
+{
+  uint32_t hash = 2166136261u;
+
+  for (int i = 0; i < cpu->code_memory_size; ++i) {
+    const APEX_Instruction* ins = &cpu->code_memory[i];
+    uint32_t fields[5] = { ins->opcode, ins->rd, ins->rs1, ins->rs2,
+                           (uint32_t)ins->imm };
+    const unsigned char* bytes = (const unsigned char*)fields;
+    for (size_t b = 0; b < sizeof(fields); ++b) {
+      hash = (hash ^ bytes[b]) * 16777619u;
+    }
+  }
+  return hash;
+}
+
+/* Counts the runs of non-zero data memory words, and writes them to fp
+ * unless it is NULL
+ */
+static uint32_t
+write_runs(const APEX_CPU* cpu, FILE* fp, int* error)
+{
+  const int* mem = cpu->data_memory;
+  uint32_t runs = 0;
+  uint32_t i = 0;
+
+  while (i < DATA_MEMORY_SIZE) {
+    if (!mem[i]) {
+      i++;
+      continue;
+    }
+    uint32_t start = i;
+    while (i < DATA_MEMORY_SIZE && mem[i]) {
+      i++;
+    }
+    uint32_t run[2] = { start, i - start };
+    if (fp && (fwrite(run, sizeof(run), 1, fp) != 1 ||
+               fwrite(&mem[start], sizeof(mem[0]), run[1], fp) != run[1])) {
+      *error = 1;
+    }
+    runs++;
+  }
+  return runs;
+}
+
+static void
+fill_header(const APEX_CPU* cpu, APEX_Checkpoint_Header* header)
+{
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+  header->version = CHECKPOINT_VERSION;
+  header->state_size = sizeof(APEX_Checkpoint_State);
+  header->stage_size = sizeof(CPU_Stage);
+  header->num_stages = NUM_STAGES;
+  header->memory_size = DATA_MEMORY_SIZE;
+  header->code_size = cpu->code_memory_size;
+  header->code_hash = hash_code(cpu);
+}
+
+/* Writes the state of cpu to filename. Returns -1 on error. */
+int
+APEX_checkpoint_save(const APEX_CPU* cpu, const char* filename)
+{
+  APEX_Checkpoint_Header header;
+  APEX_Checkpoint_State state;
+  int error = 0;
+
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    return -1;
+  }
+
+  fill_header(cpu, &header);
+  header.num_runs = write_runs(cpu, NULL, &error);
+
+  memset(&state, 0, sizeof(state));
+  state.clock = cpu->clock;
+  state.zero = cpu->zero;
+  state.pc = cpu->pc;
+  state.finished = cpu->finished;
+  state.faulted = cpu->faulted;
+  state.mem_wait = cpu->mem_wait;
+  state.fetch_pc = cpu->fetch_pc;
+  state.fetch_count = cpu->fetch_count;
+  state.fetch_wait = cpu->fetch_wait;
+  memcpy(state.regs, cpu->regs, sizeof(state.regs));
+  memcpy(state.reg_writers, cpu->reg_writers, sizeof(state.reg_writers));
+  state.ins_completed = cpu->ins_completed;
+  state.stall_cycles = cpu->stall_cycles;
+  state.mem_stall_cycles = cpu->mem_stall_cycles;
+  state.fetch_stall_cycles = cpu->fetch_stall_cycles;
+  state.ex_stall_cycles = cpu->ex_stall_cycles;
+  memcpy(state.forwarded, cpu->forwarded, sizeof(state.forwarded));
+  state.stall_reg = cpu->stall_reg;
+  memcpy(state.reg_stall_cycles, cpu->reg_stall_cycles,
+         sizeof(state.reg_stall_cycles));
+  memcpy(state.opcode_stall_cycles, cpu->opcode_stall_cycles,
+         sizeof(state.opcode_stall_cycles));
+  state.counters = cpu->counters;
+
+  size_t rows = cpu->code_memory_size + 1;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+      fwrite(&state, sizeof(state), 1, fp) != 1 ||
+      fwrite(cpu->stage, sizeof(cpu->stage), 1, fp) != 1 ||
+      fwrite(cpu->cpi_by_pc, sizeof(*cpu->cpi_by_pc), rows, fp) != rows) {
+    error = 1;
+  }
+  write_runs(cpu, fp, &error);
+
+  if (fclose(fp) != 0) {
+    error = 1;
+  }
+  return error ? -1 : 0;
+}
+
+/*
+ * Replaces the state of cpu, which must hold the same program, with the
+ * checkpoint in filename. Returns -1 and leaves cpu untouched if the
+ * file is unreadable or was written for another build or program.
+ */
+int
+APEX_checkpoint_restore(APEX_CPU* cpu, const char* filename)
+{
+  APEX_Checkpoint_Header header;
+  APEX_Checkpoint_Header expected;
+  APEX_Checkpoint_State state;
+  CPU_Stage stage[NUM_STAGES];
+
+  /* Data memory and the CPI rows are staged separately so a bad file
+   * leaves cpu intact
+   */
+  size_t rows = cpu->code_memory_size + 1;
+  int* mem = calloc(DATA_MEMORY_SIZE, sizeof(*mem));
+  long long (*cpi_by_pc)[NUM_CPI_SLOTS] = calloc(rows, sizeof(*cpi_by_pc));
+  if (!mem || !cpi_by_pc) {
+    free(mem);
+    free(cpi_by_pc);
+    return -1;
+  }
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    free(mem);
+    free(cpi_by_pc);
+    return -1;
+  }
+
+  fill_header(cpu, &expected);
+  if (fread(&header, sizeof(header), 1, fp) != 1) {
+    goto fail;
+  }
+  expected.num_runs = header.num_runs;
+  if (memcmp(&header, &expected, sizeof(header)) != 0 ||
+      fread(&state, sizeof(state), 1, fp) != 1 ||
+      fread(stage, sizeof(stage), 1, fp) != 1 ||
+      fread(cpi_by_pc, sizeof(*cpi_by_pc), rows, fp) != rows ||
+      state.stall_reg < -1 || state.stall_reg >= 16) {
+    goto fail;
+  }
+
+  for (uint32_t r = 0; r < header.num_runs; ++r) {
+    uint32_t run[2];
+    if (fread(run, sizeof(run), 1, fp) != 1 ||
+        run[0] > DATA_MEMORY_SIZE || run[1] > DATA_MEMORY_SIZE - run[0] ||
+        fread(&mem[run[0]], sizeof(mem[0]), run[1], fp) != run[1]) {
+      goto fail;
+    }
+  }
+  fclose(fp);
+
+  cpu->clock = state.clock;
+  cpu->zero = state.zero;
+  cpu->pc = state.pc;
+  cpu->finished = state.finished != 0;
+  cpu->faulted = state.faulted != 0;
+  cpu->mem_wait = state.mem_wait;
+  cpu->fetch_pc = state.fetch_pc;
+  cpu->fetch_count = state.fetch_count;
+  cpu->fetch_wait = state.fetch_wait;
+  memcpy(cpu->regs, state.regs, sizeof(cpu->regs));
+  memcpy(cpu->reg_writers, state.reg_writers, sizeof(cpu->reg_writers));
+  cpu->ins_completed = state.ins_completed;
+  cpu->stall_cycles = state.stall_cycles;
+  cpu->mem_stall_cycles = state.mem_stall_cycles;
+  cpu->fetch_stall_cycles = state.fetch_stall_cycles;
+  cpu->ex_stall_cycles = state.ex_stall_cycles;
+  memcpy(cpu->forwarded, state.forwarded, sizeof(cpu->forwarded));
+  cpu->stall_reg = state.stall_reg;
+  memcpy(cpu->reg_stall_cycles, state.reg_stall_cycles,
+         sizeof(cpu->reg_stall_cycles));
+  memcpy(cpu->opcode_stall_cycles, state.opcode_stall_cycles,
+         sizeof(cpu->opcode_stall_cycles));
+  cpu->counters = state.counters;
+  memcpy(cpu->stage, stage, sizeof(cpu->stage));
+  if (cpu->bpred) {
+    /* Branches from DRF to EX2 were predicted by the run that saved */
+    int unqueued = 0;
+    for (int i = DRF; i <= EX2; ++i) {
+      int opcode = stage[i].opcode;
+      unqueued += !stage[i].busy && (opcode == OP_JUMP || opcode == OP_BZ ||
+                                     opcode == OP_BNZ);
+    }
+    APEX_bpred_restart(cpu->bpred, unqueued);
+  }
+  memcpy(cpu->data_memory, mem, sizeof(cpu->data_memory));
+  memcpy(cpu->cpi_by_pc, cpi_by_pc, rows * sizeof(*cpi_by_pc));
+  free(mem);
+  free(cpi_by_pc);
+  return 0;
+
+fail:
+  fclose(fp);
+  free(mem);
+  free(cpi_by_pc);
+  return -1;
+}
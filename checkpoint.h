@@ -0,0 +1,16 @@
+#ifndef _APEX_CHECKPOINT_H_
+#define _APEX_CHECKPOINT_H_
+/**
+ *  checkpoint.h
+ *  Saves and restores the complete simulator state, so a long run can
+ *  be fast-forwarded once and resumed many times
+ */
+#include "cpu.h"
+
+int
+APEX_checkpoint_save(const APEX_CPU* cpu, const char* filename);
+
+int
+APEX_checkpoint_restore(APEX_CPU* cpu, const char* filename);
+
+#endif
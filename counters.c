@@ -0,0 +1,215 @@
+/*
+ *  counters.c
+ *  JSON dump of the performance counters :
+ *
+ *    { "cycles", "retired", "ipc", "cpi",
+ *      "retired_by_opcode" : { "<opcode>" : n, ... },
+ *      "stall_cycles" : { "<cause>" : n, ... },
+ *      "decode_stall_cycles", "flushed_instructions",
+ *      "forwarded" : { "<stage>" : n, ... }, "forwarding_hits",
+ *      "memory_accesses" : { "loads", "stores" },
+ *      "bubbles" : { "<stage>" : n, ... },
+ *      "cpi_stack" : { "<slot>" : n, ... },
+ *      "cpi_stack_by_pc" : [ { "pc", "<slot>" : n, ... }, ... ] }
+ *
+ *  Stall causes are those of APEX_Counters plus the memory, execute and
+ *  fetch wait cycles the pipeline already counts.
+ */
+#include "counters.h"
+
+const char* const APEX_stall_cause_names[NUM_STALL_CAUSES] = {
+  [STALL_RAW_RS1]      = "raw_rs1",
+  [STALL_RAW_RS2]      = "raw_rs2",
+  [STALL_RAW_RD]       = "raw_rd",
+  [STALL_HALT_DRAIN]   = "halt_drain",
+  [STALL_BRANCH_FLUSH] = "branch_flush",
+};
+
+const char* const APEX_cpi_slot_names[NUM_CPI_SLOTS] = {
+  [CPI_RETIRING]        = "retiring",
+  [CPI_FETCH]           = "fetch",
+  [CPI_RESTEER]         = "resteer",
+  [CPI_BAD_SPECULATION] = "bad_speculation",
+  [CPI_DEPENDENCY]      = "dependency",
+  [CPI_MEMORY]          = "memory",
+  [CPI_EXECUTE]         = "execute",
+};
+
+/* Top level of the CPI stack : slots first .. last of each category */
+static const struct
+{
+  const char* name;
+  int first;
+  int last;
+} cpi_categories[] = {
+  { "retiring",        CPI_RETIRING,        CPI_RETIRING },
+  { "front end",       CPI_FETCH,           CPI_RESTEER },
+  { "bad speculation", CPI_BAD_SPECULATION, CPI_BAD_SPECULATION },
+  { "back end",        CPI_DEPENDENCY,      CPI_EXECUTE },
+};
+
+/* Column headings of the per-pc table */
+static const char* const cpi_slot_columns[NUM_CPI_SLOTS] = {
+  [CPI_RETIRING]        = "retiring",
+  [CPI_FETCH]           = "fetch",
+  [CPI_RESTEER]         = "resteer",
+  [CPI_BAD_SPECULATION] = "bad spec",
+  [CPI_DEPENDENCY]      = "dependency",
+  [CPI_MEMORY]          = "memory",
+  [CPI_EXECUTE]         = "execute",
+};
+
+static const char* const stage_names[NUM_STAGES] = {
+  [F]    = "F",
+  [DRF]  = "DRF",
+  [EX1]  = "EX1",
+  [EX2]  = "EX2",
+  [MEM1] = "MEM1",
+  [MEM2] = "MEM2",
+  [WB]   = "WB",
+};
+
+/* Writes the counters of cpu to out. Returns -1 on a write error. */
+int
+APEX_counters_write_json(const APEX_CPU* cpu, FILE* out)
+{
+  const APEX_Counters* c = &cpu->counters;
+
+  fprintf(out, "{\n  \"cycles\": %d,\n  \"retired\": %d,\n", cpu->clock,
+          cpu->ins_completed);
+  fprintf(out, "  \"ipc\": %.4f,\n  \"cpi\": %.4f,\n",
+          cpu->clock ? (double)cpu->ins_completed / cpu->clock : 0.0,
+          cpu->ins_completed ? (double)cpu->clock / cpu->ins_completed : 0.0);
+
+  fprintf(out, "  \"retired_by_opcode\": {");
+  const char* sep = "";
+  for (int op = OP_NONE + 1; op < NUM_OPCODES; ++op) {
+    if (op != OP_FLUSH) {
+      fprintf(out, "%s\"%s\": %lld", sep, APEX_opcode_info[op].name,
+              c->retired[op]);
+      sep = ", ";
+    }
+  }
+
+  fprintf(out, "},\n  \"stall_cycles\": {");
+  for (int i = 0; i < NUM_STALL_CAUSES; ++i) {
+    fprintf(out, "\"%s\": %lld, ", APEX_stall_cause_names[i], c->stalls[i]);
+  }
+  fprintf(out, "\"memory\": %d, \"execute\": %d, \"fetch\": %d},\n",
+          cpu->mem_stall_cycles, cpu->ex_stall_cycles,
+          cpu->fetch_stall_cycles);
+  fprintf(out, "  \"decode_stall_cycles\": %d,\n", cpu->stall_cycles);
+  fprintf(out, "  \"flushed_instructions\": %lld,\n", c->flushed);
+
+  long long hits = 0;
+  fprintf(out, "  \"forwarded\": {");
+  for (int i = EX2; i <= WB; ++i) {
+    fprintf(out, "%s\"%s\": %d", i == EX2 ? "" : ", ", stage_names[i],
+            cpu->forwarded[i]);
+    hits += cpu->forwarded[i];
+  }
+  fprintf(out, "},\n  \"forwarding_hits\": %lld,\n", hits);
+  fprintf(out, "  \"memory_accesses\": {\"loads\": %lld, \"stores\": %lld},\n",
+          c->loads, c->stores);
+
+  fprintf(out, "  \"bubbles\": {");
+  for (int i = F; i < NUM_STAGES; ++i) {
+    fprintf(out, "%s\"%s\": %lld", i == F ? "" : ", ", stage_names[i],
+            c->bubbles[i]);
+  }
+
+  fprintf(out, "},\n  \"cpi_stack\": {");
+  for (int i = 0; i < NUM_CPI_SLOTS; ++i) {
+    fprintf(out, "%s\"%s\": %lld", i == 0 ? "" : ", ",
+            APEX_cpi_slot_names[i], c->cpi[i]);
+  }
+  fprintf(out, "},\n  \"cpi_stack_by_pc\": [");
+  sep = "";
+  for (int row = 0; row <= cpu->code_memory_size; ++row) {
+    const long long* cycles = cpu->cpi_by_pc[row];
+    long long total = 0;
+    for (int i = 0; i < NUM_CPI_SLOTS; ++i) {
+      total += cycles[i];
+    }
+    if (total == 0) {
+      continue;
+    }
+    if (row < cpu->code_memory_size) {
+      fprintf(out, "%s\n    {\"pc\": %d", sep, 4000 + 4 * row);
+    }
+    else {
+      fprintf(out, "%s\n    {\"pc\": null", sep);
+    }
+    for (int i = 0; i < NUM_CPI_SLOTS; ++i) {
+      fprintf(out, ", \"%s\": %lld", APEX_cpi_slot_names[i], cycles[i]);
+    }
+    fprintf(out, "}");
+    sep = ",";
+  }
+  fprintf(out, "%s]\n}\n", *sep ? "\n  " : "");
+
+  return ferror(out) ? -1 : 0;
+}
+
+/*
+ * Prints the CPI stack : the cycles of each category and slot, the CPI
+ * they add, then every instruction that was charged cycles, in code
+ * order, with those blamed on no instruction last
+ */
+void
+APEX_counters_print_cpi_stack(const APEX_CPU* cpu, FILE* out)
+{
+  const long long* cpi = cpu->counters.cpi;
+  int retired = cpu->ins_completed;
+
+  fprintf(out, "APEX_CPU : CPI stack, %d cycles, CPI %.4f\n", cpu->clock,
+          retired ? (double)cpu->clock / retired : 0.0);
+  for (size_t k = 0; k < sizeof(cpi_categories) / sizeof(cpi_categories[0]);
+       ++k) {
+    long long cycles = 0;
+    for (int i = cpi_categories[k].first; i <= cpi_categories[k].last; ++i) {
+      cycles += cpi[i];
+    }
+    fprintf(out, "APEX_CPU :   %-16s %10lld cycles  CPI %.4f  %5.1f%%",
+            cpi_categories[k].name, cycles,
+            retired ? (double)cycles / retired : 0.0,
+            cpu->clock ? 100.0 * cycles / cpu->clock : 0.0);
+    if (cpi_categories[k].first < cpi_categories[k].last) {
+      for (int i = cpi_categories[k].first; i <= cpi_categories[k].last;
+           ++i) {
+        fprintf(out, "%s%s %lld", i == cpi_categories[k].first ? "  (" :
+                ", ", APEX_cpi_slot_names[i], cpi[i]);
+      }
+      fprintf(out, ")");
+    }
+    fprintf(out, "\n");
+  }
+
+  fprintf(out, "APEX_CPU : CPI stack by pc %15s", "total");
+  for (int i = 0; i < NUM_CPI_SLOTS; ++i) {
+    fprintf(out, " %10s", cpi_slot_columns[i]);
+  }
+  fprintf(out, "\n");
+  for (int row = 0; row <= cpu->code_memory_size; ++row) {
+    const long long* cycles = cpu->cpi_by_pc[row];
+    long long total = 0;
+    for (int i = 0; i < NUM_CPI_SLOTS; ++i) {
+      total += cycles[i];
+    }
+    if (total == 0) {
+      continue;
+    }
+    if (row < cpu->code_memory_size) {
+      fprintf(out, "APEX_CPU :   pc(%d) %-8s", 4000 + 4 * row,
+              APEX_opcode_info[cpu->code_memory[row].opcode].name);
+    }
+    else {
+      fprintf(out, "APEX_CPU :   %-18s", "no instruction");
+    }
+    fprintf(out, " %10lld", total);
+    for (int i = 0; i < NUM_CPI_SLOTS; ++i) {
+      fprintf(out, " %10lld", cycles[i]);
+    }
+    fprintf(out, "\n");
+  }
+}
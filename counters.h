@@ -0,0 +1,23 @@
+#ifndef _APEX_COUNTERS_H_
+#define _APEX_COUNTERS_H_
+/**
+ *  counters.h
+ *  Performance counters of the pipeline. The stage functions bump
+ *  APEX_CPU.counters as they go. This writes them, with the other run
+ *  statistics of the CPU, as one JSON object, and prints the CPI stack
+ *  they add up to.
+ */
+#include <stdio.h>
+
+#include "cpu.h"
+
+extern const char* const APEX_stall_cause_names[NUM_STALL_CAUSES];
+extern const char* const APEX_cpi_slot_names[NUM_CPI_SLOTS];
+
+int
+APEX_counters_write_json(const APEX_CPU* cpu, FILE* out);
+
+void
+APEX_counters_print_cpi_stack(const APEX_CPU* cpu, FILE* out);
+
+#endif
@@ -1,1182 +1,1779 @@
-  /*
-   *  cpu.c
-   *  Contains APEX cpu pipeline implementation
-   *
-   *  Author :
-   *  Gaurav Kothari (gkothar1@binghamton.edu)
-   *  State University of New York, Binghamton
-   */
-  #include <stdio.h>
-  #include <stdlib.h>
-  #include <string.h>
-
-  #include "cpu.h"
-
-  /* Set this flag to 1 to enable debug messages */
-  #define ENABLE_DEBUG_MESSAGES 1
-
-  /*
-   * This function creates and initializes APEX cpu.
-   *
-   * Note : You are free to edit this function according to your
-   * 				implementation
-   */
+/*
+ *  cpu.c
+ *  Contains APEX cpu pipeline implementation
+ *
+ *  Author :
+ *  Gaurav Kothari (gkothar1@binghamton.edu)
+ *  State University of New York, Binghamton
+ */
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+#include "cache.h"
+#include "counters.h"
+#include "cpu.h"
+#include "latency.h"
+#include "multicore.h"
+#include "trace.h"
+
+/* Per-opcode action of one pipeline stage. A NULL entry means the
+ * opcode does nothing in that stage.
+ */
+typedef void (*APEX_Stage_Handler)(APEX_CPU* cpu, CPU_Stage* stage);
+
+/*
+ * Creates a CPU in its reset state that runs code. The code memory is
+ * borrowed, not copied : it must outlive the CPU and is left alone by
+ * APEX_cpu_stop(), so many CPUs can share one decoded program.
+ */
 APEX_CPU*
-APEX_cpu_init(const char* filename)
+APEX_cpu_create(APEX_Instruction* code, int size)
 {
-  if (!filename) {
+  APEX_CPU* cpu = calloc(1, sizeof(*cpu));
+  if (!cpu) {
     return NULL;
   }
-
-  APEX_CPU* cpu = malloc(sizeof(*cpu));
-  if (!cpu) {
+  cpu->cpi_by_pc = calloc(size + 1, sizeof(*cpu->cpi_by_pc));
+  if (!cpu->cpi_by_pc) {
+    free(cpu);
     return NULL;
   }
 
-    /* Initialize PC, Registers and all pipeline stages */
+  /* Initialize PC, Registers and all pipeline stages */
   cpu->pc = 4000;
-  memset(cpu->regs, 0, sizeof(int) * 32);
-  memset(cpu->regs_valid, 1, sizeof(int) * 32);
-  memset(cpu->stage, 0, sizeof(CPU_Stage) * NUM_STAGES);
-  memset(cpu->data_memory, 0, sizeof(int) * 4000);
+  cpu->stall_reg = -1;
 
-    /* Parse input file and create code memory */
-  cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+  cpu->code_memory = code;
+  cpu->code_memory_size = size;
+  cpu->code_memory_borrowed = 1;
+  cpu->out = stdout;
+  cpu->err = stderr;
 
-  if (!cpu->code_memory) {
-    free(cpu);
+  /* Make all stages busy except Fetch stage, initally to start the pipeline */
+  for (int i = 1; i < NUM_STAGES; ++i) {
+    cpu->stage[i].busy = 1;
+  }
+
+  return cpu;
+}
+
+/*
+ * Creates a CPU that owns the code memory decoded from filename, an
+ * assembly file or an .apexbin image. Load errors are reported to err,
+ * or stderr when it is NULL.
+ */
+APEX_CPU*
+APEX_cpu_open_file(const char* filename, FILE* err)
+{
+  if (!filename) {
     return NULL;
   }
+  if (!err) {
+    err = stderr;
+  }
 
-  if (ENABLE_DEBUG_MESSAGES) {
-    fprintf(stderr,
-      "APEX_CPU : Initialized APEX CPU, loaded %d instructions\n",
-      cpu->code_memory_size);
-    fprintf(stderr, "APEX_CPU : Printing Code Memory\n");
-    printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode", "rd", "rs1", "rs2", "imm");
-
-    for (int i = 0; i < cpu->code_memory_size; ++i) {
-      printf("%-9s %-9d %-9d %-9d %-9d\n",
-       cpu->code_memory[i].opcode,
-       cpu->code_memory[i].rd,
-       cpu->code_memory[i].rs1,
-       cpu->code_memory[i].rs2,
-       cpu->code_memory[i].imm);
-    }
+  /* Parse input file and create code memory */
+  int size;
+  int mapped;
+  APEX_Instruction* code = create_code_memory(filename, &size, &mapped, err);
+  if (!code) {
+    return NULL;
   }
 
-    /* Make all stages busy except Fetch stage, initally to start the pipeline */
-  for (int i = 1; i < NUM_STAGES; ++i) {
-    cpu->stage[i].busy = 1;
+  APEX_CPU* cpu = APEX_cpu_create(code, size);
+  if (!cpu) {
+    destroy_code_memory(code, size, mapped);
+    return NULL;
+  }
+  cpu->code_memory_mapped = mapped;
+  cpu->code_memory_borrowed = 0;
+  cpu->err = err;
+
+  return cpu;
+}
+
+/*
+ * Creates a CPU that owns the code memory decoded from the assembly in
+ * text. name labels syntax errors, which are reported as by
+ * APEX_cpu_open_file().
+ */
+APEX_CPU*
+APEX_cpu_open_buffer(const char* name, const char* text, size_t length,
+                     FILE* err)
+{
+  if (!err) {
+    err = stderr;
+  }
+
+  int size;
+  APEX_Instruction* code = parse_code_memory(name, text, length, &size, err);
+  if (!code) {
+    return NULL;
   }
 
+  APEX_CPU* cpu = APEX_cpu_create(code, size);
+  if (!cpu) {
+    destroy_code_memory(code, size, 0);
+    return NULL;
+  }
+  cpu->code_memory_borrowed = 0;
+  cpu->err = err;
+
   return cpu;
 }
 
-  /*
-   * This function de-allocates APEX cpu.
-   *
-   * Note : You are free to edit this function according to your
-   * 				implementation
-   */
+/*
+ * This function creates and initializes APEX cpu.
+ *
+ * Note : You are free to edit this function according to your
+ * 				implementation
+ */
+APEX_CPU*
+APEX_cpu_init(const char* filename)
+{
+  return APEX_cpu_open_file(filename, stderr);
+}
+
+/*
+ * Lists code memory, as part of the summary trace
+ */
+void
+APEX_cpu_print_code(APEX_CPU* cpu)
+{
+  fprintf(cpu->err,
+    "APEX_CPU : Initialized APEX CPU, loaded %d instructions\n",
+    cpu->code_memory_size);
+  fprintf(cpu->err, "APEX_CPU : Printing Code Memory\n");
+  fprintf(cpu->out, "%-9s %-9s %-9s %-9s %-9s\n", "opcode", "rd", "rs1", "rs2", "imm");
+
+  for (int i = 0; i < cpu->code_memory_size; ++i) {
+    fprintf(cpu->out, "%-9s %-9d %-9d %-9d %-9d\n",
+     APEX_opcode_info[cpu->code_memory[i].opcode].name,
+     cpu->code_memory[i].rd,
+     cpu->code_memory[i].rs1,
+     cpu->code_memory[i].rs2,
+     cpu->code_memory[i].imm);
+  }
+}
+
+/*
+ * This function de-allocates APEX cpu.
+ *
+ * Note : You are free to edit this function according to your
+ * 				implementation
+ */
 void
 APEX_cpu_stop(APEX_CPU* cpu)
 {
-  free(cpu->code_memory);
+  if (!cpu->code_memory_borrowed) {
+    destroy_code_memory(cpu->code_memory, cpu->code_memory_size,
+                        cpu->code_memory_mapped);
+  }
+  APEX_cache_destroy(cpu->dcache);
+  APEX_cache_destroy(cpu->icache);
+  APEX_bpred_destroy(cpu->bpred);
+  free(cpu->latency);
+  free(cpu->cpi_by_pc);
   free(cpu);
 }
 
-  /* Converts the PC(4000 series) into
-   * array index for code memory
-   *
-   * Note : You are not supposed to edit this function
-   *
-   */
+/* Converts the PC(4000 series) into
+ * array index for code memory
+ *
+ * Note : You are not supposed to edit this function
+ *
+ */
 int
 get_code_index(int pc)
 {
   return (pc - 4000) / 4;
 }
 
-static void
-print_instruction(CPU_Stage* stage)
+/* Whether pc falls inside the program */
+static int
+in_code(const APEX_CPU* cpu, int pc)
 {
-  if (strcmp(stage->opcode, "STORE") == 0)
-  {
-    printf("%s,R%d,R%d,#%d ", stage->opcode, stage->rs1, stage->rs2, stage->imm);
-  }
+  int index = get_code_index(pc);
+  return index >= 0 && index < cpu->code_memory_size;
+}
 
-  if (strcmp(stage->opcode, "STR") == 0)
-  {
-    printf("%s,R%d,R%d,R%d ", stage->opcode,stage->rd, stage->rs1, stage->rs2);
-  }
+/* Instruction at pc. Running past the end of the program fetches
+ * bubbles.
+ */
+static const APEX_Instruction*
+code_at(const APEX_CPU* cpu, int pc)
+{
+  static const APEX_Instruction empty_ins;
 
-   if (strcmp(stage->opcode, "LDR") == 0)
-  {
-    printf("%s,R%d,R%d,R%d ", stage->opcode,stage->rd, stage->rs1, stage->rs2);
+  if (in_code(cpu, pc)) {
+    return &cpu->code_memory[get_code_index(pc)];
   }
+  return &empty_ins;
+}
 
-  if (strcmp(stage->opcode, "LOAD") == 0) 
-  {
-    printf("%s,R%d,R%d,#%d ", stage->opcode, stage->rd, stage->rs1, stage->imm);
-  }
+/* Replaces the instruction held in a latch with a HALT marker */
+static void
+squash_to_halt(CPU_Stage* stage)
+{
+  stage->pc = 0;
+  stage->opcode = OP_HALT;
+  stage->stalled = 1;
+}
 
-  if (strcmp(stage->opcode, "MOVC") == 0) 
-  {
-    printf("%s,R%d,#%d ", stage->opcode, stage->rd, stage->imm);
-  }
+/* Stalls (or releases) the front end on a decode dependency */
+static void
+set_decode_stall(APEX_CPU* cpu, int stalled)
+{
+  cpu->stage[F].stalled = stalled;
+  cpu->stage[DRF].stalled = stalled;
+}
 
-  if (strcmp(stage->opcode, "ADD") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
-  }
+/* Opcodes that write rd at writeback */
+static int
+writes_register(int opcode)
+{
+  return opcode == OP_MOVC || opcode == OP_LOAD || opcode == OP_LDR ||
+         opcode == OP_ADD || opcode == OP_ADDL || opcode == OP_SUB ||
+         opcode == OP_AND || opcode == OP_OR || opcode == OP_XOR ||
+         opcode == OP_MUL;
+}
 
-  if (strcmp(stage->opcode, "ADDL") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->imm);
-  }
+/* LOAD, LDR, STORE and STR, which access data memory in MEM1 */
+static int
+is_memory_access(int opcode)
+{
+  return opcode == OP_STORE || opcode == OP_STR || opcode == OP_LOAD ||
+         opcode == OP_LDR;
+}
 
-  if (strcmp(stage->opcode, "SUB") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
-  }
+/* A data memory access outside data memory, which ends the run as the
+ * functional engines do : it commits nothing and neither does anything
+ * after it
+ */
+static int
+is_data_fault(const CPU_Stage* stage)
+{
+  return is_memory_access(stage->opcode) &&
+         (stage->mem_address < 0 || stage->mem_address >= DATA_MEMORY_SIZE);
+}
 
-  if (strcmp(stage->opcode, "AND") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
-  }
+/* BZ, BNZ and JUMP, which may change the next pc */
+static int
+is_control(int opcode)
+{
+  return opcode == OP_JUMP || opcode == OP_BZ || opcode == OP_BNZ;
+}
 
-  if (strcmp(stage->opcode, "OR") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
+/* Counts a cycle in which stage i got no instruction to process */
+static void
+count_bubble(APEX_CPU* cpu, int i)
+{
+  const CPU_Stage* stage = &cpu->stage[i];
+  if (stage->busy || stage->opcode == OP_FLUSH) {
+    cpu->counters.bubbles[i]++;
   }
+}
 
-  if (strcmp(stage->opcode, "XOR") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
-  }
+/* Whether a latch holds an instruction on its way to writeback */
+static int
+holds_instruction(const CPU_Stage* stage)
+{
+  return !stage->busy && !stage->stalled && stage->opcode != OP_FLUSH;
+}
 
-  if (strcmp(stage->opcode, "MUL") == 0) 
-  {
-    printf("%s,R%d,R%d,R%d", stage->opcode, stage->rd, stage->rs1,stage->rs2);
-  }
+/*
+ * Scoreboard. decode claims rd for a writer as it issues it to EX1 and
+ * writeback releases it, so a register is busy until its last writer
+ * in flight commits. A latch that is squashed instead of committing
+ * hands its claim back here.
+ */
+static int
+holds_claim(const CPU_Stage* stage)
+{
+  return !stage->busy && !stage->stalled && writes_register(stage->opcode);
+}
 
-  if (strcmp(stage->opcode, "BZ") == 0) 
-  {
-    printf("%s,#%d", stage->opcode, stage->imm);
+static void
+release_claim(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  if (holds_claim(stage)) {
+    cpu->reg_writers[stage->rd]--;
   }
+}
 
-  if (strcmp(stage->opcode, "BNZ") == 0) 
-  {
-    printf("%s,#%d", stage->opcode, stage->imm);
-  }
+/* squash_to_halt() for a latch past decode */
+static void
+squash_issued(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  release_claim(cpu, stage);
+  squash_to_halt(stage);
+}
 
-  if (strcmp(stage->opcode, "JUMP") == 0) 
-  {
-    printf("%s,R%d,#%d", stage->opcode,stage->rs1,stage->imm);
+/* pc fetched after the instruction in F : the next one, or with a branch
+ * predictor the predicted path of a control instruction
+ */
+static int
+next_fetch_pc(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->predicted_taken = 0;
+  if (!cpu->bpred || !is_control(stage->opcode)) {
+    return stage->pc + 4;
   }
+  int next_pc = APEX_bpred_predict(cpu->bpred, stage->pc,
+                                   stage->opcode != OP_JUMP);
+  stage->predicted_taken = next_pc != stage->pc + 4;
+  return next_pc;
+}
 
-  if (strcmp(stage->opcode, "HALT") == 0)
-  {
-    printf("HALT");
+/*
+ * Fills the fetch queue from the I-cache : a cycle either waits on the
+ * line being fetched or, once the queue has room for fetch_width
+ * instructions, starts the next access. An access delivers up to
+ * fetch_width instructions the cycle it completes, never past the end
+ * of its line. A pc other than the head of the queue, set by a
+ * taken branch, restarts the queue there.
+ */
+static void
+fetch_fill(APEX_CPU* cpu)
+{
+  if (cpu->pc != cpu->fetch_pc) {
+    cpu->fetch_pc = cpu->pc;
+    cpu->fetch_count = 0;
+    cpu->fetch_wait = 0;
   }
 
-  if(strcmp(stage->opcode, "Due to Halt")==0){
-    printf("%s", stage->opcode);
+  int room = cpu->fetch_queue_size - cpu->fetch_count;
+  int next = cpu->fetch_pc + 4 * cpu->fetch_count;
+  if (cpu->fetch_wait > 0) {
+    if (--cpu->fetch_wait > 0) {
+      return;
+    }
+  }
+  else {
+    if (room < cpu->fetch_width) {
+      return;
+    }
+    int latency = APEX_cache_access(cpu->icache, next >> 2, 0);
+    if (latency > 1) {
+      cpu->fetch_wait = latency - 1;
+      return;
+    }
   }
 
+  int line_size = cpu->icache->config.line_size;
+  int count = (line_size - (next & (line_size - 1))) / 4;
+  if (count > cpu->fetch_width) {
+    count = cpu->fetch_width;
+  }
+  if (count > room) {
+    count = room;
+  }
+  cpu->fetch_count += count;
 }
 
-  /* Debug function which dumps the cpu stage
-   * content
-   *
-   * Note : You are not supposed to edit this function
-   *
-   */
-static void
-print_stage_content(char* name, CPU_Stage* stage)
+/*
+ * F behind the fetch queue : takes the instruction at pc from the head
+ * of the queue, or sends decode a bubble while the queue is empty
+ */
+static int
+fetch_queued(APEX_CPU* cpu)
 {
-  printf("%-15s: pc(%d) ", name, stage->pc);
-  print_instruction(stage);
-  printf("\n");
+  CPU_Stage* stage = &cpu->stage[F];
+
+  fetch_fill(cpu);
+  count_bubble(cpu, F);
+  if (stage->stalled) {
+    cpu->counters.stalls[STALL_HALT_DRAIN] += stage->opcode == OP_HALT;
+    APEX_trace_stage(cpu, F, 0);
+    return 0;
+  }
+  if (cpu->fetch_count == 0) {
+    memset(stage, 0, sizeof(*stage));
+    stage->busy = 1;
+    stage->mem_address = cpu->pc;
+    cpu->fetch_stall_cycles++;
+    if (!cpu->stage[DRF].stalled) {
+      cpu->stage[DRF] = *stage;
+    }
+    APEX_trace_stage(cpu, F, 0);
+    return 0;
+  }
+
+  const APEX_Instruction* current_ins = code_at(cpu, cpu->pc);
+  stage->busy = 0;
+  stage->pc = cpu->pc;
+  stage->opcode = current_ins->opcode;
+  stage->rd = current_ins->rd;
+  stage->rs1 = current_ins->rs1;
+  stage->rs2 = current_ins->rs2;
+  stage->imm = current_ins->imm;
+
+  if (!cpu->stage[DRF].stalled) {
+    cpu->pc = next_fetch_pc(cpu, stage);
+    cpu->fetch_pc += 4;
+    cpu->fetch_count--;
+    cpu->stage[DRF] = cpu->stage[F];
+  }
+
+  APEX_trace_stage(cpu, F, 1);
+  return 0;
 }
 
-  /*
-   *  Fetch Stage of APEX Pipeline
-   *
-   *  Note : You are free to edit this function according to your
-   * 				 implementation
-   */
+/*
+ *  Fetch Stage of APEX Pipeline
+ *
+ *  Note : You are free to edit this function according to your
+ * 				 implementation
+ */
 int
 fetch(APEX_CPU* cpu)
 {
+  if (cpu->icache) {
+    return fetch_queued(cpu);
+  }
+
   CPU_Stage* stage = &cpu->stage[F];
-  if (!stage->busy && !stage->stalled) {  
-      /* Store current PC in fetch latch */
+  count_bubble(cpu, F);
+  if (!stage->busy && !stage->stalled) {
+    /* Store current PC in fetch latch */
     stage->pc = cpu->pc;
 
-      /* Index into code memory using this pc and copy all instruction fields into
-       * fetch latch
-       */
-    APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
-    strcpy(stage->opcode, current_ins->opcode);
+    /* Index into code memory using this pc and copy all instruction fields into
+     * fetch latch
+     */
+    const APEX_Instruction* current_ins = code_at(cpu, cpu->pc);
+    stage->opcode = current_ins->opcode;
     stage->rd = current_ins->rd;
     stage->rs1 = current_ins->rs1;
     stage->rs2 = current_ins->rs2;
     stage->imm = current_ins->imm;
-    stage->rd = current_ins->rd;
 
-    if(!cpu->stage[DRF].stalled)
-    {
+    if (!cpu->stage[DRF].stalled) {
       /* Update PC for next instruction */
-      cpu->pc += 4;
+      cpu->pc = next_fetch_pc(cpu, stage);
 
       /* Copy data from fetch latch to decode latch*/
       cpu->stage[DRF] = cpu->stage[F];
     }
 
+    APEX_trace_stage(cpu, F, 1);
+  }
+  else {
+    cpu->counters.stalls[STALL_HALT_DRAIN] += stage->opcode == OP_HALT;
+    APEX_trace_stage(cpu, F, 0);
+  }
 
-    if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Fetch", stage);
+  return 0;
+}
+
+/*
+ * Bypass network. Where decode reads a source register from : the
+ * register file when the scoreboard has no writer in flight, else the
+ * latch of the youngest one, found from EX2 (the instruction that just
+ * left EX1) down to WB (the one writeback commits next cycle). A load
+ * has its value from MEM2 on, any other writer from EX2 on once its
+ * execute latency has passed. Returns
+ * OPERAND_WAIT while the writer has no value yet.
+ */
+enum
+{
+  OPERAND_REGISTER_FILE = -1,
+  OPERAND_WAIT = -2
+};
+
+static int
+operand_source(const APEX_CPU* cpu, int reg)
+{
+  if (cpu->reg_writers[reg] == 0) {
+    return OPERAND_REGISTER_FILE;
+  }
+  for (int i = EX2; i <= WB; ++i) {
+    const CPU_Stage* writer = &cpu->stage[i];
+    if (writer->busy || writer->stalled || writer->rd != reg ||
+        !writes_register(writer->opcode)) {
+      continue;
+    }
+    if (i < MEM2 && (writer->opcode == OP_LOAD || writer->opcode == OP_LDR)) {
+      return OPERAND_WAIT;
     }
+    if (writer->ex_left > 0) {
+      return OPERAND_WAIT;
+    }
+    return i;
   }
-  else{print_stage_content("Fetch", stage);}
-  
-  
-  return 0;}
-
-  /*
-   *  Decode Stage of APEX Pipeline
-   *
-   *  Note : You are free to edit this function according to your
-   * 				 implementation
-   */
-int
-decode(APEX_CPU* cpu)
+  return OPERAND_REGISTER_FILE;
+}
+
+/*
+ * Finds the source of each of regs, in rs1, rs2, rd order, returning 1
+ * when all are ready. Otherwise stalls F and DRF and notes the register
+ * waited on.
+ */
+static int
+operands_ready(APEX_CPU* cpu, const int* regs, int* sources, int count)
 {
-  CPU_Stage* stage = &cpu->stage[DRF];
+  for (int i = 0; i < count; ++i) {
+    sources[i] = operand_source(cpu, regs[i]);
+    if (sources[i] == OPERAND_WAIT) {
+      cpu->stall_reg = regs[i];
+      cpu->counters.stalls[STALL_RAW_RS1 + i]++;
+      set_decode_stall(cpu, 1);
+      return 0;
+    }
+  }
+  set_decode_stall(cpu, 0);
+  return 1;
+}
 
-  if(stage->stalled) {
-    stage->stalled = 0;
+/* Value of reg from source, counting the bypass path it takes */
+static int
+read_operand(APEX_CPU* cpu, int reg, int source)
+{
+  if (source == OPERAND_REGISTER_FILE) {
+    return cpu->regs[reg];
   }
-  if(stage->forward_enabler==1){
-  cpu->regs[stage->forward_regindex]=stage->forward_buffer;
-  stage->forward_enabler=0;
- // printf("\n\nR%d----%d\n\n",stage->forward_regindex,stage->forward_buffer);
+  int value = cpu->stage[source].buffer;
+  cpu->forwarded[source]++;
+  APEX_trace_forward(cpu, reg, value);
+  return value;
 }
 
-  if (!stage->busy && !stage->stalled) 
-  {
-      
-      /* Read data from register file for store */
-    if (strcmp(stage->opcode, "HALT") == 0) 
-    {
-      cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=0;
-        cpu->stage[F].pc =0;
-        strcpy(cpu->stage[F].opcode, "HALT");
+/*
+ * Decode handlers : read source registers once the bypass network has
+ * them, otherwise stall F and DRF
+ */
+static void
+decode_halt(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  cpu->stage[F].stalled = 1;
+  cpu->stage[DRF].stalled = 0;
+  cpu->stage[F].pc = 0;
+  cpu->stage[F].opcode = OP_HALT;
+}
 
-    }
-    
-    if (strcmp(stage->opcode, "STORE") == 0) 
-    {
-      if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  //Valid bits of regs checked for dependency
-      {
-        cpu->stage[F].stalled=0;
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];
-        stage->rs2_value= cpu->regs[stage->rs2];
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
-    }
+static void
+decode_store(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  int regs[] = { stage->rs1, stage->rs2 };
+  int sources[2];
+  if (operands_ready(cpu, regs, sources, 2)) {
+    stage->rs1_value = read_operand(cpu, stage->rs1, sources[0]);
+    stage->rs2_value = read_operand(cpu, stage->rs2, sources[1]);
+  }
+}
 
-    if (strcmp(stage->opcode, "STR") == 0) 
-    {
-      if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2]&& cpu->regs_valid[stage->rd])  //Valid bits of regs checked for dependency
-      {
-        cpu->stage[F].stalled=0;
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];
-        stage->rs2_value= cpu->regs[stage->rs2];
-        stage->buffer=cpu->regs[stage->rd];
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
-    }
+/* STR stores rd, its third source */
+static void
+decode_str(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  int regs[] = { stage->rs1, stage->rs2, stage->rd };
+  int sources[3];
+  if (operands_ready(cpu, regs, sources, 3)) {
+    stage->rs1_value = read_operand(cpu, stage->rs1, sources[0]);
+    stage->rs2_value = read_operand(cpu, stage->rs2, sources[1]);
+    stage->buffer = read_operand(cpu, stage->rd, sources[2]);
+  }
+}
 
+/* LOAD, ADDL : one register source */
+static void
+decode_reg_imm(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  int regs[] = { stage->rs1 };
+  int sources[1];
+  if (operands_ready(cpu, regs, sources, 1)) {
+    stage->rs1_value = read_operand(cpu, stage->rs1, sources[0]);
+  }
+}
 
-      /* No Register file read needed for MOVC */
-    if (strcmp(stage->opcode, "MOVC") == 0)
-    {
-        
-        cpu->regs_valid[stage->rd]=0;    
-      }
-   
+/* LDR, ADD, SUB, MUL, AND, OR, XOR : two register sources */
+static void
+decode_reg_reg(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  int regs[] = { stage->rs1, stage->rs2 };
+  int sources[2];
+  if (operands_ready(cpu, regs, sources, 2)) {
+    stage->rs1_value = read_operand(cpu, stage->rs1, sources[0]);
+    stage->rs2_value = read_operand(cpu, stage->rs2, sources[1]);
+  }
+}
 
-      if (strcmp(stage->opcode, "LOAD") == 0) 
-      {
+static void
+decode_jump(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  int regs[] = { stage->rs1 };
+  int sources[1];
+  if (operands_ready(cpu, regs, sources, 1)) {
+    stage->rs1_value = read_operand(cpu, stage->rs1, sources[0]);
+  }
+}
 
+static const APEX_Stage_Handler decode_handlers[NUM_OPCODES] = {
+  [OP_STORE] = decode_store,
+  [OP_STR]   = decode_str,
+  [OP_LOAD]  = decode_reg_imm,
+  [OP_LDR]   = decode_reg_reg,
+  [OP_ADD]   = decode_reg_reg,
+  [OP_ADDL]  = decode_reg_imm,
+  [OP_SUB]   = decode_reg_reg,
+  [OP_AND]   = decode_reg_reg,
+  [OP_OR]    = decode_reg_reg,
+  [OP_XOR]   = decode_reg_reg,
+  [OP_MUL]   = decode_reg_reg,
+  [OP_JUMP]  = decode_jump,
+  [OP_HALT]  = decode_halt,
+};
+
+/*
+ *  Decode Stage of APEX Pipeline
+ *
+ *  Note : You are free to edit this function according to your
+ * 				 implementation
+ */
+int
+decode(APEX_CPU* cpu)
+{
+  CPU_Stage* stage = &cpu->stage[DRF];
 
-        
-        if(cpu->regs_valid[stage->rs1])       
-        {
-          cpu->stage[F].stalled=0; 
-          cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];  // 0 is invalid for dependency
-        cpu->regs_valid[stage->rd]=0; 
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
+  count_bubble(cpu, DRF);
+  if (stage->stalled) {
+    stage->stalled = 0;
+  }
+  cpu->stall_reg = -1;
 
+  if (!stage->busy && !stage->stalled) {
+    APEX_Stage_Handler handler = decode_handlers[stage->opcode];
+    if (handler) {
+      handler(cpu, stage);
+    }
+    if (holds_claim(stage)) {
+      cpu->reg_writers[stage->rd]++;
     }
 
-    if (strcmp(stage->opcode, "LDR") == 0) 
-      {
+    /* Copy data from decode latch to execute latch*/
+    cpu->stage[EX1] = cpu->stage[DRF];
 
+    APEX_trace_stage(cpu, DRF, 1);
+  }
+  else {
+    /* A bubble from fetch moves on like an instruction */
+    cpu->stage[EX1] = cpu->stage[DRF];
+    APEX_trace_stage(cpu, DRF, 0);
+  }
 
-        
-        if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])       
-        {
-          cpu->stage[F].stalled=0; 
-          cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];  // 0 is invalid for dependency
-        stage->rs2_value= cpu->regs[stage->rs2];
-        cpu->regs_valid[stage->rd]=0; 
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
+  return 0;
+}
 
-    }
+/*
+ * Execute1 handlers : compute ALU results, memory addresses and branch
+ * targets. Instructions go through EX1 in program order, so the zero
+ * flag set there is always the one BZ / BNZ must see in EX1.
+ */
+static void
+set_zero_flag(APEX_CPU* cpu, int value)
+{
+  cpu->zero = (value == 0);
+}
 
-    if (strcmp(stage->opcode, "JUMP") == 0) 
-    {
-      
-    stage->rs1_value= cpu->regs[stage->rs1];
-    }
+static void
+execute1_store(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->mem_address = stage->rs2_value + stage->imm;
+}
 
-    if (strcmp(stage->opcode, "ADD") == 0) 
-    {stage->math_ins++;
-
-      
-      if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  
-      {
-        cpu->stage[F].stalled=0; 
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];//printf("pPPPASSSSmake\n");
-        stage->rs2_value= cpu->regs[stage->rs2];
-        cpu->regs_valid[stage->rd]=0;
-        
-      }
-else
-    {
-      cpu->stage[F].stalled=1; 
-      cpu->stage[DRF].stalled=1;
-    }
+/* STR, LDR */
+static void
+execute1_reg_address(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->mem_address = stage->rs2_value + stage->rs1_value;
+}
 
-    }
+static void
+execute1_load(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->mem_address = stage->imm + stage->rs1_value;
+}
 
-     if (strcmp(stage->opcode, "ADDL") == 0) 
-    {stage->math_ins++;
-
-      
-      if(cpu->regs_valid[stage->rs1])  
-      {
-        cpu->stage[F].stalled=0; 
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];//printf("pPPPASSSSmake\n");
-       
-        cpu->regs_valid[stage->rd]=0;
-        
-      }
-else
-    {
-      cpu->stage[F].stalled=1; 
-      cpu->stage[DRF].stalled=1;
-    }
+static void
+execute1_movc(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->imm;
+}
 
-    }
+static void
+execute1_add(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs1_value + stage->rs2_value;
+  set_zero_flag(cpu, stage->buffer);
+}
 
-    if (strcmp(stage->opcode, "SUB") == 0) 
-    {stage->math_ins++;
-      
-      if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  
-      {
-        cpu->stage[F].stalled=0; 
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];
-        stage->rs2_value= cpu->regs[stage->rs2];
-        cpu->regs_valid[stage->rd]=0;
-        
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
-    }
+static void
+execute1_addl(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs1_value + stage->imm;
+  set_zero_flag(cpu, stage->buffer);
+}
 
-    if (strcmp(stage->opcode, "AND") == 0) 
-      {
-        if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  
-        {
-          cpu->stage[F].stalled=0; 
-          cpu->stage[DRF].stalled=0;
-          stage->rs1_value= cpu->regs[stage->rs1];
-          stage->rs2_value= cpu->regs[stage->rs2];
-          cpu->regs_valid[stage->rd]=0;
-        }
-        else
-        {
-          cpu->stage[F].stalled=1; 
-          cpu->stage[DRF].stalled=1;
-        }  
-      }
+static void
+execute1_sub(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs1_value - stage->rs2_value;
+  set_zero_flag(cpu, stage->buffer);
+}
 
-      if (strcmp(stage->opcode, "OR") == 0) 
-      {
-        
-        if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  
-        {
-          cpu->stage[F].stalled=0; 
-          cpu->stage[DRF].stalled=0;
-          stage->rs1_value= cpu->regs[stage->rs1];
-          stage->rs2_value= cpu->regs[stage->rs2];
-          cpu->regs_valid[stage->rd]=0;
-        }
-        else
-        {
-          cpu->stage[F].stalled=1; 
-          cpu->stage[DRF].stalled=1;
-        } 
-      }
-      if (strcmp(stage->opcode, "XOR") == 0) 
-      {
-        
-      if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  // For Dependency
-      {
-        cpu->stage[F].stalled=0; 
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];
-        stage->rs2_value= cpu->regs[stage->rs2];
-        cpu->regs_valid[stage->rd]=0;  
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
+static void
+execute1_mul(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs1_value * stage->rs2_value;
+  set_zero_flag(cpu, stage->buffer);
+}
 
-    }
-    if (strcmp(stage->opcode, "MUL") == 0) 
-    {
-      stage->math_ins++;
-      if(cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2])  // For Dependency
-      {
-        cpu->stage[F].stalled=0; 
-        cpu->stage[DRF].stalled=0;
-        stage->rs1_value= cpu->regs[stage->rs1];
-        stage->rs2_value= cpu->regs[stage->rs2];
-        cpu->regs_valid[stage->rd]=0; 
-        
-      }
-      else
-      {
-        cpu->stage[F].stalled=1; 
-        cpu->stage[DRF].stalled=1;
-      }
+static void
+execute1_and(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs2_value & stage->rs1_value;
+}
 
+static void
+execute1_or(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs2_value | stage->rs1_value;
+}
 
-    }
-    if( strcmp(stage->opcode, "BNZ") == 0) 
-      {
-      
-      if((cpu->stage[WB].math_ins == 1) || (cpu->stage[MEM1].math_ins == 1)||(cpu->stage[MEM2].math_ins == 1)) 
-      {
-        stage->stalled = 1;
-      } else {
-        stage->stalled = 0;
-      }
-    }
+static void
+execute1_xor(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = stage->rs2_value ^ stage->rs1_value;
+}
 
-    if(strcmp(stage->opcode, "BZ") == 0) 
-      {
-      
-      if((cpu->stage[WB].math_ins == 1) || (cpu->stage[MEM1].math_ins == 1)||(cpu->stage[MEM2].math_ins == 2)) 
-      {
-        stage->stalled = 1;
-      } else {
-        stage->stalled = 0;
-      }
-    }
+static void
+execute1_halt(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  squash_to_halt(&cpu->stage[DRF]);
+  squash_to_halt(&cpu->stage[F]);
+}
 
+static void
+execute1_bz(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  if (cpu->zero == 1) {
+    stage->mem_address = stage->pc + stage->imm;
+  }
+  else {
+    stage->mem_address = 0;
+  }
+}
 
-      /* Copy data from decode latch to execute latch*/
-    cpu->stage[EX1] = cpu->stage[DRF];
+static void
+execute1_bnz(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  if (!cpu->zero) {
+    stage->mem_address = stage->pc + stage->imm;
+  }
+  else {
+    stage->mem_address = 0;
+  }
+}
 
-    if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Decode/RF", stage);
-    }
+static const APEX_Stage_Handler execute1_handlers[NUM_OPCODES] = {
+  [OP_MOVC]  = execute1_movc,
+  [OP_STORE] = execute1_store,
+  [OP_STR]   = execute1_reg_address,
+  [OP_LOAD]  = execute1_load,
+  [OP_LDR]   = execute1_reg_address,
+  [OP_ADD]   = execute1_add,
+  [OP_ADDL]  = execute1_addl,
+  [OP_SUB]   = execute1_sub,
+  [OP_AND]   = execute1_and,
+  [OP_OR]    = execute1_or,
+  [OP_XOR]   = execute1_xor,
+  [OP_MUL]   = execute1_mul,
+  [OP_BZ]    = execute1_bz,
+  [OP_BNZ]   = execute1_bnz,
+  [OP_HALT]  = execute1_halt,
+};
+
+/* Cycles from EX1 until the result of opcode is ready. Memory
+ * opcodes compute only an address here, their latency is in MEM1.
+ */
+static int
+execute_latency(const APEX_CPU* cpu, int opcode)
+{
+  if (!cpu->latency || is_memory_access(opcode)) {
+    return 1;
+  }
+  return cpu->latency->cycles[opcode];
+}
+
+/* Runs the instruction in EX1 and starts its latency */
+static void
+execute1_start(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_Stage_Handler handler = execute1_handlers[stage->opcode];
+  if (handler) {
+    handler(cpu, stage);
   }
+  stage->ex_left = execute_latency(cpu, stage->opcode) - 1;
+  stage->started = 1;
+}
 
-   else
-   {  
-   if(ENABLE_DEBUG_MESSAGES)
-   {
-      printf("Decode/RF        : EMPTY\n");
-    }
-  } 
-
-  return 0;
+/*
+ * Called instead of execute1() while EX2 is held : the instruction in
+ * EX1 stays there but starts executing if its unit is free, that is
+ * pipelined or not the one still busy in EX2
+ */
+static void
+execute1_overlap(APEX_CPU* cpu)
+{
+  CPU_Stage* stage = &cpu->stage[EX1];
+  const CPU_Stage* held = &cpu->stage[EX2];
+  if (stage->busy || stage->stalled || stage->started ||
+      (stage->opcode == held->opcode && cpu->latency &&
+       !cpu->latency->pipelined[stage->opcode])) {
+    APEX_trace_stage(cpu, EX1, stage->busy || stage->stalled ?
+                               TRACE_STAGE_IDLE : TRACE_STAGE_HELD);
+    return;
+  }
+  execute1_start(cpu, stage);
+  APEX_trace_stage(cpu, EX1, 1);
 }
 
-  /*
-   *  Execute Stage of APEX Pipeline
-   *
-   *  Note : You are free to edit this function according to your
-   * 				 implementation
-   */
+/*
+ *  Execute Stage of APEX Pipeline
+ *
+ *  Note : You are free to edit this function according to your
+ * 				 implementation
+ */
 int
 execute1(APEX_CPU* cpu)
 {
   CPU_Stage* stage = &cpu->stage[EX1];
+  count_bubble(cpu, EX1);
   if (!stage->busy && !stage->stalled) {
-
-    if((cpu->stage[DRF].rs1==stage->rd)||(cpu->stage[DRF].rs2==stage->rd)){
-      (cpu->stage[DRF].forward_enabler)=1;
-
-    }
-
-
-
-      /* Store */
-    if (strcmp(stage->opcode, "STORE") == 0) {
-      stage->mem_address = (stage->rs2_value) + (stage->imm);
-
-
+    if (!stage->started) {
+      execute1_start(cpu, stage);
     }
+    stage->started = 0;
 
-    if (strcmp(stage->opcode, "STR") == 0) 
-    {
-      stage->mem_address=(stage->rs2_value)+(stage->rs1_value);
-    }
-
-      /* MOVC */
-    if (strcmp(stage->opcode, "MOVC") == 0) {
-     stage->buffer = stage->imm;
-   }
-
-   if (strcmp(stage->opcode, "LOAD") == 0) 
-   {
-    stage->mem_address = (stage->imm)+(stage->rs1_value);
+    /* Copy data from Execute latch to Memory latch*/
+    cpu->stage[EX2] = cpu->stage[EX1];
 
+    APEX_trace_stage(cpu, EX1, 1);
   }
-
-
-   if (strcmp(stage->opcode, "LDR") == 0) 
-   {
-    stage->mem_address = (stage->rs2_value)+(stage->rs1_value);
-
+  else {
+    cpu->stage[EX2] = cpu->stage[EX1];    APEX_trace_stage(cpu, EX1, 0);
   }
-
-  if (strcmp(stage->opcode, "ADD") == 0) 
-  {
-     stage->buffer = (stage->rs1_value) + (stage->rs2_value);
-     if(stage->buffer==0)
-   cpu->zero=1;
- else
-   cpu->zero=0;
-  
- }
-
-if (strcmp(stage->opcode, "ADDL") == 0) 
-  {
-     stage->buffer = (stage->rs1_value) + (stage->imm);
-     if(stage->buffer==0)
-   cpu->zero=1;
- else
-   cpu->zero=0;
-  
- }
-
- if (strcmp(stage->opcode, "SUB") == 0) 
- {
-  stage->buffer = (stage->rs1_value) - (stage->rs2_value);
-  if(stage->buffer==0)
-   cpu->zero=1;
- else
-   cpu->zero=0;
-    
+  return 0;
 }
 
-if (strcmp(stage->opcode, "AND") == 0) 
+/*
+ * Execute2 handlers : resolve control flow
+ */
+static void
+execute2_halt(APEX_CPU* cpu, CPU_Stage* stage)
 {
-  stage->buffer = stage->rs2_value&stage->rs1_value;
-  
+  squash_to_halt(&cpu->stage[DRF]);
+  squash_to_halt(&cpu->stage[F]);
+  squash_issued(cpu, &cpu->stage[EX1]);
 }
 
- 
-
-if (strcmp(stage->opcode, "OR") == 0) 
+/* Turns the instructions fetched after the branch at branch_pc, in EX2,
+ * into bubbles. Stalls they caused, on a dependency or behind a HALT on
+ * the wrong path, go with them so fetch restarts at the target.
+ */
+static void
+flush_front_end(APEX_CPU* cpu, int branch_pc)
 {
-  stage->buffer = stage->rs2_value | stage->rs1_value;
- 
+  cpu->counters.flushed += holds_instruction(&cpu->stage[DRF]) +
+                           holds_instruction(&cpu->stage[EX1]);
+  release_claim(cpu, &cpu->stage[EX1]);
+  cpu->stage[F].opcode = OP_FLUSH;
+  cpu->stage[DRF].opcode = OP_FLUSH;
+  cpu->stage[EX1].opcode = OP_FLUSH;
+  cpu->stage[F].pc = cpu->stage[DRF].pc = cpu->stage[EX1].pc = 0;
+  for (int i = F; i <= EX1; ++i) {
+    cpu->stage[i].stalled = 0;
+    cpu->stage[i].mem_address = branch_pc;
+  }
+  cpu->stage[EX1].started = 0;
+  cpu->stage[EX1].ex_left = 0;
 }
 
-if (strcmp(stage->opcode, "XOR") == 0) 
+/*
+ * Squashes the wrong path behind the mispredicted branch at branch_pc,
+ * in EX2 : DRF and EX1 become bubbles that write nothing, the
+ * destination the one in EX1 claimed at decode is released, and F,
+ * which may have been stalled by a decode on the wrong path, fetches
+ * again.
+ */
+static void
+squash_wrong_path(APEX_CPU* cpu, int branch_pc)
 {
-  stage->buffer = stage->rs2_value ^ stage->rs1_value;
-  
+  cpu->counters.flushed += holds_instruction(&cpu->stage[DRF]) +
+                           holds_instruction(&cpu->stage[EX1]);
+  release_claim(cpu, &cpu->stage[EX1]);
+  for (int i = F; i <= EX1; ++i) {
+    memset(&cpu->stage[i], 0, sizeof(cpu->stage[i]));
+    if (i != F) {
+      cpu->stage[i].busy = 1;
+      cpu->stage[i].bubble = BUBBLE_FLUSH;
+      cpu->stage[i].mem_address = branch_pc;
+    }
+  }
 }
 
-if (strcmp(stage->opcode, "MUL") == 0) 
+/*
+ * Resolves a control instruction against its prediction, redirecting
+ * fetch to next_pc on a misprediction. Fetch went on at the fall-through
+ * or the branch target, but only the predictor knows the target of a
+ * JUMP predicted taken. Predictions queue from DRF to EX2, three at
+ * most, well within the predictor's queue.
+ */
+static void
+resolve_predicted(APEX_CPU* cpu, CPU_Stage* stage, int next_pc)
 {
-  stage->buffer = stage->rs1_value * stage->rs2_value;
-  if(stage->buffer==0)
-   cpu->zero=1;
- else
-   cpu->zero=0;
-  
-
-
-}
-
-
-if(strcmp(stage->opcode, "HALT") == 0)
-     {
-      
-      cpu->stage[DRF].pc = 0;
-       strcpy(cpu->stage[DRF].opcode, "HALT");
-       cpu->stage[DRF].stalled = 1;
-      cpu->stage[F].stalled = 1;
-       strcpy(cpu->stage[F].opcode, "HALT");
-      cpu->stage[F].pc = 0;
-      
-    }
-
-    
-
-    if (strcmp(stage->opcode, "BZ") == 0)  //*bnz
-   {  
-    
-    if(cpu->zero==1)
-    {
-      
-      stage->mem_address = stage->pc + stage->imm;
-      
-      cpu->zero=0;
-  } else {
-    stage->mem_address = 0;
+  int conditional = stage->opcode != OP_JUMP;
+  int predicted_pc = stage->pc + 4;
+  if (stage->predicted_taken) {
+    predicted_pc = conditional ? stage->pc + stage->imm : -1;
   }
+  if (APEX_bpred_resolve(cpu->bpred, stage->pc, conditional, next_pc,
+                         predicted_pc)) {
+    cpu->pc = next_pc;
+    squash_wrong_path(cpu, stage->pc);
   }
+}
 
- if (strcmp(stage->opcode, "BNZ") == 0)
-   {  
-    
-    if((!cpu->zero)==1)
-    {
-      
-      stage->mem_address = stage->pc + stage->imm;
-    
-      cpu->zero=0;
-  } else {
-    stage->mem_address = 0;
-  }
+static void
+execute2_jump(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  if (cpu->bpred) {
+    resolve_predicted(cpu, stage, stage->rs1_value + stage->imm);
+    return;
   }
-
-
-
-      /* Copy data from Execute latch to Memory latch*/
-cpu->stage[EX2] = cpu->stage[EX1];
-
-if (ENABLE_DEBUG_MESSAGES) {
-  print_stage_content("Execute1", stage);
-}
+  cpu->pc = stage->rs1_value + stage->imm;
+  flush_front_end(cpu, stage->pc);
 }
 
- else
-  {
-   cpu->stage[EX2] = cpu->stage[EX1];
-  if(ENABLE_DEBUG_MESSAGES)
-   {
-      printf("Execute        : EMPTY\n");
-    } 
-  } 
-  return 0;
+/* BZ, BNZ : a taken branch flushes F, DRF and EX1, unless predicted */
+static void
+execute2_branch(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  if (cpu->bpred) {
+    resolve_predicted(cpu, stage, stage->mem_address != 0 ?
+                                  stage->mem_address : stage->pc + 4);
+  }
+  else if (stage->mem_address != 0) {
+    cpu->pc = stage->mem_address;
+    flush_front_end(cpu, stage->pc);
+  }
 }
 
+static const APEX_Stage_Handler execute2_handlers[NUM_OPCODES] = {
+  [OP_JUMP]  = execute2_jump,
+  [OP_BZ]    = execute2_branch,
+  [OP_BNZ]   = execute2_branch,
+  [OP_HALT]  = execute2_halt,
+};
+
+/*
+ * Returns 1 when EX2 holds an instruction whose result is not ready :
+ * MEM1 receives a bubble and EX1 may only start its own instruction.
+ */
 int
 execute2(APEX_CPU* cpu)
 {
   CPU_Stage* stage = &cpu->stage[EX2];
-  if(strcmp(stage->opcode, "LOAD") && strcmp(stage->opcode,"LDR") != 0) {
-      cpu->regs_valid[stage->rd] = 1;
-      {
-          cpu->regs[stage->rd] = stage->buffer;
-      }
-  }
+  count_bubble(cpu, EX2);
   if (!stage->busy && !stage->stalled) {
-  
-    
-
-    if(strcmp(stage->opcode, "HALT") == 0)
-     {
-      
-      cpu->stage[DRF].pc = 0;
-       strcpy(cpu->stage[DRF].opcode, "HALT");
-       cpu->stage[DRF].stalled = 1;
-      cpu->stage[F].stalled = 1;
-       strcpy(cpu->stage[F].opcode, "HALT");
-      cpu->stage[F].pc = 0;
-      cpu->stage[EX1].stalled = 1;
-       strcpy(cpu->stage[EX1].opcode, "HALT");
-      cpu->stage[EX1].pc = 0;
-      
-    }
 
-    if (strcmp(stage->opcode, "JUMP") == 0) 
-  { 
-    cpu->pc = stage->rs1_value + stage->imm;
-  }
-    if (strcmp(stage->opcode, "BZ") == 0) 
-    {
-      if(stage->mem_address != 0) {
-        cpu->pc =stage->mem_address;
-
-
-      strcpy(cpu->stage[F].opcode, "flush");        
-        
-          
-        cpu->stage[DRF].pc = cpu->stage[F].pc= 0;
-         strcpy(cpu->stage[DRF].opcode, "flushflush");
-         //strcpy(cpu->stage[EX2].opcode, "BZ");
-         strcpy(cpu->stage[EX1].opcode, "flush");
-         cpu->stage[EX1].pc = 0;
-        if(stage->imm < 0) {
-          cpu->ins_completed = (cpu->ins_completed + (stage->imm/4))-1;
-        }
-
-        else{
-          cpu->ins_completed = (cpu->ins_completed - (stage->imm/4));
-        }
-        
-      }
+    if (stage->ex_left > 0) {
+      memset(&cpu->stage[MEM1], 0, sizeof(cpu->stage[MEM1]));
+      cpu->stage[MEM1].busy = 1;
+      cpu->stage[MEM1].bubble = BUBBLE_EXECUTE;
+      cpu->stage[MEM1].mem_address = stage->pc;
+      APEX_trace_stage(cpu, EX2, TRACE_STAGE_HELD);
+      return 1;
     }
 
-      if (strcmp(stage->opcode, "BNZ") == 0) 
-    {
-      if(stage->mem_address != 0) {
-        cpu->pc =stage->mem_address;
-
-
-        strcpy(cpu->stage[F].opcode, "flush");
-         strcpy(cpu->stage[DRF].opcode, "flush");
-         strcpy(cpu->stage[EX1].opcode, "flush");
-         //strcpy(cpu->stage[EX2].opcode, "");
-          cpu->stage[DRF].pc =cpu->stage[EX1].pc=cpu->stage[F].pc   = 0;
-        if(stage->imm < 0) {
-          cpu->ins_completed = (cpu->ins_completed + (stage->imm/4))-1;
-        }
-
-        else{
-          cpu->ins_completed = (cpu->ins_completed - (stage->imm/4));
-        }
-        
-      }
+    APEX_Stage_Handler handler = execute2_handlers[stage->opcode];
+    if (handler) {
+      handler(cpu, stage);
     }
 
+    cpu->stage[MEM1] = cpu->stage[EX2];
 
-    if(cpu->stage[DRF].forward_enabler==1){
-    cpu->regs_valid[stage->rd]=1;
-    cpu->stage[DRF].forward_regindex=stage->rd;
-    cpu->stage[DRF].forward_buffer = stage->buffer;
-  //printf("\n\t----!!!!!rd ex2 %d----rd buff %d----",stage->rd,stage->buffer);
-
+    APEX_trace_stage(cpu, EX2, 1);
+  }
+  else {
+    cpu->stage[MEM1] = cpu->stage[EX2];
+    APEX_trace_stage(cpu, EX2, 0);
+  }
+  return 0;
 }
 
+/*
+ * Data memory as seen by memory1 : the core's own array, or the shared
+ * memory of its multi-core system. An L1 hit of one cycle fits in MEM1,
+ * longer accesses add their extra cycles to the delay, as do accesses
+ * the latency table makes longer without a cache, and a core then
+ * waits for a port of the shared memory from the cycle its access
+ * leaves the cache.
+ */
+static int
+data_delay(APEX_CPU* cpu, const CPU_Stage* stage)
+{
+  int delay = 0;
+  if (cpu->dcache) {
+    int write = stage->opcode == OP_STORE || stage->opcode == OP_STR;
+    delay = APEX_cache_access(cpu->dcache, stage->mem_address, write) - 1;
+  }
+  else if (cpu->latency) {
+    delay = cpu->latency->cycles[stage->opcode] - 1;
+  }
+  if (cpu->multicore) {
+    delay += APEX_multicore_delay(cpu->multicore, cpu->core_id,
+                                  cpu->clock + delay);
+  }
+  return delay;
+}
 
+static int
+data_load(APEX_CPU* cpu, int address)
+{
+  if (cpu->multicore) {
+    return APEX_multicore_load(cpu->multicore, cpu->core_id, cpu->clock,
+                               address);
+  }
+  return cpu->data_memory[address];
+}
 
- 
+static void
+data_store(APEX_CPU* cpu, int address, int value)
+{
+  if (cpu->multicore) {
+    APEX_multicore_store(cpu->multicore, cpu->core_id, cpu->clock, address,
+                         value);
+    return;
+  }
+  cpu->data_memory[address] = value;
+}
 
+/*
+ * Memory1 handlers : access data memory
+ */
+static void
+memory1_store(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  data_store(cpu, stage->mem_address, stage->rs1_value);
+  cpu->counters.stores++;
+}
 
+static void
+memory1_str(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  data_store(cpu, stage->mem_address, stage->buffer);
+  cpu->counters.stores++;
+}
 
+/* LOAD, LDR */
+static void
+memory1_load(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  stage->buffer = data_load(cpu, stage->mem_address);
+  cpu->counters.loads++;
+}
 
-    cpu->stage[MEM1] = cpu->stage[EX2];
+static void
+memory1_halt(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  squash_issued(cpu, &cpu->stage[EX1]);
+  squash_issued(cpu, &cpu->stage[EX2]);
+  squash_to_halt(&cpu->stage[DRF]);
+  squash_to_halt(&cpu->stage[F]);
+}
 
-    if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Execute2", stage);
-    }
+static const APEX_Stage_Handler memory1_handlers[NUM_OPCODES] = {
+  [OP_STORE] = memory1_store,
+  [OP_STR]   = memory1_str,
+  [OP_LOAD]  = memory1_load,
+  [OP_LDR]   = memory1_load,
+  [OP_HALT]  = memory1_halt,
+};
+
+/*
+ * Returns 1 while the access in MEM1 has to wait. The first cycle of an
+ * access sets mem_wait to its delay, each later one counts it down and
+ * the access completes in the cycle it reaches 0.
+ */
+static int
+memory1_wait(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  if (cpu->mem_wait > 0) {
+    return --cpu->mem_wait > 0;
   }
-
-  else{cpu->stage[MEM1] = cpu->stage[EX2];
-
-    if (ENABLE_DEBUG_MESSAGES) {
-      printf("Execute2        : EMPTY\n");
-    }}
-  return 0;
+  cpu->mem_wait = data_delay(cpu, stage);
+  return cpu->mem_wait > 0;
 }
 
-  /*
-   *  Memory Stage of APEX Pipeline
-   *
-   *  Note : You are free to edit this function according to your
-   * 				 implementation
-   */
+/*
+ *  Memory Stage of APEX Pipeline. Returns 1 when MEM1 holds its access
+ *  this cycle : MEM2 receives a bubble and the stages above MEM1 must
+ *  not run.
+ *
+ *  Note : You are free to edit this function according to your
+ * 				 implementation
+ */
 int
 memory1(APEX_CPU* cpu)
 {
   CPU_Stage* stage = &cpu->stage[MEM1];
+  count_bubble(cpu, MEM1);
   if (!stage->busy && !stage->stalled) {
 
-  if((cpu->stage[DRF].rs1==stage->rd)||(cpu->stage[DRF].rs2==stage->rd)){
-      (cpu->stage[DRF].forward_enabler)=1;
-    }
-
-
-      /* Store */
-    if (strcmp(stage->opcode, "STORE") == 0) {
-
-      cpu->data_memory[stage->mem_address] = stage->rs1_value;
-        //printf("----------ADDRESSSSS-------%d---------\n",);
-
-    }
-
-       /* Store */
-    if (strcmp(stage->opcode, "STR") == 0) {
-
-      cpu->data_memory[stage->mem_address] = stage->buffer;
-        //printf("----------ADDRESSSSS-------%d---------\n",);
-
-    }
-
-
-    if (strcmp(stage->opcode, "LOAD") == 0) 
-    {
-      stage->buffer= cpu->data_memory[stage->mem_address];
-    }
-
-    if (strcmp(stage->opcode, "LDR") == 0) 
-    {
-      stage->buffer= cpu->data_memory[stage->mem_address];
+    int fault = is_data_fault(stage);
+    if (!fault && is_memory_access(stage->opcode) &&
+        memory1_wait(cpu, stage)) {
+      memset(&cpu->stage[MEM2], 0, sizeof(cpu->stage[MEM2]));
+      cpu->stage[MEM2].busy = 1;
+      cpu->stage[MEM2].bubble = BUBBLE_MEMORY;
+      cpu->stage[MEM2].mem_address = stage->pc;
+      APEX_trace_stage(cpu, MEM1, TRACE_STAGE_HELD);
+      return 1;
     }
 
-
-    if(strcmp(stage->opcode, "HALT") == 0) 
-  {   //printf("HALTTTT___");
-      cpu->stage[EX1].pc = cpu->stage[EX2].pc =cpu->stage[DRF].pc = cpu->stage[F].pc =0;
-      strcpy(cpu->stage[EX1].opcode, "HALT");
-      strcpy(cpu->stage[EX2].opcode, "HALT");
-      strcpy(cpu->stage[DRF].opcode, "HALT");
-      cpu->stage[EX1].stalled=cpu->stage[EX2].stalled = cpu->stage[DRF].stalled = cpu->stage[F].stalled = 1;
-       strcpy(cpu->stage[F].opcode, "HALT");
-     
-      
-      
+    /* A fault squashes what follows it, as a HALT does, and ends the
+     * run from WB
+     */
+    APEX_Stage_Handler handler = fault ? memory1_halt :
+                                 memory1_handlers[stage->opcode];
+    if (handler) {
+      handler(cpu, stage);
     }
-        
 
-
-   
-      /* Copy data from decode latch to execute latch*/
+    /* Copy data from decode latch to execute latch*/
     cpu->stage[MEM2] = cpu->stage[MEM1];
 
-    if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Memory1", stage);
-    }
+    APEX_trace_stage(cpu, MEM1, 1);
   }
-   else
-   {
-   cpu->stage[MEM2] = cpu->stage[MEM1];
-    if(ENABLE_DEBUG_MESSAGES)
-    {
-       printf("Memory1         : EMPTY\n");
-    } 
+  else {
+    cpu->stage[MEM2] = cpu->stage[MEM1];    APEX_trace_stage(cpu, MEM1, 0);
   }
-  
+
   return 0;
 }
 
+/*
+ * Memory2 handlers
+ */
+static void
+memory2_halt(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  squash_issued(cpu, &cpu->stage[EX1]);
+  squash_issued(cpu, &cpu->stage[EX2]);
+  squash_to_halt(&cpu->stage[DRF]);
+  squash_to_halt(&cpu->stage[F]);
+  release_claim(cpu, &cpu->stage[MEM1]);
+  cpu->stage[MEM1].opcode = OP_HALT;
+  cpu->stage[MEM1].stalled = 1;
+}
+
+static const APEX_Stage_Handler memory2_handlers[NUM_OPCODES] = {
+  [OP_HALT]  = memory2_halt,
+};
+
 int
 memory2(APEX_CPU* cpu)
 {
   CPU_Stage* stage = &cpu->stage[MEM2];
-    if(strcmp(stage->opcode, "LOAD") && strcmp(stage->opcode,"LDR") == 0) {
-        cpu->regs_valid[stage->rd] = 1;
-        {
-            cpu->regs[stage->rd] = stage->buffer;
-        }
-    }
+  count_bubble(cpu, MEM2);
   if (!stage->busy && !stage->stalled) {
 
- if(strcmp(stage->opcode, "HALT") == 0) 
-  {
-      cpu->stage[EX1].pc = cpu->stage[EX2].pc =cpu->stage[DRF].pc = cpu->stage[F].pc =0;
-      strcpy(cpu->stage[EX1].opcode, "HALT");
-      strcpy(cpu->stage[EX2].opcode, "HALT");
-      strcpy(cpu->stage[DRF].opcode, "HALT");
-      cpu->stage[MEM1].stalled = cpu->stage[EX1].stalled=cpu->stage[EX2].stalled = cpu->stage[DRF].stalled = cpu->stage[F].stalled = 1;
-       strcpy(cpu->stage[F].opcode, "HALT");strcpy(cpu->stage[MEM1].opcode, "HALT");
-     
-      
-      
+    APEX_Stage_Handler handler = memory2_handlers[stage->opcode];
+    if (handler) {
+      handler(cpu, stage);
     }
 
-     if(cpu->stage[DRF].forward_enabler==1){
+    /* Copy data from decode latch to execute latch*/
+    cpu->stage[WB] = cpu->stage[MEM2];
 
-    cpu->regs_valid[stage->rd]=1;
-    cpu->stage[DRF].forward_regindex=stage->rd;
-    cpu->stage[DRF].forward_buffer = stage->buffer;
- // printf("\n\t--pcDRF-%s---currentPC--%s----!!!!!rd MEM2 %d----rd buff %d----",cpu->stage[DRF].opcode,stage->opcode,stage->rd,stage->buffer);
+    APEX_trace_stage(cpu, MEM2, 1);
+  }
+  else {
+    cpu->stage[WB] = cpu->stage[MEM2];
+    APEX_trace_stage(cpu, MEM2, 0);
+  }
+  return 0;
 }
 
+/*
+ * Writeback handlers : update the register file, the only place it is
+ * written, and release a decode stall
+ */
 
+static void
+writeback_reg(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  cpu->regs[stage->rd] = stage->buffer;
+  cpu->reg_writers[stage->rd]--;
+  set_decode_stall(cpu, 0);
+}
 
- 
-
-      /* Copy data from decode latch to execute latch*/
-    cpu->stage[WB] = cpu->stage[MEM2];
-
-    if (ENABLE_DEBUG_MESSAGES) {
-      print_stage_content("Memory2", stage);
-    }
+static void
+writeback_halt(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  squash_to_halt(&cpu->stage[F]);
+  squash_to_halt(&cpu->stage[DRF]);
+  for (int i = EX1; i < WB; ++i) {
+    squash_issued(cpu, &cpu->stage[i]);
   }
-
-  else{cpu->stage[WB] = cpu->stage[MEM2];
-
-    if (ENABLE_DEBUG_MESSAGES) {
-      printf("Memory2         : EMPTY\n");
-    }}
-  return 0;
+  cpu->finished = 1;
 }
 
-  /*
-   *  Writeback Stage of APEX Pipeline
-   *
-   *  Note : You are free to edit this function according to your
-   * 				 implementation
-   */
+static const APEX_Stage_Handler writeback_handlers[NUM_OPCODES] = {
+  [OP_MOVC]  = writeback_reg,
+  [OP_LOAD]  = writeback_reg,
+  [OP_LDR]   = writeback_reg,
+  [OP_ADD]   = writeback_reg,
+  [OP_ADDL]  = writeback_reg,
+  [OP_SUB]   = writeback_reg,
+  [OP_MUL]   = writeback_reg,
+  [OP_AND]   = writeback_reg,
+  [OP_OR]    = writeback_reg,
+  [OP_XOR]   = writeback_reg,
+  [OP_HALT]  = writeback_halt,
+};
+
+/*
+ *  Writeback Stage of APEX Pipeline. Commits the instruction in WB,
+ *  counting it unless it is a bubble. One fetched past the end of code
+ *  memory ends the run, as a HALT does, and so does a data memory fault,
+ *  which commits nothing.
+ *
+ *  Note : You are free to edit this function according to your
+ * 				 implementation
+ */
 int
 writeback(APEX_CPU* cpu)
 {
   CPU_Stage* stage = &cpu->stage[WB];
-  if (!stage->busy && !stage->stalled) {
-    
-
-
-      /* Update register file */
-    if (strcmp(stage->opcode, "MOVC") == 0) {
-
-     cpu->regs[stage->rd] = stage->buffer;
-     //cpu->regs_valid[stage->rd]=1;
-     cpu->stage[DRF].stalled=0;
-     cpu->stage[F].stalled=0;  
-    // printf("\ncpu->regs[stage->rd] %d\n",cpu->regs[0]);
-   }
-
-
-
-   if (strcmp(stage->opcode, "LOAD") == 0) 
-   {
-    cpu->regs[stage->rd] = stage->buffer;
-    //cpu->regs_valid[stage->rd]=1;
-    cpu->stage[DRF].stalled=0;
-    cpu->stage[F].stalled=0; 
-
+  count_bubble(cpu, WB);
+  if (stage->opcode == OP_FLUSH ||
+      (stage->busy && stage->bubble == BUBBLE_FLUSH)) {
+    cpu->counters.stalls[STALL_BRANCH_FLUSH]++;
   }
+  if (holds_instruction(stage)) {
+
+    if (stage->opcode == OP_NONE && !in_code(cpu, stage->pc)) {
+      cpu->finished = 1;
+      APEX_trace_stage(cpu, WB, 0);
+      return 0;
+    }
+    if (is_data_fault(stage)) {
+      release_claim(cpu, stage);
+      writeback_halt(cpu, stage);
+      cpu->faulted = 1;
+      cpu->pc = stage->pc;
+      APEX_trace_stage(cpu, WB, 0);
+      return 0;
+    }
 
-   if (strcmp(stage->opcode, "LDR") == 0) 
-   {
-    cpu->regs[stage->rd] = stage->buffer;
-    //cpu->regs_valid[stage->rd]=1;
-    cpu->stage[DRF].stalled=0;
-    cpu->stage[F].stalled=0; 
+    APEX_Stage_Handler handler = writeback_handlers[stage->opcode];
+    if (handler) {
+      handler(cpu, stage);
+    }
 
-  }
+    cpu->ins_completed++;
+    cpu->counters.retired[stage->opcode]++;
 
-  if (strcmp(stage->opcode, "ADD") == 0) 
-  { 
-    cpu->regs[stage->rd] = stage->buffer;
-    //printf("\ntseter --%d\n",stage->buffer);
-    //cpu->regs_valid[stage->rd]=1;
-    cpu->stage[DRF].stalled=0;
-    cpu->stage[F].stalled=0; 
-     if(stage->buffer==0)
-     cpu->zero=1;
-   else
-     cpu->zero=0;   
+    APEX_trace_stage(cpu, WB, 1);
   }
-
-  if (strcmp(stage->opcode, "ADDL") == 0) 
-  { 
-    cpu->regs[stage->rd] = stage->buffer;
-    //printf("\ntseter --%d\n",stage->buffer);
-    //cpu->regs_valid[stage->rd]=1;
-    cpu->stage[DRF].stalled=0;
-    cpu->stage[F].stalled=0; 
-     if(stage->buffer==0)
-     cpu->zero=1;
-   else
-     cpu->zero=0;   
+  else {
+    APEX_trace_stage(cpu, WB, 0);
   }
 
-  if (strcmp(stage->opcode, "SUB") == 0) 
-  {
-   cpu->regs[stage->rd] = stage->buffer;
-   //cpu->regs_valid[stage->rd]=1;
-   cpu->stage[DRF].stalled=0;
-   cpu->stage[F].stalled=0; 
-    if(stage->buffer==0)
-     cpu->zero=1;
-   else
-     cpu->zero=0;   
- }
-
- if (strcmp(stage->opcode, "AND") == 0) 
- {
-
-  //cpu->regs_valid[stage->rd]=1;
-  cpu->stage[DRF].stalled=0;
-  cpu->stage[F].stalled=0; 
+  return 0;
 }
 
-if (strcmp(stage->opcode, "OR") == 0) 
+/* Latch and register state a cycle reads and writes : zero flag, pc,
+ * register file, scoreboard and all latches, which are laid out
+ * contiguously in APEX_CPU. Data memory is left out because only the
+ * instruction in MEM1 touches it, so a cycle that leaves this state
+ * unchanged can at most repeat an identical store.
+ */
+#define PIPELINE_STATE_BEGIN offsetof(APEX_CPU, zero)
+#define PIPELINE_STATE_SIZE \
+  (offsetof(APEX_CPU, stage) + sizeof(((APEX_CPU*)0)->stage) - \
+   PIPELINE_STATE_BEGIN)
+
+/* Countdowns of the waits in progress : MEM1's access, the I-cache
+ * line being fetched and the multi-cycle results in EX1 and EX2
+ */
+enum
 {
+  WAIT_MEMORY,
+  WAIT_FETCH,
+  WAIT_EX1,
+  WAIT_EX2,
+  NUM_WAITS
+};
+
+/* State before a cycle, and the counters a cycle that only waits adds
+ * to
+ */
+typedef struct APEX_Cycle_Snapshot
+{
+  unsigned char state[PIPELINE_STATE_SIZE];
+  int ins_completed;
+  int waits[NUM_WAITS];
+  long long stalls[NUM_STALL_CAUSES];
+  long long bubbles[NUM_STAGES];
+  int mem_stall_cycles;
+  int fetch_stall_cycles;
+  int ex_stall_cycles;
+} APEX_Cycle_Snapshot;
 
-  //cpu->regs_valid[stage->rd]=1;
-  cpu->stage[DRF].stalled=0;
-  cpu->stage[F].stalled=0; 
+static void
+get_waits(const APEX_CPU* cpu, int* waits)
+{
+  waits[WAIT_MEMORY] = cpu->mem_wait;
+  waits[WAIT_FETCH] = cpu->fetch_wait;
+  waits[WAIT_EX1] = cpu->stage[EX1].ex_left;
+  waits[WAIT_EX2] = cpu->stage[EX2].ex_left;
 }
 
-if (strcmp(stage->opcode, "XOR") == 0) 
+static void
+set_waits(APEX_CPU* cpu, const int* waits)
 {
-  //cpu->regs_valid[stage->rd]=1;
-  cpu->stage[DRF].stalled=0;
-  cpu->stage[F].stalled=0; 
+  cpu->mem_wait = waits[WAIT_MEMORY];
+  cpu->fetch_wait = waits[WAIT_FETCH];
+  cpu->stage[EX1].ex_left = waits[WAIT_EX1];
+  cpu->stage[EX2].ex_left = waits[WAIT_EX2];
 }
 
-if (strcmp(stage->opcode, "MUL") == 0) 
+static void
+take_snapshot(const APEX_CPU* cpu, APEX_Cycle_Snapshot* snap)
 {
-  cpu->regs[stage->rd] = stage->buffer;
-  //cpu->regs_valid[stage->rd]=1;
-  cpu->stage[DRF].stalled=0;
-  cpu->stage[F].stalled=0; 
-   if(stage->buffer==0)
-     cpu->zero=1;
-   else
-     cpu->zero=0;   
+  memcpy(snap->state, (const char*)cpu + PIPELINE_STATE_BEGIN,
+         PIPELINE_STATE_SIZE);
+  snap->ins_completed = cpu->ins_completed;
+  get_waits(cpu, snap->waits);
+  memcpy(snap->stalls, cpu->counters.stalls, sizeof(snap->stalls));
+  memcpy(snap->bubbles, cpu->counters.bubbles, sizeof(snap->bubbles));
+  snap->mem_stall_cycles = cpu->mem_stall_cycles;
+  snap->fetch_stall_cycles = cpu->fetch_stall_cycles;
+  snap->ex_stall_cycles = cpu->ex_stall_cycles;
 }
 
-if(strcmp(stage->opcode, "HALT") == 0) {
-        cpu->ins_completed = cpu->code_memory_size - 1;
-        cpu->stage[F].pc =cpu->stage[MEM1].pc =cpu->stage[MEM2].pc =cpu->stage[EX1].pc=cpu->stage[EX2].pc=cpu->stage[DRF].pc =  0;
-        strcpy(cpu->stage[EX1].opcode, "HALT");
-        strcpy(cpu->stage[EX2].opcode, "HALT");        
-        
-        strcpy(cpu->stage[DRF].opcode, "HALT");
-        cpu->stage[EX2].stalled =cpu->stage[EX1].stalled = 1;
-        cpu->stage[DRF].stalled = 1;
-        cpu->stage[F].stalled = 1;
-         strcpy(cpu->stage[F].opcode, "HALT");
-         cpu->ins_completed = cpu->code_memory_size - 1;
-        strcpy(cpu->stage[MEM2].opcode, "HALT");
-        strcpy(cpu->stage[MEM1].opcode, "HALT");
-        cpu->stage[MEM2].stalled =cpu->stage[MEM1].stalled = 1;
-        }
-
-
-
+/*
+ * Cycles after this one that repeat it. A cycle that changed nothing
+ * but the countdowns of the waits in progress, each by one, is repeated
+ * until one of them is about to reach 0 : only that cycle can let an
+ * instruction move. Returns -1 for a cycle that changed anything else,
+ * and INT_MAX for a fixed point, a cycle that changed nothing at all,
+ * which repeats forever.
+ */
+static int
+idle_cycles(APEX_CPU* cpu, const APEX_Cycle_Snapshot* before)
+{
+  int waits[NUM_WAITS];
 
-cpu->ins_completed++;
+  if (before->ins_completed != cpu->ins_completed) {
+    return -1;
+  }
+  get_waits(cpu, waits);
+  set_waits(cpu, before->waits);
+  int same = memcmp(before->state, (const char*)cpu + PIPELINE_STATE_BEGIN,
+                    PIPELINE_STATE_SIZE) == 0;
+  set_waits(cpu, waits);
+  if (!same) {
+    return -1;
+  }
 
-if (ENABLE_DEBUG_MESSAGES) {
-  print_stage_content("Writeback", stage);
+  int cycles = INT_MAX;
+  for (int i = 0; i < NUM_WAITS; ++i) {
+    if (waits[i] == before->waits[i]) {
+      continue;
+    }
+    if (waits[i] != before->waits[i] - 1 || waits[i] <= 1) {
+      return -1;
+    }
+    if (waits[i] - 1 < cycles) {
+      cycles = waits[i] - 1;
+    }
+  }
+  return cycles;
 }
+
+/* Multi-cycle results in EX1 and EX2 progress every cycle, whether or
+ * not their latches move
+ */
+static void
+count_down_execute(APEX_CPU* cpu)
+{
+  for (int i = EX1; i <= EX2; ++i) {
+    if (cpu->stage[i].ex_left > 0) {
+      cpu->stage[i].ex_left--;
+    }
+  }
 }
-else{
-  printf("Writeback      : EMPTY\n");
+
+/* Stages from top up to F are held behind a waiting stage, bubbles
+ * stay empty. The fetch queue keeps filling.
+ */
+static void
+hold_stages(APEX_CPU* cpu, int top)
+{
+  if (cpu->icache) {
+    fetch_fill(cpu);
+  }
+  for (int i = top; i >= F; --i) {
+    const CPU_Stage* held = &cpu->stage[i];
+    APEX_trace_stage(cpu, i, held->busy || held->stalled ?
+                             TRACE_STAGE_IDLE : TRACE_STAGE_HELD);
+  }
 }
 
-return 0;
+/* Counts cycles that end with decode stalled, charging them to the
+ * register and the opcode decode waits on
+ */
+static void
+count_decode_stall(APEX_CPU* cpu, int cycles)
+{
+  const CPU_Stage* stage = &cpu->stage[DRF];
+  if (!stage->stalled) {
+    return;
+  }
+  cpu->stall_cycles += cycles;
+  if (cpu->stall_reg >= 0) {
+    cpu->reg_stall_cycles[cpu->stall_reg] += cycles;
+    cpu->opcode_stall_cycles[stage->opcode] += cycles;
+  }
 }
 
-  /*
-   *  APEX CPU simulation loop
-   *
-   *  Note : You are free to edit this function according to your
-   * 				 implementation
-   */
-  
+/*
+ * CPI stack slot of a cycle, from the latch writeback gets : the
+ * instruction it commits, the consumer decode stalled, or the bubble an
+ * earlier cycle left. Sets pc to the instruction the cycle is blamed on.
+ */
+static int
+cpi_slot(const APEX_CPU* cpu, int* pc)
+{
+  const CPU_Stage* stage = &cpu->stage[WB];
 
+  if (stage->opcode == OP_FLUSH ||
+      (stage->busy && stage->bubble == BUBBLE_FLUSH)) {
+    *pc = stage->mem_address;
+    return code_at(cpu, *pc)->opcode == OP_JUMP ? CPI_RESTEER :
+                                                  CPI_BAD_SPECULATION;
+  }
+  if (!stage->busy) {
+    *pc = stage->pc;
+    if (stage->stalled) {
+      return CPI_DEPENDENCY;
+    }
+    /* Past the end of the program there is nothing left to fetch */
+    return in_code(cpu, stage->pc) ? CPI_RETIRING : CPI_FETCH;
+  }
+  *pc = stage->mem_address;
+  switch (stage->bubble) {
+    case BUBBLE_MEMORY:
+      return CPI_MEMORY;
+    case BUBBLE_EXECUTE:
+      return CPI_EXECUTE;
+    default:
+      return CPI_FETCH;
+  }
+}
 
-  int
-  APEX_cpu_run(APEX_CPU *cpu, const char* type, const char* req_cyc)
-  {
-     int need_cyc = atoi(req_cyc);
-  
+/* Charges cycles to the CPI stack, in total and by static pc */
+static void
+count_cpi(APEX_CPU* cpu, int cycles)
+{
+  int pc;
+  int slot = cpi_slot(cpu, &pc);
+  int row = in_code(cpu, pc) ? get_code_index(pc) : cpu->code_memory_size;
 
+  cpu->counters.cpi[slot] += cycles;
+  cpu->cpi_by_pc[row][slot] += cycles;
+}
 
+/*
+ * Runs cycles more repeats of the cycle that followed before in one
+ * step : every counter it added to gets as much again per cycle, and
+ * the waits it counted down go down by cycles
+ */
+static void
+skip_idle_cycles(APEX_CPU* cpu, const APEX_Cycle_Snapshot* before,
+                 int cycles)
+{
+  APEX_Counters* c = &cpu->counters;
+  int waits[NUM_WAITS];
 
+  for (int i = 0; i < NUM_STALL_CAUSES; ++i) {
+    c->stalls[i] += (c->stalls[i] - before->stalls[i]) * cycles;
+  }
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    c->bubbles[i] += (c->bubbles[i] - before->bubbles[i]) * cycles;
+  }
+  cpu->mem_stall_cycles +=
+    (cpu->mem_stall_cycles - before->mem_stall_cycles) * cycles;
+  cpu->fetch_stall_cycles +=
+    (cpu->fetch_stall_cycles - before->fetch_stall_cycles) * cycles;
+  cpu->ex_stall_cycles +=
+    (cpu->ex_stall_cycles - before->ex_stall_cycles) * cycles;
+  count_decode_stall(cpu, cycles);
+  count_cpi(cpu, cycles);
+
+  get_waits(cpu, waits);
+  for (int i = 0; i < NUM_WAITS; ++i) {
+    if (waits[i] != before->waits[i]) {
+      waits[i] -= cycles;
+    }
+  }
+  set_waits(cpu, waits);
+  cpu->clock += cycles;
+}
 
+const char* const APEX_cpu_stop_names[NUM_CPU_STOPS] = {
+  [CPU_STOP_COMPLETE] = "complete",
+  [CPU_STOP_CYCLES]   = "cycle limit",
+  [CPU_STOP_RETIRED]  = "retired limit",
+  [CPU_STOP_PC]       = "until pc",
+  [CPU_STOP_DEADLOCK] = "deadlock",
+  [CPU_STOP_CONDITION] = "condition",
+  [CPU_STOP_FAULT]    = "data memory fault",
+};
+
+/*
+ *  Runs the pipeline until every instruction has committed, or until the
+ *  first of the cpu->req_cyc cycle limit and the until_pc / until_retired
+ *  stop conditions. Prints nothing beyond the trace level of cpu and
+ *  returns why it stopped (CPU_STOP_*).
+ */
+int
+APEX_cpu_simulate(APEX_CPU* cpu)
+{
+  APEX_Cycle_Snapshot before;
 
-    while (1) {
-     
-      //int need_cyc=req_cyc;
+  while (1) {
 
-      /* All the instructions committed, so exit */
-      if ((cpu->ins_completed == cpu->code_memory_size)) {
-        printf("(apex) >> Simulation Complete");
-        break;
-      }
+    /* The program committed its HALT, ran off its end or faulted */
+    if (cpu->finished) {
+      return cpu->faulted ? CPU_STOP_FAULT : CPU_STOP_COMPLETE;
+    }
+    if (cpu->req_cyc > 0 && cpu->clock >= cpu->req_cyc) {
+      return CPU_STOP_CYCLES;
+    }
+    if (cpu->until_retired > 0 && cpu->ins_completed >= cpu->until_retired) {
+      return CPU_STOP_RETIRED;
+    }
 
-      if (ENABLE_DEBUG_MESSAGES) {
-        printf("--------------------------------\n");
-        printf("Clock Cycle #: %d\n", cpu->clock+1);
-        printf("--------------------------------\n");
-      }
+    if (APEX_TRACE_ON(cpu, TRACE_STAGE)) {
+      APEX_trace_print_banner(cpu->out, cpu->clock + 1);
+    }
 
+    take_snapshot(cpu, &before);
 
+    /* pc that writeback commits this cycle, for until_pc */
+    const CPU_Stage* wb = &cpu->stage[WB];
+    int committing = (!wb->busy && !wb->stalled) ? wb->pc : -1;
 
-      writeback(cpu);
-      memory2(cpu);
-      memory1(cpu);
-      execute2(cpu);
+    count_cpi(cpu, 1);
+    count_down_execute(cpu);
+    writeback(cpu);
+    memory2(cpu);
+    if (memory1(cpu) != 0) {
+      cpu->mem_stall_cycles++;
+      hold_stages(cpu, EX2);
+    }
+    else if (execute2(cpu) != 0) {
+      cpu->ex_stall_cycles++;
+      execute1_overlap(cpu);
+      hold_stages(cpu, DRF);
+    }
+    else {
       execute1(cpu);
       decode(cpu);
       fetch(cpu);
-      cpu->clock++;
-      //if((cpu->clock == need_cyc)){
-      //  break;
-      
     }
+    cpu->clock++;
+    count_decode_stall(cpu, 1);
+    APEX_trace_cycle(cpu);
 
-  printf("\n");
-    printf("\n----+++Register Value+++----\n");
-    for(int i=0;i<16;i++)
-      {printf("\n");
-    printf("Register[%d] >> Value=%d >> status=%s \n",i,cpu->regs[i],(cpu->regs_valid[i])?"Valid" : "Invalid");
+    if (cpu->until_pc && committing == cpu->until_pc) {
+      return CPU_STOP_PC;
+    }
+    if (cpu->until_fn && cpu->until_fn(cpu, cpu->until_arg)) {
+      return CPU_STOP_CONDITION;
+    }
+
+    /* A stall that only waits out a memory access, an I-cache miss or
+     * a multi-cycle result repeats this cycle until the wait ends : skip
+     * to the cycle that ends it, unless each cycle has to be traced or
+     * checked. One that repeats forever can never complete.
+     */
+    int idle = idle_cycles(cpu, &before);
+    if (idle == INT_MAX) {
+      return CPU_STOP_DEADLOCK;
+    }
+    if (idle > 0 && !cpu->trace_sink && !APEX_TRACE_ON(cpu, TRACE_CYCLE) &&
+        !cpu->until_fn) {
+      if (cpu->req_cyc > 0 && idle > cpu->req_cyc - cpu->clock) {
+        idle = cpu->req_cyc - cpu->clock;
+      }
+      skip_idle_cycles(cpu, &before, idle);
+    }
+  }
+}
 
+/* Prints the decode stall cycles spent on each register and opcode */
+static void
+print_stall_breakdown(const APEX_CPU* cpu)
+{
+  fprintf(cpu->err, "APEX_CPU : decode stall cycles by source register");
+  for (int i = 0; i < 16; ++i) {
+    if (cpu->reg_stall_cycles[i]) {
+      fprintf(cpu->err, " R%d %d", i, cpu->reg_stall_cycles[i]);
+    }
+  }
+  fprintf(cpu->err, "\nAPEX_CPU : decode stall cycles by opcode");
+  for (int i = 0; i < NUM_OPCODES; ++i) {
+    if (cpu->opcode_stall_cycles[i]) {
+      fprintf(cpu->err, " %s %d", APEX_opcode_info[i].name,
+              cpu->opcode_stall_cycles[i]);
+    }
   }
+  fprintf(cpu->err, "\n");
+}
 
-  
-  printf("----+++DATA MEMORY+++----\n");
+/*
+ *  APEX CPU simulation loop. Runs APEX_cpu_simulate() with the req_cyc
+ *  cycle limit, then prints the outcome and the final state.
+ *
+ *  Note : You are free to edit this function according to your
+ * 				 implementation
+ */
+int
+APEX_cpu_run(APEX_CPU* cpu, const char* type, const char* req_cyc)
+{
+  char outcome[64];
+
+  cpu->req_cyc = req_cyc ? atoi(req_cyc) : 0;
+
+  switch (APEX_cpu_simulate(cpu)) {
+    case CPU_STOP_COMPLETE:
+      snprintf(outcome, sizeof(outcome), "Complete");
+      break;
+
+    case CPU_STOP_CYCLES:
+      snprintf(outcome, sizeof(outcome), "Stopped at cycle %d", cpu->clock);
+      break;
+
+    case CPU_STOP_RETIRED:
+      snprintf(outcome, sizeof(outcome), "Stopped after %d instructions",
+               cpu->ins_completed);
+      break;
+
+    case CPU_STOP_PC:
+      snprintf(outcome, sizeof(outcome), "Stopped at pc(%d)", cpu->until_pc);
+      break;
+
+    case CPU_STOP_CONDITION:
+      snprintf(outcome, sizeof(outcome), "Stopped at cycle %d", cpu->clock);
+      break;
+
+    case CPU_STOP_FAULT:
+      fprintf(cpu->err,
+              "APEX_Error : data memory access out of range at pc(%d)\n",
+              cpu->pc);
+      snprintf(outcome, sizeof(outcome), "Complete");
+      break;
+
+    default:
+      fprintf(cpu->err,
+        "APEX_Error : pipeline deadlocked at cycle %d, %d instructions "
+        "committed\n", cpu->clock, cpu->ins_completed);
+      snprintf(outcome, sizeof(outcome), "Deadlocked");
+      break;
+  }
 
-  for(int i=0;i<101;i++)
-  {
-    printf(" DATA_MEM[%d] :- Value=%d \n",i,cpu->data_memory[i]);
+  fprintf(cpu->out, "(apex) >> Simulation %s", outcome);
+
+  if (APEX_TRACE_ON(cpu, TRACE_SUMMARY)) {
+    fprintf(cpu->err,
+      "APEX_CPU : %d cycles, %d instructions committed, "
+      "%d decode stall cycles\n",
+      cpu->clock, cpu->ins_completed, cpu->stall_cycles);
+    fprintf(cpu->err,
+      "APEX_CPU : operands forwarded from EX2 %d, MEM1 %d, MEM2 %d, "
+      "WB %d\n", cpu->forwarded[EX2], cpu->forwarded[MEM1],
+      cpu->forwarded[MEM2], cpu->forwarded[WB]);
+    if (cpu->stall_cycles) {
+      print_stall_breakdown(cpu);
+    }
+    if (cpu->dcache) {
+      fprintf(cpu->err, "APEX_CPU : %d memory wait cycles\n",
+              cpu->mem_stall_cycles);
+      APEX_cache_report(cpu->dcache, "", cpu->err, cpu->ins_completed);
+    }
+    if (cpu->latency) {
+      fprintf(cpu->err, "APEX_CPU : %d execute wait cycles\n",
+              cpu->ex_stall_cycles);
+    }
+    if (cpu->icache) {
+      fprintf(cpu->err, "APEX_CPU : %d fetch queue empty cycles\n",
+              cpu->fetch_stall_cycles);
+      APEX_cache_report(cpu->icache, "I", cpu->err, cpu->ins_completed);
+    }
+    if (cpu->bpred) {
+      APEX_bpred_report(cpu->bpred, cpu->err);
+    }
+    APEX_counters_print_cpi_stack(cpu, cpu->err);
   }
 
+  fprintf(cpu->out, "\n");
+  APEX_cpu_dump(cpu);
+
+  if (cpu->counters_out &&
+      APEX_counters_write_json(cpu, cpu->counters_out) < 0) {
+    fprintf(cpu->err, "APEX_Error : Unable to write the counters\n");
+  }
 
   return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Prints the final register file and the first words of data memory
+ */
+void
+APEX_cpu_dump(APEX_CPU* cpu)
+{
+  APEX_cpu_print_registers(cpu);
+  APEX_print_data_memory(cpu->out, cpu->data_memory);
+}
+
+void
+APEX_cpu_print_registers(APEX_CPU* cpu)
+{
+  fprintf(cpu->out, "\n----+++Register Value+++----\n");
+  for (int i = 0; i < 16; i++) {
+    fprintf(cpu->out, "\n");
+    fprintf(cpu->out, "Register[%d] >> Value=%d >> status=%s \n", i,
+            cpu->regs[i], cpu->reg_writers[i] == 0 ? "Valid" : "Invalid");
+  }
+}
+
+void
+APEX_print_data_memory(FILE* out, const int* data_memory)
+{
+  fprintf(out, "----+++DATA MEMORY+++----\n");
+
+  for (int i = 0; i < 101; i++) {
+    fprintf(out, " DATA_MEM[%d] :- Value=%d \n", i, data_memory[i]);
+  }
+}
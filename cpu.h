@@ -8,6 +8,8 @@
  *  Gaurav Kothari (gkothar1@binghamton.edu)
  *  State University of New York, Binghamton
  */
+#include <stddef.h>
+#include <stdio.h>
 
 enum
 {
@@ -21,38 +23,164 @@ enum
   NUM_STAGES
 };
 
-/* Format of an APEX instruction  */
+/* Number of words in data memory */
+enum
+{
+  DATA_MEMORY_SIZE = 4096
+};
+
+/* Why a pipeline run stopped */
+enum
+{
+  CPU_STOP_COMPLETE,    // Every instruction committed
+  CPU_STOP_CYCLES,      // Reached req_cyc
+  CPU_STOP_RETIRED,     // Reached until_retired
+  CPU_STOP_PC,          // Committed the instruction at until_pc
+  CPU_STOP_DEADLOCK,    // Fixed point : nothing can ever move again
+  CPU_STOP_CONDITION,   // The until_fn callback returned non-zero
+  CPU_STOP_FAULT,       // Data memory access out of range, at pc
+  NUM_CPU_STOPS
+};
+
+/* Decoded APEX opcodes, resolved once by the parser */
+enum
+{
+  OP_NONE,          // Empty latch or unknown mnemonic
+  OP_MOVC,
+  OP_STORE,
+  OP_STR,
+  OP_LOAD,
+  OP_LDR,
+  OP_ADD,
+  OP_ADDL,
+  OP_SUB,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_MUL,
+  OP_JUMP,
+  OP_BZ,
+  OP_BNZ,
+  OP_HALT,
+  OP_FLUSH,         // Bubble injected into a latch by a taken branch
+  NUM_OPCODES
+};
+
+/* Operand formats, in assembly order */
+enum
+{
+  FMT_NONE,         // HALT
+  FMT_RD_IMM,       // MOVC,Rd,#imm
+  FMT_RS1_RS2_IMM,  // STORE,Rs1,Rs2,#imm
+  FMT_RD_RS1_RS2,   // ADD,Rd,Rs1,Rs2
+  FMT_RD_RS1_IMM,   // LOAD,Rd,Rs1,#imm
+  FMT_RS1_IMM,      // JUMP,Rs1,#imm
+  FMT_IMM           // BZ,#imm
+};
+
+/* Static description of an opcode */
+typedef struct APEX_Opcode_Info
+{
+  const char* name;     // Assembly mnemonic
+  int format;           // Operand format (FMT_*)
+  const char* display;  // printf format used by the pipeline display
+} APEX_Opcode_Info;
+
+extern const APEX_Opcode_Info APEX_opcode_info[NUM_OPCODES];
+
+/* Format of an APEX instruction, packed into 8 bytes  */
 typedef struct APEX_Instruction
 {
-  char opcode[128];	// Operation Code
-  int rd;		    // Destination Register Address
-  int rs1;		    // Source-1 Register Address
-  int rs2;		    // Source-2 Register Address
-  int imm;		    // Literal Value
+  int imm;		            // Literal Value
+  unsigned int opcode : 8;	// Operation Code (OP_*)
+  unsigned int rd : 4;		// Destination Register Address
+  unsigned int rs1 : 4;		// Source-1 Register Address
+  unsigned int rs2 : 4;		// Source-2 Register Address
 } APEX_Instruction;
 
-/* Model of CPU stage latch */
+/* Model of CPU stage latch. Values first, then register indices and
+ * flags packed into one word, so a latch is 28 bytes and the whole
+ * stage[] array spans less than four cache lines.
+ */
 typedef struct CPU_Stage
 {
   int pc;		    // Program Counter
-  char opcode[128];	// Operation Code
-  int rs1;		    // Source-1 Register Address
-  int rs2;		    // Source-2 Register Address
-  int rd;		    // Destination Register Address
   int imm;		    // Literal Value
   int rs1_value;	// Source-1 Register Value
   int rs2_value;	// Source-2 Register Value
   int buffer;		// Latch to hold some value
   int mem_address;	// Computed Memory Address
-  int busy;		    // Flag to indicate, stage is performing some action
-  int stalled;  		// Flag to indicate, stage is stalled
-  int math_ins;
-  int forward_enabler;
-  int forward_buffer;
-  int forward_regindex;
-
+  unsigned int opcode : 8;	        // Operation Code (OP_*)
+  unsigned int rs1 : 4;		        // Source-1 Register Address
+  unsigned int rs2 : 4;		        // Source-2 Register Address
+  unsigned int rd : 4;		        // Destination Register Address
+  unsigned int busy : 1;		// Flag to indicate, stage is performing some action
+  unsigned int stalled : 1;		// Flag to indicate, stage is stalled
+  unsigned int predicted_taken : 1;	// Fetch went on at a predicted target
+  unsigned int started : 1;	// EX1 began it while EX2 was held
+  unsigned int ex_left : 6;	// Cycles until its result is ready
+  unsigned int bubble : 2;	// Why a busy latch is empty (BUBBLE_*)
 } CPU_Stage;
 
+_Static_assert(sizeof(CPU_Stage) == 28, "CPU_Stage must stay 28 bytes");
+
+/* Causes of a bubble, carried down the pipeline with it. Its
+ * mem_address holds the pc of the instruction it is blamed on.
+ */
+enum
+{
+  BUBBLE_FETCH,         // Nothing fetched : start-up, fetch queue empty
+  BUBBLE_FLUSH,         // Squashed behind a branch
+  BUBBLE_MEMORY,        // Left behind by MEM1 holding an access
+  BUBBLE_EXECUTE        // Left behind by EX2 holding a result
+};
+
+/* Top-down CPI stack : what each cycle went to, judged by the latch
+ * writeback gets. Front-end bound are the fetch and resteer slots, back
+ * end bound the dependency, memory and execute ones.
+ */
+enum
+{
+  CPI_RETIRING,         // An instruction committed
+  CPI_FETCH,            // Nothing fetched yet
+  CPI_RESTEER,          // Squashed behind a JUMP
+  CPI_BAD_SPECULATION,  // Flushed behind a BZ / BNZ
+  CPI_DEPENDENCY,       // Decode waited for an operand
+  CPI_MEMORY,           // MEM1 held an access
+  CPI_EXECUTE,          // EX2 held a multi-cycle result
+  NUM_CPI_SLOTS
+};
+
+/* Stall causes the performance counters tell apart */
+enum
+{
+  STALL_RAW_RS1,        // Decode waited for its rs1 source
+  STALL_RAW_RS2,        // Decode waited for its rs2 source
+  STALL_RAW_RD,         // Decode waited for rd, the data of a STR
+  STALL_HALT_DRAIN,     // Fetch held behind a HALT until it commits
+  STALL_BRANCH_FLUSH,   // Writeback got a latch a branch flushed
+  NUM_STALL_CAUSES
+};
+
+/* Performance counters, plain increments in the stage functions so
+ * they are always on (see counters.h)
+ */
+typedef struct APEX_Counters
+{
+  long long retired[NUM_OPCODES];       // Committed, by opcode
+  long long stalls[NUM_STALL_CAUSES];   // Cycles, by cause
+  long long flushed;        // Instructions squashed behind a branch
+  long long loads;          // Data memory accesses MEM1 completed
+  long long stores;
+  long long bubbles[NUM_STAGES];        // Cycles a stage had no instruction
+  long long cpi[NUM_CPI_SLOTS];         // Cycles, by CPI stack slot
+} APEX_Counters;
+
+struct APEX_CPU;
+
+/* Caller-supplied stop condition, checked after every cycle */
+typedef int (*APEX_Stop_Condition)(const struct APEX_CPU* cpu, void* arg);
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
@@ -61,38 +189,169 @@ typedef struct APEX_CPU
   int clock;
   int req_cyc;
 
+  /* Stop conditions of the pipeline run, 0 when unused */
+  int until_pc;       // Stop once the instruction at this pc commits
+  int until_retired;  // Stop once this many instructions have committed
+  APEX_Stop_Condition until_fn;   // Stop once it returns non-zero
+  void* until_arg;
+
   int zero;
   /* Current program counter */
   int pc;
 
-  /* Integer register file */
+  /* Committed a HALT, ran past the end of code memory or faulted */
+  int finished;
+  /* Finished at a data memory access out of range, at pc */
+  int faulted;
+
+  /* Cycles the access in MEM1 still has to wait, holding MEM1 and the
+   * stages above it
+   */
+  int mem_wait;
+
+  /* Fetch queue, used with an I-cache : fetch_count instructions from
+   * fetch_pc on are fetched and wait for F, and fetch_wait cycles are
+   * left on the line being fetched
+   */
+  int fetch_pc;
+  int fetch_count;
+  int fetch_wait;
+
+  /* Integer register file and its scoreboard : the writers of each
+   * register that decode has issued and writeback not yet committed. A
+   * register is valid when it has none, however many are in flight.
+   */
   int regs[16];
-  int regs_valid[16];
+  int reg_writers[16];
 
   /* Array of 7 CPU_stage */
-  CPU_Stage stage[7];
+  CPU_Stage stage[NUM_STAGES];
 
   /* Code Memory where instructions are stored */
   APEX_Instruction* code_memory;
   int code_memory_size;
+  int code_memory_mapped;   // Points into a mapped .apexbin image
+  int code_memory_borrowed; // Owned by the caller of APEX_cpu_create()
+
+  /* Core of a multi-core system, whose shared memory replaces
+   * data_memory, or NULL (see multicore.h)
+   */
+  struct APEX_Multicore* multicore;
+  int core_id;
+
+  /* First level of the data cache hierarchy, or NULL for a fixed
+   * latency memory (see cache.h). Owned by the CPU.
+   */
+  struct APEX_Cache* dcache;
+
+  /* Instruction cache, or NULL for an ideal front end fetching one
+   * instruction per cycle. With one, each cycle fetches up to
+   * fetch_width instructions of a line into a queue of fetch_queue_size
+   * entries, and F takes the next instruction from the queue.
+   */
+  struct APEX_Cache* icache;
+  int fetch_width;
+  int fetch_queue_size;
+
+  /* Branch predictor, or NULL to fetch straight on and flush behind
+   * every taken BZ / BNZ (see bpred.h). Owned by the CPU.
+   */
+  struct APEX_Bpred* bpred;
+
+  /* Functional unit latencies, or NULL for one cycle everywhere (see
+   * latency.h). Owned by the CPU.
+   */
+  struct APEX_Latency_Table* latency;
 
-  /* Data Memory */
-  int data_memory[4096];
+  /* Simulation output (traces, dumps) and diagnostics, stdout and
+   * stderr unless the caller supplies its own streams
+   */
+  FILE* out;
+  FILE* err;
+
+  /* Tracing, see trace.h */
+  int trace_level;
+  struct APEX_Trace_Sink* trace_sink;
 
   /* Some stats */
   int ins_completed;
+  int stall_cycles;   // Cycles that ended with decode stalled
+  int mem_stall_cycles; // Cycles MEM1 held a waiting access
+  int fetch_stall_cycles; // Cycles F found the fetch queue empty
+  int ex_stall_cycles;  // Cycles EX2 held a result not yet ready
+  int forwarded[NUM_STAGES];  // Operands decode read from each latch
+  int stall_reg;      // Source decode waited on this cycle, -1 for none
+  int reg_stall_cycles[16];   // Decode stall cycles by awaited register
+  int opcode_stall_cycles[NUM_OPCODES]; // and by the stalled opcode
+  APEX_Counters counters;
+
+  /* counters.cpi by the static pc each cycle is blamed on, one row per
+   * instruction in code memory and a last one for cycles blamed on none
+   */
+  long long (*cpi_by_pc)[NUM_CPI_SLOTS];
+
+  /* Where APEX_cpu_run writes the counters as JSON, or NULL */
+  FILE* counters_out;
 
+  /* Data Memory. Every engine bounds each access and stops the run
+   * with a fault outside it, and it comes last so that no pointer the
+   * CPU owns sits behind it.
+   */
+  int data_memory[DATA_MEMORY_SIZE];
 } APEX_CPU;
 
 APEX_Instruction*
-create_code_memory(const char* filename, int* size);
+create_code_memory(const char* filename, int* size, int* mapped, FILE* err);
+
+APEX_Instruction*
+parse_code_memory(const char* name, const char* text, size_t length,
+                  int* size, FILE* err);
+
+void
+destroy_code_memory(APEX_Instruction* code, int size, int mapped);
+
+int
+write_code_image(const APEX_Instruction* code, int size, const char* filename);
+
+int
+verify_code_image(const APEX_Instruction* code, int size);
+
+extern const char* const APEX_cpu_stop_names[NUM_CPU_STOPS];
+
+APEX_CPU*
+APEX_cpu_create(APEX_Instruction* code, int size);
+
+APEX_CPU*
+APEX_cpu_open_file(const char* filename, FILE* err);
+
+APEX_CPU*
+APEX_cpu_open_buffer(const char* name, const char* text, size_t length,
+                     FILE* err);
 
 APEX_CPU*
 APEX_cpu_init(const char* filename);
 
+int
+APEX_cpu_simulate(APEX_CPU* cpu);
+
 int
 APEX_cpu_run(APEX_CPU *cpu, const char* type, const char* req_cyc);
 
+void
+APEX_cpu_dump(APEX_CPU* cpu);
+
+void
+APEX_cpu_print_registers(APEX_CPU* cpu);
+
+void
+APEX_print_data_memory(FILE* out, const int* data_memory);
+
+void
+APEX_cpu_print_code(APEX_CPU* cpu);
+
+int
+get_code_index(int pc);
+
 void
 APEX_cpu_stop(APEX_CPU* cpu);
 
@@ -7,197 +7,662 @@
  *  Gaurav Kothari (gkothar1@binghamton.edu)
  *  State University of New York, Binghamton
  */
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cpu.h"
 
 /*
- * This function is related to parsing input file
+ * Opcode table, indexed by OP_*. The display strings keep the exact
+ * layout of the original per-opcode printf calls.
  *
- * Note : You are not supposed to edit this function
+ * Note : you can edit this table to add new instructions
  */
+const APEX_Opcode_Info APEX_opcode_info[NUM_OPCODES] = {
+  [OP_NONE]  = { "",      FMT_NONE,        "" },
+  [OP_MOVC]  = { "MOVC",  FMT_RD_IMM,      "%s,R%d,#%d " },
+  [OP_STORE] = { "STORE", FMT_RS1_RS2_IMM, "%s,R%d,R%d,#%d " },
+  [OP_STR]   = { "STR",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d " },
+  [OP_LOAD]  = { "LOAD",  FMT_RD_RS1_IMM,  "%s,R%d,R%d,#%d " },
+  [OP_LDR]   = { "LDR",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d " },
+  [OP_ADD]   = { "ADD",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d" },
+  [OP_ADDL]  = { "ADDL",  FMT_RD_RS1_IMM,  "%s,R%d,R%d,#%d" },
+  [OP_SUB]   = { "SUB",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d" },
+  [OP_AND]   = { "AND",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d" },
+  [OP_OR]    = { "OR",    FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d" },
+  [OP_XOR]   = { "XOR",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d" },
+  [OP_MUL]   = { "MUL",   FMT_RD_RS1_RS2,  "%s,R%d,R%d,R%d" },
+  [OP_JUMP]  = { "JUMP",  FMT_RS1_IMM,     "%s,R%d,#%d" },
+  [OP_BZ]    = { "BZ",    FMT_IMM,         "%s,#%d" },
+  [OP_BNZ]   = { "BNZ",   FMT_IMM,         "%s,#%d" },
+  [OP_HALT]  = { "HALT",  FMT_NONE,        "%s" },
+  [OP_FLUSH] = { "flush", FMT_NONE,        "" },
+};
+
+/* Operand slots, in assembly order for each format */
+enum
+{
+  OPND_END,
+  OPND_RD,
+  OPND_RS1,
+  OPND_RS2,
+  OPND_IMM
+};
+
+static const unsigned char format_operands[][4] = {
+  [FMT_NONE]        = { OPND_END },
+  [FMT_RD_IMM]      = { OPND_RD, OPND_IMM, OPND_END },
+  [FMT_RS1_RS2_IMM] = { OPND_RS1, OPND_RS2, OPND_IMM, OPND_END },
+  [FMT_RD_RS1_RS2]  = { OPND_RD, OPND_RS1, OPND_RS2, OPND_END },
+  [FMT_RD_RS1_IMM]  = { OPND_RD, OPND_RS1, OPND_IMM, OPND_END },
+  [FMT_RS1_IMM]     = { OPND_RS1, OPND_IMM, OPND_END },
+  [FMT_IMM]         = { OPND_IMM, OPND_END },
+};
+
+/* Position in the input, for error messages */
+typedef struct APEX_Parser
+{
+  FILE* err;          // Where errors are reported
+  const char* filename;
+  const char* line;   // First character of the current line
+  int line_num;       // From 1
+} APEX_Parser;
+
+static void
+parse_error(const APEX_Parser* p, const char* at, const char* fmt, ...)
+{
+  va_list ap;
+
+  fprintf(p->err, "APEX_Error : %s:%d:%d: ", p->filename, p->line_num,
+          (int)(at - p->line) + 1);
+  va_start(ap, fmt);
+  vfprintf(p->err, fmt, ap);
+  va_end(ap);
+  fprintf(p->err, "\n");
+}
+
 static int
-get_num_from_string(char* buffer)
+is_blank(char c)
 {
-  char str[16];
-  int j = 0;
-  for (int i = 1; buffer[i] != '\0'; ++i) {
-    str[j] = buffer[i];
-    j++;
-  }
-  str[j] = '\0';
-  return atoi(str);
+  return c == ' ' || c == '\t' || c == '\r';
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : you can edit this function to add new instructions
+ * Finds the next comma separated field in [*pos, end), trimmed of
+ * blanks. Empty fields are skipped, as strtok did. Returns NULL at the
+ * end of the line.
  */
-static void
-create_APEX_instruction(APEX_Instruction* ins, char* buffer)
-{
-  char* token = strtok(buffer, ",");
-  int token_num = 0;
-  char tokens[6][128];
-  while (token != NULL) {
-    strcpy(tokens[token_num], token);
-    token_num++;
-    token = strtok(NULL, ",");
-  }
-
-  strcpy(ins->opcode, tokens[0]);
+static const char*
+next_field(const char** pos, const char* end, const char** field_end)
+{
+  const char* s = *pos;
 
-  if (strcmp(ins->opcode, "MOVC") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->imm = get_num_from_string(tokens[2]);
+  for (;;) {
+    while (s < end && (*s == ',' || is_blank(*s))) {
+      s++;
+    }
+    if (s == end) {
+      *pos = s;
+      return NULL;
+    }
+
+    const char* e = s;
+    while (e < end && *e != ',') {
+      e++;
+    }
+    *pos = e;
+    while (e > s && is_blank(e[-1])) {
+      e--;
+    }
+    *field_end = e;
+    return s;
   }
+}
 
-  if (strcmp(ins->opcode, "STORE") == 0) {
-    ins->rs1 = get_num_from_string(tokens[1]);
-    ins->rs2 = get_num_from_string(tokens[2]);
-    ins->imm = get_num_from_string(tokens[3]);
+/* Maps an assembly mnemonic to its opcode, OP_NONE if unknown */
+static int
+lookup_opcode(const char* name, size_t len)
+{
+  for (int op = OP_MOVC; op <= OP_HALT; ++op) {
+    const char* mnemonic = APEX_opcode_info[op].name;
+    if (mnemonic[0] == name[0] && strncmp(mnemonic, name, len) == 0 &&
+        mnemonic[len] == '\0') {
+      return op;
+    }
   }
-  
-  if(strcmp(ins->opcode, "ADD")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  return OP_NONE;
+}
+
+/* Packs a mnemonic of up to 8 characters into an integer, 0 if longer */
+static uint64_t
+mnemonic_key(const char* name, size_t len)
+{
+  uint64_t key = 0;
+
+  if (len > sizeof(key)) {
+    return 0;
   }
+  memcpy(&key, name, len);
+  return key;
+}
+
+/* mnemonic_key() of every opcode, indexed by OP_*. Filled once, then
+ * only read, so parsers may run concurrently.
+ */
+static uint64_t opcode_keys[NUM_OPCODES];
+static pthread_once_t opcode_keys_once = PTHREAD_ONCE_INIT;
 
-  if(strcmp(ins->opcode, "ADDL")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+static void
+init_opcode_keys(void)
+{
+  for (int op = OP_MOVC; op <= OP_HALT; ++op) {
+    const char* name = APEX_opcode_info[op].name;
+    opcode_keys[op] = mnemonic_key(name, strlen(name));
   }
+}
 
-  if(strcmp(ins->opcode, "STR")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+/*
+ * Decodes a line written in the canonical form "OP,R1,R2,#-3" without
+ * blanks or empty fields, which is what generated programs contain.
+ * Returns 0, leaving the line to parse_line(), on anything else
+ * including errors. Otherwise *next is the start of the following line.
+ */
+static int
+parse_canonical(const char* s, const char* end, APEX_Instruction* ins,
+                const char** next)
+{
+  const char* c = s;
+
+  while (c < end && *c >= 'A' && *c <= 'Z') {
+    c++;
+  }
+  uint64_t key = mnemonic_key(s, c - s);
+  if (!key) {
+    return 0;
   }
-  
-  if(strcmp(ins->opcode, "LOAD")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->imm = get_num_from_string(tokens[3]);
+  int opcode = OP_MOVC;
+  while (opcode <= OP_HALT && opcode_keys[opcode] != key) {
+    opcode++;
   }
+  if (opcode > OP_HALT) {
+    return 0;
+  }
+
+  APEX_Instruction decoded = { 0 };
+  const unsigned char* slot =
+    format_operands[APEX_opcode_info[opcode].format];
+  for (; *slot != OPND_END; ++slot) {
+    if (end - c < 3 || c[0] != ',' ||
+        (c[1] != 'R' && c[1] != 'r' && c[1] != '#')) {
+      return 0;
+    }
+    c += 2;
+
+    int negative = (*c == '-');
+    c += negative;
+    const char* digits = c;
+    const char* limit = end - c > 9 ? c + 9 : end;
+    unsigned int value = 0;
+    while (c < limit && (unsigned char)(*c - '0') <= 9) {
+      value = value * 10 + (*c - '0');
+      c++;
+    }
+    if (c == digits || (c < end && (unsigned char)(*c - '0') <= 9)) {
+      return 0;
+    }
 
-  if(strcmp(ins->opcode, "LDR")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->imm = get_num_from_string(tokens[3]);
+    switch (*slot) {
+      case OPND_RD:
+      case OPND_RS1:
+      case OPND_RS2:
+        if (negative || value > 15) {
+          return 0;
+        }
+        if (*slot == OPND_RD) {
+          decoded.rd = value;
+        }
+        else if (*slot == OPND_RS1) {
+          decoded.rs1 = value;
+        }
+        else {
+          decoded.rs2 = value;
+        }
+        break;
+      default:
+        decoded.imm = negative ? -(int)value : (int)value;
+        break;
+    }
   }
-  
-  if(strcmp(ins->opcode, "SUB")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+
+  if (c < end && *c == '\r') {
+    c++;
   }
-  
-   if(strcmp(ins->opcode, "AND")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  if (c < end && *c != '\n') {
+    return 0;
   }
-  
-   if(strcmp(ins->opcode, "OR")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  *next = c < end ? c + 1 : end;
+
+  decoded.opcode = opcode;
+  *ins = decoded;
+  return 1;
+}
+
+/*
+ * Parses "R<n>" or "#<n>". Either prefix is accepted for any operand,
+ * as the original parser only skipped the first character.
+ */
+static int
+parse_operand(const APEX_Parser* p, const char* s, const char* e, int* value)
+{
+  const char* c = s;
+  long long v = 0;
+  int negative = 0;
+
+  if (c == e || (*c != 'R' && *c != 'r' && *c != '#')) {
+    parse_error(p, s, "expected R<n> or #<n>, found '%.*s'", (int)(e - s), s);
+    return -1;
   }
-  
-   if(strcmp(ins->opcode, "XOR")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  c++;
+  if (c < e && (*c == '-' || *c == '+')) {
+    negative = (*c == '-');
+    c++;
   }
-  
-   if(strcmp(ins->opcode, "MUL")==0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->rs1 = get_num_from_string(tokens[2]);
-    ins->rs2 = get_num_from_string(tokens[3]);
+  if (c == e) {
+    parse_error(p, s, "missing number in '%.*s'", (int)(e - s), s);
+    return -1;
   }
-  
-  if(strcmp(ins->opcode, "JUMP")==0) {
-    ins->rs1 = get_num_from_string(tokens[1]); 
-    ins->imm = get_num_from_string(tokens[2]);  
+  for (; c < e; ++c) {
+    if (*c < '0' || *c > '9') {
+      parse_error(p, c, "unexpected '%c' in '%.*s'", *c, (int)(e - s), s);
+      return -1;
+    }
+    v = v * 10 + (*c - '0');
+    if (v > (long long)INT_MAX + 1) {
+      parse_error(p, s, "number '%.*s' out of range", (int)(e - s), s);
+      return -1;
+    }
   }
-  
-  if(strcmp(ins->opcode, "BZ")==0) {
-    ins->imm = get_num_from_string(tokens[1]);  
+  if (negative) {
+    v = -v;
   }
-  
-  if(strcmp(ins->opcode, "BNZ")==0) {
-    ins->imm = get_num_from_string(tokens[1]);  
+  if (v > INT_MAX) {
+    parse_error(p, s, "number '%.*s' out of range", (int)(e - s), s);
+    return -1;
   }
-  
-  if(strcmp(ins->opcode, "HALT")==0) {
-      ins->imm = get_num_from_string(tokens[1]);
+  *value = (int)v;
+  return 0;
+}
+
+/*
+ * Decodes one line of assembly. The mnemonic is resolved once here, so
+ * the pipeline never compares strings. A blank line becomes an empty
+ * instruction.
+ *
+ * Note : you can edit this function to add new instructions
+ */
+static int
+parse_line(const APEX_Parser* p, const char* s, const char* end,
+           APEX_Instruction* ins)
+{
+  const char* field_end;
+
+  memset(ins, 0, sizeof(*ins));
+
+  const char* field = next_field(&s, end, &field_end);
+  if (!field) {
+    return 0;
   }
-  
-  if(strcmp(ins->opcode, "JUMP")==0) {
-    ins->rs1 = get_num_from_string(tokens[1]); 
-    ins->imm = get_num_from_string(tokens[2]);  
+  ins->opcode = lookup_opcode(field, field_end - field);
+  if (ins->opcode == OP_NONE) {
+    parse_error(p, field, "unknown instruction '%.*s'",
+                (int)(field_end - field), field);
+    return -1;
   }
-  
-  
-  
-  
-  
 
+  const unsigned char* slot =
+    format_operands[APEX_opcode_info[ins->opcode].format];
+  for (; *slot != OPND_END; ++slot) {
+    int value;
+    field = next_field(&s, end, &field_end);
+    if (!field) {
+      parse_error(p, end, "missing operand for %s",
+                  APEX_opcode_info[ins->opcode].name);
+      return -1;
+    }
+    if (parse_operand(p, field, field_end, &value) < 0) {
+      return -1;
+    }
+    if (*slot != OPND_IMM && (value < 0 || value > 15)) {
+      parse_error(p, field, "register '%.*s' out of range",
+                  (int)(field_end - field), field);
+      return -1;
+    }
 
-}
+    switch (*slot) {
+      case OPND_RD:
+        ins->rd = value;
+        break;
+      case OPND_RS1:
+        ins->rs1 = value;
+        break;
+      case OPND_RS2:
+        ins->rs2 = value;
+        break;
+      default:
+        ins->imm = value;
+        break;
+    }
+  }
 
+  field = next_field(&s, end, &field_end);
+  if (field) {
+    parse_error(p, field, "unexpected operand '%.*s'",
+                (int)(field_end - field), field);
+    return -1;
+  }
+  return 0;
+}
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Pre-assembled program image (.apexbin) : an APEX_Image_Header followed
+ * by code memory exactly as APEX_Instruction is laid out in memory, so
+ * the simulator runs straight from the mapped file. The probe rejects
+ * images written by a build with another instruction layout.
  */
-APEX_Instruction*
-create_code_memory(const char* filename, int* size)
+#define IMAGE_MAGIC "APEXBIN1"
+#define IMAGE_VERSION 1
+
+typedef struct APEX_Image_Header
 {
-  if (!filename) {
-    return NULL;
+  char magic[8];            // IMAGE_MAGIC
+  uint32_t version;         // IMAGE_VERSION
+  uint32_t ins_size;        // sizeof(APEX_Instruction)
+  uint32_t count;           // Instructions in the image
+  uint32_t header_check;    // FNV-1a of the header with this field zero
+  uint64_t code_check;      // FNV-1a of the instructions
+  unsigned char probe[8];   // image_probe() of the writer
+} APEX_Image_Header;
+
+_Static_assert(sizeof(APEX_Instruction) <= 8,
+               "APEX_Instruction must fit the image probe");
+_Static_assert(sizeof(APEX_Image_Header) % 8 == 0,
+               "Image code must stay aligned");
+
+static uint64_t
+fnv1a(uint64_t hash, const void* data, size_t len)
+{
+  const unsigned char* bytes = data;
+
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
   }
+  return hash;
+}
+
+#define FNV_OFFSET 14695981039346656037ull
+
+/* Copy of ins with every padding bit cleared, so images are
+ * reproducible
+ */
+static APEX_Instruction
+canonical_instruction(const APEX_Instruction* ins)
+{
+  APEX_Instruction out;
+
+  memset(&out, 0, sizeof(out));
+  out.imm = ins->imm;
+  out.opcode = ins->opcode;
+  out.rd = ins->rd;
+  out.rs1 = ins->rs1;
+  out.rs2 = ins->rs2;
+  return out;
+}
+
+static void
+image_probe(unsigned char probe[8])
+{
+  APEX_Instruction ins;
+
+  memset(&ins, 0, sizeof(ins));
+  ins.imm = 0x01020304;
+  ins.opcode = OP_HALT;
+  ins.rd = 1;
+  ins.rs1 = 2;
+  ins.rs2 = 3;
+  ins = canonical_instruction(&ins);
+  memset(probe, 0, 8);
+  memcpy(probe, &ins, sizeof(ins));
+}
+
+static uint32_t
+header_check(const APEX_Image_Header* header)
+{
+  APEX_Image_Header copy = *header;
 
-  FILE* fp = fopen(filename, "r");
+  copy.header_check = 0;
+  return (uint32_t)fnv1a(FNV_OFFSET, &copy, sizeof(copy));
+}
+
+/*
+ * Writes code memory as an .apexbin image. Returns -1 on error.
+ */
+int
+write_code_image(const APEX_Instruction* code, int size, const char* filename)
+{
+  APEX_Image_Header header;
+  int error = 0;
+
+  FILE* fp = fopen(filename, "wb");
   if (!fp) {
+    return -1;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.version = IMAGE_VERSION;
+  header.ins_size = sizeof(APEX_Instruction);
+  header.count = size;
+  header.code_check = FNV_OFFSET;
+  for (int i = 0; i < size; ++i) {
+    APEX_Instruction ins = canonical_instruction(&code[i]);
+    header.code_check = fnv1a(header.code_check, &ins, sizeof(ins));
+  }
+  image_probe(header.probe);
+  header.header_check = header_check(&header);
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+    error = 1;
+  }
+  for (int i = 0; i < size && !error; ++i) {
+    APEX_Instruction ins = canonical_instruction(&code[i]);
+    if (fwrite(&ins, sizeof(ins), 1, fp) != 1) {
+      error = 1;
+    }
+  }
+  if (fclose(fp) != 0) {
+    error = 1;
+  }
+  return error ? -1 : 0;
+}
+
+/*
+ * Validates the header of a mapped image and the opcode of every
+ * instruction, which the stage handler tables are indexed by, and
+ * returns its code memory, or NULL after printing why the image is
+ * unusable. The instructions themselves are only checksummed by
+ * verify_code_image().
+ */
+static APEX_Instruction*
+open_code_image(const char* filename, const char* map, size_t length,
+                int* size, FILE* err)
+{
+  const APEX_Image_Header* header = (const APEX_Image_Header*)map;
+  unsigned char probe[8];
+
+  image_probe(probe);
+  if (header->version != IMAGE_VERSION ||
+      header->ins_size != sizeof(APEX_Instruction) ||
+      memcmp(header->probe, probe, sizeof(probe)) != 0) {
+    fprintf(err, "APEX_Error : %s: image built for another simulator "
+            "version, re-assemble it\n", filename);
+    return NULL;
+  }
+  if (header->header_check != header_check(header) ||
+      length != sizeof(*header) + (size_t)header->count * header->ins_size ||
+      header->count == 0 || header->count > INT_MAX) {
+    fprintf(err, "APEX_Error : %s: corrupt image header\n", filename);
     return NULL;
   }
 
-  char* line = NULL;
-  size_t len = 0;
-  ssize_t nread;
-  int code_memory_size = 0;
+  APEX_Instruction* code = (APEX_Instruction*)(map + sizeof(*header));
+  for (uint32_t i = 0; i < header->count; ++i) {
+    if (code[i].opcode >= NUM_OPCODES || code[i].opcode == OP_FLUSH) {
+      fprintf(err, "APEX_Error : %s: invalid opcode %u at pc(%u)\n",
+              filename, code[i].opcode, 4000 + 4 * i);
+      return NULL;
+    }
+  }
+
+  *size = header->count;
+  return code;
+}
+
+/*
+ * Checksums the instructions of code memory mapped from an image.
+ * Returns -1 if they do not match the header.
+ */
+int
+verify_code_image(const APEX_Instruction* code, int size)
+{
+  const APEX_Image_Header* header =
+    (const APEX_Image_Header*)((const char*)code - sizeof(*header));
+
+  return fnv1a(FNV_OFFSET, code, sizeof(*code) * size) == header->code_check
+         ? 0 : -1;
+}
 
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    code_memory_size++;
+/* Releases code memory from create_code_memory() */
+void
+destroy_code_memory(APEX_Instruction* code, int size, int mapped)
+{
+  if (mapped) {
+    munmap((char*)code - sizeof(APEX_Image_Header),
+           sizeof(APEX_Image_Header) + sizeof(*code) * size);
+  }
+  else {
+    free(code);
   }
-  *size = code_memory_size;
-  if (!code_memory_size) {
-    fclose(fp);
+}
+
+/*
+ * Decodes assembly text in a single pass, one instruction per line.
+ * name is only used in error messages. Prints the line and column of
+ * the first syntax error to err and returns NULL.
+ */
+APEX_Instruction*
+parse_code_memory(const char* name, const char* text, size_t length,
+                  int* size, FILE* err)
+{
+  pthread_once(&opcode_keys_once, init_opcode_keys);
+
+  /* A typical line is about 12 bytes, growing from there is rare */
+  int capacity = length / 12 + 16;
+  int count = 0;
+  APEX_Instruction* code_memory = malloc(sizeof(*code_memory) * capacity);
+  APEX_Parser parser = { err, name, text, 0 };
+  const char* end = text + length;
+  const char* s = text;
+
+  while (code_memory && s < end) {
+    if (count == capacity) {
+      capacity *= 2;
+      APEX_Instruction* grown =
+        realloc(code_memory, sizeof(*code_memory) * capacity);
+      if (!grown) {
+        free(code_memory);
+        code_memory = NULL;
+        break;
+      }
+      code_memory = grown;
+    }
+
+    parser.line_num++;
+    if (parse_canonical(s, end, &code_memory[count], &s)) {
+      count++;
+      continue;
+    }
+
+    const char* eol = memchr(s, '\n', end - s);
+    if (!eol) {
+      eol = end;
+    }
+    parser.line = s;
+    if (parse_line(&parser, s, eol, &code_memory[count]) < 0) {
+      free(code_memory);
+      code_memory = NULL;
+      break;
+    }
+    count++;
+    s = eol + 1;
+  }
+
+  *size = count;
+  return code_memory;
+}
+
+/*
+ * Maps the input file. An .apexbin image is used in place, *mapped is
+ * set and code memory points into the mapping. Assembly goes through
+ * parse_code_memory(). Errors are reported to err.
+ */
+APEX_Instruction*
+create_code_memory(const char* filename, int* size, int* mapped, FILE* err)
+{
+  *mapped = 0;
+  if (!filename) {
     return NULL;
   }
 
-  APEX_Instruction* code_memory =
-    malloc(sizeof(*code_memory) * code_memory_size);
-  if (!code_memory) {
-    fclose(fp);
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  size_t length = st.st_size;
+  const char* text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED) {
     return NULL;
   }
 
-  rewind(fp);
-  int current_instruction = 0;
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    create_APEX_instruction(&code_memory[current_instruction], line);
-    current_instruction++;
+  if (length >= sizeof(APEX_Image_Header) &&
+      memcmp(text, IMAGE_MAGIC, strlen(IMAGE_MAGIC)) == 0) {
+    APEX_Instruction* code = open_code_image(filename, text, length, size,
+                                             err);
+    if (!code) {
+      munmap((void*)text, length);
+      return NULL;
+    }
+    *mapped = 1;
+    return code;
   }
 
-  free(line);
-  fclose(fp);
+  madvise((void*)text, length, MADV_SEQUENTIAL);
+  APEX_Instruction* code_memory = parse_code_memory(filename, text, length,
+                                                    size, err);
+  munmap((void*)text, length);
   return code_memory;
 }
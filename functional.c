@@ -0,0 +1,585 @@
+/*
+ *  functional.c
+ *  Executes code memory one instruction at a time with APEX semantics.
+ *  No latches, no stalls : only the final architectural state is
+ *  modelled, which makes this mode suitable for long runs and for
+ *  checking the pipeline's end state. A taken BZ, BNZ or JUMP goes to
+ *  its target at once, with no delay slots : the pipelines squash what
+ *  they fetched behind it, with or without a branch predictor.
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "functional.h"
+#include "jit.h"
+#include "trace.h"
+
+const char* const APEX_functional_stop_names[NUM_FUNC_STOPS] = {
+  [FUNC_HALT]  = "HALT",
+  [FUNC_END]   = "end of code memory",
+  [FUNC_LIMIT] = "instruction limit",
+  [FUNC_FAULT] = "data memory fault",
+};
+
+const char* const APEX_functional_engine_names[NUM_FUNC_ENGINES] = {
+  [FUNC_ENGINE_SWITCH]   = "switch",
+  [FUNC_ENGINE_THREADED] = "threaded",
+  [FUNC_ENGINE_JIT]      = "jit",
+};
+
+/* Code memory index of a PC-relative branch target, same rounding as
+ * get_code_index but inlined into the dispatch loop
+ */
+static inline int
+branch_index(int index, int imm)
+{
+  return (index * 4 + imm) / 4;
+}
+
+/*
+ * Runs from cpu->pc until HALT, the end of code memory, a data memory
+ * fault or max_ins retired instructions (max_ins <= 0 means no limit).
+ * Registers, zero flag, pc and data memory are left in the CPU.
+ */
+int
+APEX_functional_run(APEX_CPU* cpu, long long max_ins, long long* retired)
+{
+  const APEX_Instruction* code = cpu->code_memory;
+  const unsigned int size = cpu->code_memory_size;
+  int* mem = cpu->data_memory;
+  int regs[16];
+  int zero = cpu->zero;
+  int index = get_code_index(cpu->pc);
+  long long count = 0;
+  int stop = FUNC_LIMIT;
+
+  if (max_ins <= 0) {
+    max_ins = LLONG_MAX;
+  }
+
+  /* Work on a private copy of the register file : it cannot alias data
+   * memory, so the compiler keeps it out of the store path.
+   */
+  memcpy(regs, cpu->regs, sizeof(regs));
+
+  while (count < max_ins) {
+    if ((unsigned int)index >= size) {
+      stop = FUNC_END;
+      break;
+    }
+
+    const APEX_Instruction* ins = &code[index];
+    int next = index + 1;
+    unsigned int addr;
+    int result;
+
+    switch (ins->opcode) {
+      case OP_MOVC:
+        regs[ins->rd] = ins->imm;
+        break;
+
+      case OP_ADD:
+        result = regs[ins->rs1] + regs[ins->rs2];
+        regs[ins->rd] = result;
+        zero = (result == 0);
+        break;
+
+      case OP_ADDL:
+        result = regs[ins->rs1] + ins->imm;
+        regs[ins->rd] = result;
+        zero = (result == 0);
+        break;
+
+      case OP_SUB:
+        result = regs[ins->rs1] - regs[ins->rs2];
+        regs[ins->rd] = result;
+        zero = (result == 0);
+        break;
+
+      case OP_MUL:
+        result = regs[ins->rs1] * regs[ins->rs2];
+        regs[ins->rd] = result;
+        zero = (result == 0);
+        break;
+
+      case OP_AND:
+        regs[ins->rd] = regs[ins->rs1] & regs[ins->rs2];
+        break;
+
+      case OP_OR:
+        regs[ins->rd] = regs[ins->rs1] | regs[ins->rs2];
+        break;
+
+      case OP_XOR:
+        regs[ins->rd] = regs[ins->rs1] ^ regs[ins->rs2];
+        break;
+
+      case OP_LOAD:
+        addr = regs[ins->rs1] + ins->imm;
+        if (addr >= DATA_MEMORY_SIZE) {
+          goto fault;
+        }
+        regs[ins->rd] = mem[addr];
+        break;
+
+      case OP_LDR:
+        addr = regs[ins->rs1] + regs[ins->rs2];
+        if (addr >= DATA_MEMORY_SIZE) {
+          goto fault;
+        }
+        regs[ins->rd] = mem[addr];
+        break;
+
+      case OP_STORE:
+        addr = regs[ins->rs2] + ins->imm;
+        if (addr >= DATA_MEMORY_SIZE) {
+          goto fault;
+        }
+        mem[addr] = regs[ins->rs1];
+        break;
+
+      case OP_STR:
+        addr = regs[ins->rs1] + regs[ins->rs2];
+        if (addr >= DATA_MEMORY_SIZE) {
+          goto fault;
+        }
+        mem[addr] = regs[ins->rd];
+        break;
+
+      case OP_BZ:
+        if (zero) {
+          next = branch_index(index, ins->imm);
+        }
+        break;
+
+      case OP_BNZ:
+        if (!zero) {
+          next = branch_index(index, ins->imm);
+        }
+        break;
+
+      case OP_JUMP:
+        next = get_code_index(regs[ins->rs1] + ins->imm);
+        break;
+
+      case OP_HALT:
+        count++;
+        index = next;
+        stop = FUNC_HALT;
+        goto done;
+
+      default:
+        break;
+    }
+
+    count++;
+    index = next;
+  }
+  goto done;
+
+fault:
+  stop = FUNC_FAULT;
+
+done:
+  memcpy(cpu->regs, regs, sizeof(regs));
+  cpu->zero = zero;
+  cpu->pc = 4000 + index * 4;
+  cpu->ins_completed = count > INT_MAX ? INT_MAX : (int)count;
+  if (retired) {
+    *retired = count;
+  }
+  return stop;
+}
+
+/* One pre-linked instruction of the threaded engine : the handler
+ * address replaces the opcode, and BZ/BNZ carry their target index in
+ * imm, so dispatch never decodes bitfields or computes PCs.
+ */
+typedef struct APEX_Threaded_Op
+{
+  const void* handler;  // Label of the handler in threaded_exec()
+  int imm;              // Literal value, or branch target index
+  unsigned char rd;     // Destination Register Address
+  unsigned char rs1;    // Source-1 Register Address
+  unsigned char rs2;    // Source-2 Register Address
+} APEX_Threaded_Op;
+
+#if defined(__GNUC__)
+
+/*
+ * Executes pre-linked code. Called with ops == NULL it only hands out its
+ * handler table, which is how the linker learns the label addresses.
+ */
+static int
+threaded_exec(APEX_CPU* cpu, const APEX_Threaded_Op* ops, int size,
+              long long max_ins, long long* retired,
+              const void* const** handlers_out)
+{
+  static const void* const handlers[NUM_OPCODES + 1] = {
+    [OP_NONE]  = &&op_nop,
+    [OP_MOVC]  = &&op_movc,
+    [OP_STORE] = &&op_store,
+    [OP_STR]   = &&op_str,
+    [OP_LOAD]  = &&op_load,
+    [OP_LDR]   = &&op_ldr,
+    [OP_ADD]   = &&op_add,
+    [OP_ADDL]  = &&op_addl,
+    [OP_SUB]   = &&op_sub,
+    [OP_AND]   = &&op_and,
+    [OP_OR]    = &&op_or,
+    [OP_XOR]   = &&op_xor,
+    [OP_MUL]   = &&op_mul,
+    [OP_JUMP]  = &&op_jump,
+    [OP_BZ]    = &&op_bz,
+    [OP_BNZ]   = &&op_bnz,
+    [OP_HALT]  = &&op_halt,
+    [OP_FLUSH] = &&op_nop,
+    [NUM_OPCODES] = &&op_end,
+  };
+
+  if (!ops) {
+    *handlers_out = handlers;
+    return 0;
+  }
+
+  int* mem = cpu->data_memory;
+  int regs[16];
+  int zero = cpu->zero;
+  int index = get_code_index(cpu->pc);
+  const APEX_Threaded_Op* op;
+  long long budget = max_ins > 0 ? max_ins : LLONG_MAX;
+  long long left = budget;
+  unsigned int addr;
+  int result;
+  int stop = FUNC_LIMIT;
+
+  memcpy(regs, cpu->regs, sizeof(regs));
+
+/* Retire the current op and jump straight to the next one's handler */
+#define DISPATCH()                      \
+  do {                                  \
+    if (--left == 0) {                  \
+      goto limit;                       \
+    }                                   \
+    goto *op->handler;                  \
+  } while (0)
+#define NEXT()                          \
+  do {                                  \
+    op++;                               \
+    DISPATCH();                         \
+  } while (0)
+#define BRANCH_TO(target)               \
+  do {                                  \
+    int target_ = (target);             \
+    if ((unsigned int)target_ >= (unsigned int)size) { \
+      index = target_;                  \
+      stop = --left ? FUNC_END : FUNC_LIMIT; \
+      goto done;                        \
+    }                                   \
+    op = &ops[target_];                 \
+    DISPATCH();                         \
+  } while (0)
+
+  if ((unsigned int)index >= (unsigned int)size) {
+    stop = FUNC_END;
+    goto done;
+  }
+  op = &ops[index];
+  goto *op->handler;
+
+op_nop:
+  NEXT();
+
+op_movc:
+  regs[op->rd] = op->imm;
+  NEXT();
+
+op_add:
+  result = regs[op->rs1] + regs[op->rs2];
+  regs[op->rd] = result;
+  zero = (result == 0);
+  NEXT();
+
+op_addl:
+  result = regs[op->rs1] + op->imm;
+  regs[op->rd] = result;
+  zero = (result == 0);
+  NEXT();
+
+op_sub:
+  result = regs[op->rs1] - regs[op->rs2];
+  regs[op->rd] = result;
+  zero = (result == 0);
+  NEXT();
+
+op_mul:
+  result = regs[op->rs1] * regs[op->rs2];
+  regs[op->rd] = result;
+  zero = (result == 0);
+  NEXT();
+
+op_and:
+  regs[op->rd] = regs[op->rs1] & regs[op->rs2];
+  NEXT();
+
+op_or:
+  regs[op->rd] = regs[op->rs1] | regs[op->rs2];
+  NEXT();
+
+op_xor:
+  regs[op->rd] = regs[op->rs1] ^ regs[op->rs2];
+  NEXT();
+
+op_load:
+  addr = regs[op->rs1] + op->imm;
+  if (addr >= DATA_MEMORY_SIZE) {
+    goto fault;
+  }
+  regs[op->rd] = mem[addr];
+  NEXT();
+
+op_ldr:
+  addr = regs[op->rs1] + regs[op->rs2];
+  if (addr >= DATA_MEMORY_SIZE) {
+    goto fault;
+  }
+  regs[op->rd] = mem[addr];
+  NEXT();
+
+op_store:
+  addr = regs[op->rs2] + op->imm;
+  if (addr >= DATA_MEMORY_SIZE) {
+    goto fault;
+  }
+  mem[addr] = regs[op->rs1];
+  NEXT();
+
+op_str:
+  addr = regs[op->rs1] + regs[op->rs2];
+  if (addr >= DATA_MEMORY_SIZE) {
+    goto fault;
+  }
+  mem[addr] = regs[op->rd];
+  NEXT();
+
+op_bz:
+  if (zero) {
+    BRANCH_TO(op->imm);
+  }
+  NEXT();
+
+op_bnz:
+  if (!zero) {
+    BRANCH_TO(op->imm);
+  }
+  NEXT();
+
+op_jump:
+  BRANCH_TO(get_code_index(regs[op->rs1] + op->imm));
+
+op_halt:
+  left--;
+  index = op - ops + 1;
+  stop = FUNC_HALT;
+  goto done;
+
+op_end:
+  index = size;
+  stop = FUNC_END;
+  goto done;
+
+limit:
+  /* op already points at the successor of the last retired instruction */
+  index = op - ops;
+  goto done;
+
+fault:
+  index = op - ops;
+  stop = FUNC_FAULT;
+
+done:
+#undef BRANCH_TO
+#undef NEXT
+#undef DISPATCH
+  memcpy(cpu->regs, regs, sizeof(regs));
+  cpu->zero = zero;
+  cpu->pc = 4000 + index * 4;
+  long long count = budget - left;
+  cpu->ins_completed = count > INT_MAX ? INT_MAX : (int)count;
+  if (retired) {
+    *retired = count;
+  }
+  return stop;
+}
+
+#endif
+
+/*
+ * Direct-threaded engine : links code memory into an array of handler
+ * addresses with operands unpacked, then runs it with computed gotos.
+ * Same contract as APEX_functional_run(). Compilers without labels as
+ * values fall back to the switch engine.
+ */
+int
+APEX_threaded_run(APEX_CPU* cpu, long long max_ins, long long* retired)
+{
+#if defined(__GNUC__)
+  const void* const* handlers;
+  int size = cpu->code_memory_size;
+
+  APEX_Threaded_Op* ops = malloc(sizeof(*ops) * (size + 1));
+  if (!ops) {
+    return APEX_functional_run(cpu, max_ins, retired);
+  }
+
+  threaded_exec(cpu, NULL, 0, 0, NULL, &handlers);
+  for (int i = 0; i < size; ++i) {
+    const APEX_Instruction* ins = &cpu->code_memory[i];
+    APEX_Threaded_Op* op = &ops[i];
+
+    op->handler = handlers[ins->opcode < NUM_OPCODES ? ins->opcode : OP_NONE];
+    op->rd = ins->rd;
+    op->rs1 = ins->rs1;
+    op->rs2 = ins->rs2;
+    op->imm = ins->imm;
+    if (ins->opcode == OP_BZ || ins->opcode == OP_BNZ) {
+      op->imm = branch_index(i, ins->imm);
+    }
+  }
+  /* Falling off the last instruction lands on this sentinel */
+  memset(&ops[size], 0, sizeof(ops[size]));
+  ops[size].handler = handlers[NUM_OPCODES];
+
+  int stop = threaded_exec(cpu, ops, size, max_ins, retired, NULL);
+  free(ops);
+  return stop;
+#else
+  return APEX_functional_run(cpu, max_ins, retired);
+#endif
+}
+
+typedef int (*APEX_Functional_Engine)(APEX_CPU* cpu, long long max_ins,
+                                     long long* retired);
+
+static const APEX_Functional_Engine engines[NUM_FUNC_ENGINES] = {
+  [FUNC_ENGINE_SWITCH]   = APEX_functional_run,
+  [FUNC_ENGINE_THREADED] = APEX_threaded_run,
+  [FUNC_ENGINE_JIT]      = APEX_jit_run,
+};
+
+static double
+elapsed_seconds(const struct timespec* start)
+{
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/*
+ * Entry point of the functional run types. req_ins bounds the number of
+ * retired instructions (0 runs to HALT). Prints the same final state dump
+ * as the pipelined model.
+ */
+int
+APEX_functional_simulate(APEX_CPU* cpu, int engine, const char* req_ins)
+{
+  long long retired = 0;
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int stop = engines[engine](cpu, req_ins ? atoll(req_ins) : 0, &retired);
+  double seconds = elapsed_seconds(&start);
+
+  if (stop == FUNC_FAULT) {
+    fprintf(cpu->err,
+            "APEX_Error : data memory access out of range at pc(%d)\n",
+            cpu->pc);
+  }
+  if (APEX_TRACE_ON(cpu, TRACE_SUMMARY)) {
+    fprintf(cpu->err,
+      "APEX_FUNC : %s engine retired %lld instructions in %.3f s (%.1f MIPS), "
+      "stopped on %s\n",
+      APEX_functional_engine_names[engine], retired, seconds,
+      seconds > 0 ? retired / seconds / 1e6 : 0.0,
+      APEX_functional_stop_names[stop]);
+  }
+
+  fprintf(cpu->out, "(apex) >> Simulation Complete");
+  fprintf(cpu->out, "\n");
+  APEX_cpu_dump(cpu);
+
+  return stop == FUNC_FAULT;
+}
+
+/* Architectural state compared between engines */
+static int
+same_state(const APEX_CPU* a, const APEX_CPU* b)
+{
+  return a->pc == b->pc && a->zero == b->zero &&
+         memcmp(a->regs, b->regs, sizeof(a->regs)) == 0 &&
+         memcmp(a->data_memory, b->data_memory, sizeof(a->data_memory)) == 0;
+}
+
+/*
+ * Entry point of the "bench" run type : runs every engine from the same
+ * initial state, reports throughput relative to the switch engine and
+ * checks that all engines agree on the final state.
+ */
+int
+APEX_functional_bench(APEX_CPU* cpu, const char* req_ins)
+{
+  long long max_ins = req_ins ? atoll(req_ins) : 0;
+  APEX_CPU* initial = malloc(sizeof(*initial));
+  APEX_CPU* reference = malloc(sizeof(*reference));
+  double base_seconds = 0;
+  int mismatches = 0;
+
+  if (!initial || !reference) {
+    free(initial);
+    free(reference);
+    return 1;
+  }
+  *initial = *cpu;
+
+  fprintf(cpu->out, "%-10s %14s %10s %10s %8s %s\n", "engine", "retired",
+          "seconds", "MIPS", "speedup", "state");
+  for (int engine = 0; engine < NUM_FUNC_ENGINES; ++engine) {
+    long long retired = 0;
+    struct timespec start;
+
+    *cpu = *initial;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int stop = engines[engine](cpu, max_ins, &retired);
+    double seconds = elapsed_seconds(&start);
+
+    const char* state = "reference";
+    if (engine == 0) {
+      *reference = *cpu;
+      base_seconds = seconds;
+    }
+    else if (same_state(cpu, reference)) {
+      state = "match";
+    }
+    else {
+      state = "MISMATCH";
+      mismatches++;
+    }
+
+    fprintf(cpu->out, "%-10s %14lld %10.3f %10.1f %7.2fx %s (%s)\n",
+            APEX_functional_engine_names[engine], retired, seconds,
+            seconds > 0 ? retired / seconds / 1e6 : 0.0,
+            seconds > 0 ? base_seconds / seconds : 0.0, state,
+            APEX_functional_stop_names[stop]);
+  }
+
+  fprintf(cpu->out, "(apex) >> Simulation Complete");
+  fprintf(cpu->out, "\n");
+  APEX_cpu_dump(cpu);
+
+  free(initial);
+  free(reference);
+  return mismatches != 0;
+}
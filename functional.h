@@ -0,0 +1,44 @@
+#ifndef _APEX_FUNCTIONAL_H_
+#define _APEX_FUNCTIONAL_H_
+/**
+ *  functional.h
+ *  Instruction-level (ISA only) execution of APEX programs, without
+ *  the pipeline timing model
+ */
+#include "cpu.h"
+
+/* Why a functional run stopped */
+enum
+{
+  FUNC_HALT,    // Retired a HALT
+  FUNC_END,     // PC left code memory
+  FUNC_LIMIT,   // Instruction budget exhausted
+  FUNC_FAULT,   // Data memory address out of range
+  NUM_FUNC_STOPS
+};
+
+/* Functional execution engines, all with the same contract */
+enum
+{
+  FUNC_ENGINE_SWITCH,     // Switch dispatch over APEX_Instruction
+  FUNC_ENGINE_THREADED,   // Direct-threaded, pre-linked handler addresses
+  FUNC_ENGINE_JIT,        // x86-64 translation of basic blocks (jit.c)
+  NUM_FUNC_ENGINES
+};
+
+extern const char* const APEX_functional_stop_names[NUM_FUNC_STOPS];
+extern const char* const APEX_functional_engine_names[NUM_FUNC_ENGINES];
+
+int
+APEX_functional_run(APEX_CPU* cpu, long long max_ins, long long* retired);
+
+int
+APEX_threaded_run(APEX_CPU* cpu, long long max_ins, long long* retired);
+
+int
+APEX_functional_simulate(APEX_CPU* cpu, int engine, const char* req_ins);
+
+int
+APEX_functional_bench(APEX_CPU* cpu, const char* req_ins);
+
+#endif
@@ -0,0 +1,608 @@
+/*
+ *  jit.c
+ *  Translates APEX basic blocks of code memory into x86-64 and runs them
+ *  natively. A block starts at any branch target and ends after the
+ *  first BZ, BNZ, JUMP or HALT. Blocks are compiled on first use into
+ *  an mmap'd buffer, and block exits with a static target are patched
+ *  into direct jumps once that target is compiled, so hot loops never
+ *  return to C.
+ *
+ *  The APEX registers, zero flag and data memory stay in APEX_CPU at
+ *  all times, so any exit can hand over to the interpreter with exact
+ *  architectural state. The interpreter takes over for data memory
+ *  faults, the tail of an instruction budget, and blocks that no longer
+ *  fit in the code buffer.
+ */
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "functional.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+/* Size of the executable code buffer */
+#define JIT_CODE_SIZE (32 << 20)
+
+/* Longest block, keeps the per-block budget check meaningful */
+#define JIT_MAX_BLOCK 256
+
+/* Worst-case bytes emitted for one APEX instruction, including its
+ * fault stub
+ */
+#define JIT_MAX_INS_BYTES 96
+
+/* Why generated code returned to the dispatcher, in the upper half of
+ * the 64-bit return value. The lower half is a code memory index.
+ */
+enum
+{
+  JIT_EXIT_CONTINUE,  // Dispatch the block at index
+  JIT_EXIT_HALT,      // HALT retired, index is the next instruction
+  JIT_EXIT_BUDGET,    // Block at index is longer than the budget left
+  JIT_EXIT_FAULT      // Instruction at index accesses data memory out of range
+};
+
+/* A patchable "mov eax, index ; jmp exit" block exit */
+typedef struct APEX_JIT_Exit
+{
+  unsigned char* site;  // First byte of the mov
+  int next;             // Next exit waiting on the same target, -1 ends
+} APEX_JIT_Exit;
+
+typedef uint64_t (*APEX_JIT_Enter)(APEX_CPU* cpu, const void* code,
+                                   long long* budget);
+
+typedef struct APEX_JIT
+{
+  const APEX_Instruction* code;
+  int size;
+
+  unsigned char* buf;     // Executable buffer
+  size_t used;            // Bytes emitted so far
+  int full;               // No room left for another block
+
+  APEX_JIT_Enter enter;   // Trampoline into generated code
+  unsigned char* leave;   // Common exit back to the trampoline's caller
+
+  unsigned char** entry;  // Compiled block per code index, NULL if none
+  int* waiting;           // Head of unpatched exits per target index
+
+  APEX_JIT_Exit* exits;
+  int num_exits;
+  int cap_exits;
+} APEX_JIT;
+
+/* Host registers used by generated code */
+enum
+{
+  EAX = 0,
+  ECX = 1,
+  EDX = 2
+};
+
+#define REG_DISP(r)  ((int32_t)(offsetof(APEX_CPU, regs) + 4 * (r)))
+#define ZERO_DISP    ((int32_t)offsetof(APEX_CPU, zero))
+#define DMEM_DISP    ((int32_t)offsetof(APEX_CPU, data_memory))
+
+static void
+emit8(APEX_JIT* jit, uint8_t b)
+{
+  jit->buf[jit->used++] = b;
+}
+
+static void
+emit32(APEX_JIT* jit, uint32_t v)
+{
+  memcpy(&jit->buf[jit->used], &v, 4);
+  jit->used += 4;
+}
+
+static void
+emit64(APEX_JIT* jit, uint64_t v)
+{
+  memcpy(&jit->buf[jit->used], &v, 8);
+  jit->used += 8;
+}
+
+static void
+patch_rel32(unsigned char* at, const unsigned char* target)
+{
+  int32_t rel = (int32_t)(target - (at + 4));
+  memcpy(at, &rel, 4);
+}
+
+/* <op> reg, [rbx + disp32] and the store form, for 32-bit operands */
+static void
+emit_rbx_mem(APEX_JIT* jit, uint8_t opcode, int reg, int32_t disp)
+{
+  emit8(jit, opcode);
+  emit8(jit, 0x83 | (reg << 3));
+  emit32(jit, disp);
+}
+
+/* reg = APEX register r */
+static void
+emit_load_reg(APEX_JIT* jit, int reg, int r)
+{
+  emit_rbx_mem(jit, 0x8B, reg, REG_DISP(r));
+}
+
+/* APEX register r = reg */
+static void
+emit_store_reg(APEX_JIT* jit, int reg, int r)
+{
+  emit_rbx_mem(jit, 0x89, reg, REG_DISP(r));
+}
+
+/* zero flag = (eax == 0) */
+static void
+emit_set_zero(APEX_JIT* jit)
+{
+  emit8(jit, 0x85);               // test eax, eax
+  emit8(jit, 0xC0);
+  emit8(jit, 0x0F);               // sete cl
+  emit8(jit, 0x94);
+  emit8(jit, 0xC1);
+  emit8(jit, 0x0F);               // movzx ecx, cl
+  emit8(jit, 0xB6);
+  emit8(jit, 0xC9);
+  emit_rbx_mem(jit, 0x89, ECX, ZERO_DISP);
+}
+
+/* add eax, imm32 */
+static void
+emit_add_eax_imm(APEX_JIT* jit, int32_t imm)
+{
+  emit8(jit, 0x05);
+  emit32(jit, imm);
+}
+
+/* mov rax, (reason << 32 | index) ; jmp leave */
+static void
+emit_exit(APEX_JIT* jit, int reason, int index)
+{
+  emit8(jit, 0x48);
+  emit8(jit, 0xB8);
+  emit64(jit, ((uint64_t)reason << 32) | (uint32_t)index);
+  emit8(jit, 0xE9);
+  emit32(jit, 0);
+  patch_rel32(&jit->buf[jit->used - 4], jit->leave);
+}
+
+/*
+ * Block exit to a static target. Jumps straight to the target's code if
+ * it is compiled, otherwise leaves a 10-byte "mov eax, index ; jmp
+ * leave" that link_block() later overwrites with a direct jump.
+ */
+static void
+emit_chain(APEX_JIT* jit, int target)
+{
+  if ((unsigned int)target < (unsigned int)jit->size && jit->entry[target]) {
+    emit8(jit, 0xE9);
+    emit32(jit, 0);
+    patch_rel32(&jit->buf[jit->used - 4], jit->entry[target]);
+    return;
+  }
+
+  unsigned char* site = &jit->buf[jit->used];
+  emit8(jit, 0xB8);               // mov eax, target (clears the reason)
+  emit32(jit, (uint32_t)target);
+  emit8(jit, 0xE9);
+  emit32(jit, 0);
+  patch_rel32(&jit->buf[jit->used - 4], jit->leave);
+
+  if ((unsigned int)target >= (unsigned int)jit->size) {
+    return;
+  }
+  if (jit->num_exits == jit->cap_exits) {
+    int cap = jit->cap_exits ? jit->cap_exits * 2 : 256;
+    APEX_JIT_Exit* exits = realloc(jit->exits, sizeof(*exits) * cap);
+    if (!exits) {
+      return;
+    }
+    jit->exits = exits;
+    jit->cap_exits = cap;
+  }
+  jit->exits[jit->num_exits].site = site;
+  jit->exits[jit->num_exits].next = jit->waiting[target];
+  jit->waiting[target] = jit->num_exits++;
+}
+
+/* Points every exit waiting on index at its freshly compiled code */
+static void
+link_block(APEX_JIT* jit, int index)
+{
+  for (int e = jit->waiting[index]; e >= 0; e = jit->exits[e].next) {
+    unsigned char* site = jit->exits[e].site;
+    site[0] = 0xE9;
+    patch_rel32(site + 1, jit->entry[index]);
+  }
+  jit->waiting[index] = -1;
+}
+
+/*
+ * Computes a data memory word address into eax and branches to a fault
+ * stub when it is out of range. Returns the offset of the jae's rel32.
+ */
+static size_t
+emit_address_check(APEX_JIT* jit)
+{
+  emit8(jit, 0x3D);               // cmp eax, DATA_MEMORY_SIZE
+  emit32(jit, DATA_MEMORY_SIZE);
+  emit8(jit, 0x0F);               // jae fault
+  emit8(jit, 0x83);
+  emit32(jit, 0);
+  return jit->used - 4;
+}
+
+/* [rbx + rax*4 + data_memory] <-> reg */
+static void
+emit_dmem(APEX_JIT* jit, uint8_t opcode, int reg)
+{
+  emit8(jit, opcode);
+  emit8(jit, 0x84 | (reg << 3));
+  emit8(jit, 0x83);
+  emit32(jit, DMEM_DISP);
+}
+
+/*
+ * Compiles the block starting at index. Returns its entry point, or NULL
+ * when the code buffer is full.
+ */
+static unsigned char*
+compile_block(APEX_JIT* jit, int index)
+{
+  const APEX_Instruction* code = jit->code;
+  size_t faults[JIT_MAX_BLOCK];
+  int fault_ins[JIT_MAX_BLOCK];
+  int num_faults = 0;
+  int len = 0;
+
+  /* Find the block end */
+  while (index + len < jit->size && len < JIT_MAX_BLOCK) {
+    int op = code[index + len].opcode;
+    len++;
+    if (op == OP_BZ || op == OP_BNZ || op == OP_JUMP || op == OP_HALT) {
+      break;
+    }
+  }
+
+  if (jit->full ||
+      jit->used + (size_t)len * JIT_MAX_INS_BYTES + 128 > JIT_CODE_SIZE) {
+    jit->full = 1;
+    return NULL;
+  }
+
+  unsigned char* start = &jit->buf[jit->used];
+
+  /* Budget check : the whole block retires or none of it does */
+  emit8(jit, 0x49);               // cmp r13, len
+  emit8(jit, 0x81);
+  emit8(jit, 0xFD);
+  emit32(jit, len);
+  emit8(jit, 0x0F);               // jl budget
+  emit8(jit, 0x8C);
+  emit32(jit, 0);
+  size_t budget_jump = jit->used - 4;
+  emit8(jit, 0x49);               // sub r13, len
+  emit8(jit, 0x81);
+  emit8(jit, 0xED);
+  emit32(jit, len);
+
+  int i;
+  int ended = 0;
+  for (i = index; i < index + len && !ended; ++i) {
+    const APEX_Instruction* ins = &code[i];
+
+    switch (ins->opcode) {
+      case OP_MOVC:
+        emit8(jit, 0xC7);         // mov dword [rbx + rd], imm
+        emit8(jit, 0x83);
+        emit32(jit, REG_DISP(ins->rd));
+        emit32(jit, ins->imm);
+        break;
+
+      case OP_ADD:
+      case OP_SUB:
+      case OP_AND:
+      case OP_OR:
+      case OP_XOR:
+        emit_load_reg(jit, EAX, ins->rs1);
+        emit_rbx_mem(jit,
+                     ins->opcode == OP_ADD ? 0x03 :
+                     ins->opcode == OP_SUB ? 0x2B :
+                     ins->opcode == OP_AND ? 0x23 :
+                     ins->opcode == OP_OR ? 0x0B : 0x33,
+                     EAX, REG_DISP(ins->rs2));
+        emit_store_reg(jit, EAX, ins->rd);
+        if (ins->opcode == OP_ADD || ins->opcode == OP_SUB) {
+          emit_set_zero(jit);
+        }
+        break;
+
+      case OP_MUL:
+        emit_load_reg(jit, EAX, ins->rs1);
+        emit8(jit, 0x0F);         // imul eax, [rbx + rs2]
+        emit_rbx_mem(jit, 0xAF, EAX, REG_DISP(ins->rs2));
+        emit_store_reg(jit, EAX, ins->rd);
+        emit_set_zero(jit);
+        break;
+
+      case OP_ADDL:
+        emit_load_reg(jit, EAX, ins->rs1);
+        emit_add_eax_imm(jit, ins->imm);
+        emit_store_reg(jit, EAX, ins->rd);
+        emit_set_zero(jit);
+        break;
+
+      case OP_LOAD:
+      case OP_LDR:
+        emit_load_reg(jit, EAX, ins->rs1);
+        if (ins->opcode == OP_LOAD) {
+          emit_add_eax_imm(jit, ins->imm);
+        }
+        else {
+          emit_rbx_mem(jit, 0x03, EAX, REG_DISP(ins->rs2));
+        }
+        faults[num_faults] = emit_address_check(jit);
+        fault_ins[num_faults++] = i;
+        emit_dmem(jit, 0x8B, EDX);
+        emit_store_reg(jit, EDX, ins->rd);
+        break;
+
+      case OP_STORE:
+      case OP_STR:
+        if (ins->opcode == OP_STORE) {
+          emit_load_reg(jit, EAX, ins->rs2);
+          emit_add_eax_imm(jit, ins->imm);
+        }
+        else {
+          emit_load_reg(jit, EAX, ins->rs1);
+          emit_rbx_mem(jit, 0x03, EAX, REG_DISP(ins->rs2));
+        }
+        faults[num_faults] = emit_address_check(jit);
+        fault_ins[num_faults++] = i;
+        emit_load_reg(jit, EDX, ins->opcode == OP_STORE ? ins->rs1 : ins->rd);
+        emit_dmem(jit, 0x89, EDX);
+        break;
+
+      case OP_BZ:
+      case OP_BNZ: {
+        emit8(jit, 0x83);         // cmp dword [rbx + zero], 0
+        emit8(jit, 0xBB);
+        emit32(jit, ZERO_DISP);
+        emit8(jit, 0);
+        emit8(jit, 0x0F);         // BZ: jne taken, BNZ: je taken
+        emit8(jit, ins->opcode == OP_BZ ? 0x85 : 0x84);
+        emit32(jit, 0);
+        size_t taken = jit->used - 4;
+        emit_chain(jit, i + 1);
+        patch_rel32(&jit->buf[taken], &jit->buf[jit->used]);
+        emit_chain(jit, (i * 4 + ins->imm) / 4);
+        ended = 1;
+        break;
+      }
+
+      case OP_JUMP:
+        /* eax = get_code_index(rs1 + imm), rounding toward zero */
+        emit_load_reg(jit, EAX, ins->rs1);
+        emit_add_eax_imm(jit, ins->imm - 4000);
+        emit8(jit, 0x89);         // mov edx, eax
+        emit8(jit, 0xC2);
+        emit8(jit, 0xC1);         // sar edx, 31
+        emit8(jit, 0xFA);
+        emit8(jit, 31);
+        emit8(jit, 0x83);         // and edx, 3
+        emit8(jit, 0xE2);
+        emit8(jit, 3);
+        emit8(jit, 0x01);         // add eax, edx
+        emit8(jit, 0xD0);
+        emit8(jit, 0xC1);         // sar eax, 2
+        emit8(jit, 0xF8);
+        emit8(jit, 2);
+        emit8(jit, 0xE9);         // jmp leave (reason 0 : continue)
+        emit32(jit, 0);
+        patch_rel32(&jit->buf[jit->used - 4], jit->leave);
+        ended = 1;
+        break;
+
+      case OP_HALT:
+        emit_exit(jit, JIT_EXIT_HALT, i + 1);
+        ended = 1;
+        break;
+
+      default:
+        /* Empty and unknown instructions retire as no-ops */
+        break;
+    }
+  }
+  if (!ended) {
+    emit_chain(jit, index + len);
+  }
+
+  /* Cold stubs. The budget check fails before anything is charged;
+   * faults refund the instructions that did not retire.
+   */
+  patch_rel32(&jit->buf[budget_jump], &jit->buf[jit->used]);
+  emit_exit(jit, JIT_EXIT_BUDGET, index);
+
+  for (int f = 0; f < num_faults; ++f) {
+    patch_rel32(&jit->buf[faults[f]], &jit->buf[jit->used]);
+    emit8(jit, 0x49);             // add r13, unretired
+    emit8(jit, 0x81);
+    emit8(jit, 0xC5);
+    emit32(jit, index + len - fault_ins[f]);
+    emit_exit(jit, JIT_EXIT_FAULT, fault_ins[f]);
+  }
+
+  jit->entry[index] = start;
+  link_block(jit, index);
+  return start;
+}
+
+/*
+ * Emits the trampoline
+ *   uint64_t enter(APEX_CPU* cpu, const void* code, long long* budget)
+ * which keeps cpu in rbx and the remaining budget in r13 while generated
+ * code runs, and the matching exit sequence.
+ */
+static void
+emit_trampoline(APEX_JIT* jit)
+{
+  jit->enter = (APEX_JIT_Enter)(void*)&jit->buf[jit->used];
+  emit8(jit, 0x53);               // push rbx
+  emit8(jit, 0x41);               // push r12
+  emit8(jit, 0x54);
+  emit8(jit, 0x41);               // push r13
+  emit8(jit, 0x55);
+  emit8(jit, 0x48);               // mov rbx, rdi
+  emit8(jit, 0x89);
+  emit8(jit, 0xFB);
+  emit8(jit, 0x49);               // mov r12, rdx
+  emit8(jit, 0x89);
+  emit8(jit, 0xD4);
+  emit8(jit, 0x4D);               // mov r13, [r12]
+  emit8(jit, 0x8B);
+  emit8(jit, 0x2C);
+  emit8(jit, 0x24);
+  emit8(jit, 0xFF);               // jmp rsi
+  emit8(jit, 0xE6);
+
+  jit->leave = &jit->buf[jit->used];
+  emit8(jit, 0x4D);               // mov [r12], r13
+  emit8(jit, 0x89);
+  emit8(jit, 0x2C);
+  emit8(jit, 0x24);
+  emit8(jit, 0x41);               // pop r13
+  emit8(jit, 0x5D);
+  emit8(jit, 0x41);               // pop r12
+  emit8(jit, 0x5C);
+  emit8(jit, 0x5B);               // pop rbx
+  emit8(jit, 0xC3);               // ret
+}
+
+static void
+jit_destroy(APEX_JIT* jit)
+{
+  if (jit->buf && jit->buf != MAP_FAILED) {
+    munmap(jit->buf, JIT_CODE_SIZE);
+  }
+  free(jit->entry);
+  free(jit->waiting);
+  free(jit->exits);
+}
+
+static int
+jit_create(APEX_JIT* jit, const APEX_CPU* cpu)
+{
+  memset(jit, 0, sizeof(*jit));
+  jit->code = cpu->code_memory;
+  jit->size = cpu->code_memory_size;
+  jit->buf = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  jit->entry = calloc(jit->size ? jit->size : 1, sizeof(*jit->entry));
+  jit->waiting = malloc(sizeof(*jit->waiting) * (jit->size ? jit->size : 1));
+  if (jit->buf == MAP_FAILED || !jit->entry || !jit->waiting) {
+    jit_destroy(jit);
+    return -1;
+  }
+  memset(jit->waiting, 0xFF, sizeof(*jit->waiting) * jit->size);
+  emit_trampoline(jit);
+  return 0;
+}
+
+/*
+ * Same contract as APEX_functional_run(). Falls back to the threaded
+ * interpreter when executable memory is unavailable.
+ */
+int
+APEX_jit_run(APEX_CPU* cpu, long long max_ins, long long* retired)
+{
+  APEX_JIT jit;
+
+  if (jit_create(&jit, cpu) < 0) {
+    return APEX_threaded_run(cpu, max_ins, retired);
+  }
+
+  long long budget = max_ins > 0 ? max_ins : LLONG_MAX;
+  long long left = budget;
+  int index = get_code_index(cpu->pc);
+  int stop = FUNC_LIMIT;
+
+  for (;;) {
+    if (left == 0) {
+      stop = FUNC_LIMIT;
+      break;
+    }
+    if ((unsigned int)index >= (unsigned int)jit.size) {
+      stop = FUNC_END;
+      break;
+    }
+
+    unsigned char* block = jit.entry[index];
+    if (!block) {
+      block = compile_block(&jit, index);
+    }
+
+    long long ran = 0;
+    if (!block) {
+      /* Out of code space : interpret one instruction */
+      cpu->pc = 4000 + index * 4;
+      stop = APEX_functional_run(cpu, 1, &ran);
+      left -= ran;
+      index = get_code_index(cpu->pc);
+      if (stop != FUNC_LIMIT) {
+        break;
+      }
+      continue;
+    }
+
+    uint64_t ret = jit.enter(cpu, block, &left);
+    int reason = (int)(ret >> 32);
+    index = (int)(uint32_t)ret;
+
+    if (reason == JIT_EXIT_CONTINUE) {
+      continue;
+    }
+    if (reason == JIT_EXIT_HALT) {
+      stop = FUNC_HALT;
+      break;
+    }
+    if (reason == JIT_EXIT_BUDGET && left == 0) {
+      stop = FUNC_LIMIT;
+      break;
+    }
+
+    /* Budget tail or faulting access : the interpreter finishes the run */
+    cpu->pc = 4000 + index * 4;
+    stop = APEX_functional_run(cpu, reason == JIT_EXIT_FAULT ? 1 : left, &ran);
+    left -= ran;
+    index = get_code_index(cpu->pc);
+    break;
+  }
+
+  cpu->pc = 4000 + index * 4;
+  long long count = budget - left;
+  cpu->ins_completed = count > INT_MAX ? INT_MAX : (int)count;
+  if (retired) {
+    *retired = count;
+  }
+  jit_destroy(&jit);
+  return stop;
+}
+
+#else
+
+int
+APEX_jit_run(APEX_CPU* cpu, long long max_ins, long long* retired)
+{
+  return APEX_threaded_run(cpu, max_ins, retired);
+}
+
+#endif
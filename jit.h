@@ -0,0 +1,12 @@
+#ifndef _APEX_JIT_H_
+#define _APEX_JIT_H_
+/**
+ *  jit.h
+ *  Dynamic binary translation of APEX basic blocks to x86-64
+ */
+#include "cpu.h"
+
+int
+APEX_jit_run(APEX_CPU* cpu, long long max_ins, long long* retired);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ *  latency.c
+ *  Latency table files. One opcode per line, '#' starts a comment :
+ *    <opcode> <cycles> [pipelined|unpipelined]
+ *  e.g.
+ *    MUL   4             # 4-cycle pipelined multiplier
+ *    ADD   2 unpipelined
+ *    LOAD  3             # data memory access of 3 cycles
+ *  Opcodes not listed take one pipelined cycle, the timing of the
+ *  pipeline without a table.
+ */
+#include <string.h>
+
+#include "latency.h"
+
+void
+APEX_latency_defaults(APEX_Latency_Table* table)
+{
+  for (int op = 0; op < NUM_OPCODES; ++op) {
+    table->cycles[op] = 1;
+    table->pipelined[op] = 1;
+  }
+}
+
+static int
+find_opcode(const char* name)
+{
+  for (int op = OP_NONE + 1; op < NUM_OPCODES; ++op) {
+    if (op != OP_FLUSH && strcmp(APEX_opcode_info[op].name, name) == 0) {
+      return op;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Reads filename into table, starting from the defaults. Reports the
+ * first bad line to err and returns -1, leaving table unchanged.
+ */
+int
+APEX_latency_load(const char* filename, APEX_Latency_Table* table, FILE* err)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(err, "APEX_Error : Unable to open latency table %s\n", filename);
+    return -1;
+  }
+
+  APEX_Latency_Table parsed;
+  APEX_latency_defaults(&parsed);
+
+  char line[256];
+  int line_num = 0;
+  int ret = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    line_num++;
+    line[strcspn(line, "#\r\n")] = '\0';
+
+    char name[32];
+    char kind[32];
+    char extra[2];
+    int cycles;
+    int fields = sscanf(line, "%31s %d %31s %1s", name, &cycles, kind,
+                        extra);
+    if (fields == EOF) {
+      continue;
+    }
+    int op = fields >= 1 ? find_opcode(name) : -1;
+    if (fields < 2 || fields > 3 || op < 0 || cycles < 1 ||
+        cycles > APEX_LATENCY_MAX ||
+        (fields == 3 && strcmp(kind, "pipelined") != 0 &&
+         strcmp(kind, "unpipelined") != 0)) {
+      fprintf(err, "APEX_Error : %s:%d: expected <opcode> <1-%d> "
+              "[pipelined|unpipelined]\n", filename, line_num,
+              APEX_LATENCY_MAX);
+      ret = -1;
+      break;
+    }
+    parsed.cycles[op] = cycles;
+    parsed.pipelined[op] = fields < 3 || strcmp(kind, "pipelined") == 0;
+  }
+
+  fclose(fp);
+  if (ret == 0) {
+    *table = parsed;
+  }
+  return ret;
+}
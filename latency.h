@@ -0,0 +1,32 @@
+#ifndef _APEX_LATENCY_H_
+#define _APEX_LATENCY_H_
+/**
+ *  latency.h
+ *  Functional unit timing of the pipeline : how many cycles each opcode
+ *  spends executing from EX1 on, or for a LOAD, LDR, STORE and STR how
+ *  many it spends in MEM1 without a data cache, and whether its unit is
+ *  pipelined. Every opcode has a unit of its own.
+ */
+#include <stdio.h>
+
+#include "cpu.h"
+
+enum
+{
+  APEX_LATENCY_MAX = 64     // Cycles, the most an opcode may take
+};
+
+typedef struct APEX_Latency_Table
+{
+  int cycles[NUM_OPCODES];              // 1 .. APEX_LATENCY_MAX
+  unsigned char pipelined[NUM_OPCODES]; // Starts one a cycle, else one
+                                        // at a time
+} APEX_Latency_Table;
+
+void
+APEX_latency_defaults(APEX_Latency_Table* table);
+
+int
+APEX_latency_load(const char* filename, APEX_Latency_Table* table, FILE* err);
+
+#endif
@@ -0,0 +1,14 @@
+MOVC,R1,#100000
+MOVC,R2,#1
+MOVC,R7,#0
+MOVC,R3,#64
+MOVC,R4,#0
+STORE,R3,R4,#0
+LOAD,R5,R4,#0
+ADD,R7,R7,R5
+ADDL,R4,R4,#1
+SUB,R3,R3,R2
+BNZ,#-20
+SUB,R1,R1,R2
+BNZ,#-36
+HALT
@@ -7,16 +7,216 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "cpu.h"
+#include "apex.h"
 
 // ./apex_sim input_g.asm display 20
+// ./apex_sim input_g.asm simulate 5000
+// ./apex_sim input_g.asm simulate 0 --until-pc 4020
+// ./apex_sim input_g.asm simulate 100000 none --checkpoint ckpt.bin
+// ./apex_sim input_g.asm display 100020 --restore ckpt.bin
+// ./apex_sim input_g.asm assemble input_g.apexbin
+// ./apex_sim input_g.apexbin simulate 0 --verify-image
+// ./apex_sim input_g.asm functional 0
+// ./apex_sim input_g.asm threaded 0
+// ./apex_sim input_g.asm jit 0
+// ./apex_sim input_g.asm bench 0
+// ./apex_sim input_g.asm simulate 0 cycle trace.bin
+// ./apex_sim input_g.asm simulate 0 --counters counters.json
+// ./apex_sim input_g.asm multicore 0 --cores 4 --mem-latency 8 --mem-ports 1
+// ./apex_sim input_g.asm simulate 0 --l1 1024:2:16:1 --l2 8192:8:64:6:wb
+// ./apex_sim input_g.asm simulate 0 --l1i 256:1:16:1 --fetch-width 4
+// ./apex_sim input_g.asm simulate 0 --bpred gshare:12:8 --btb 256
+// ./apex_sim input_g.asm simulate 0 --latencies units.lat
+// ./apex_sim input_g.asm ooo 0 --width 2 --rob 32 --bpred tage
+// ./apex_sim input_g.asm simulate 0 --width 4 --mem 2 --bpred tage
+
+/*
+ * Entry point of the "multicore" run type : runs the program on every
+ * core of a shared-memory system and prints each core's registers and
+ * the shared memory
+ */
+static int
+run_multicore(APEX_CPU* cpu, const APEX_Multicore_Config* config,
+              const APEX_Cache_Hierarchy* caches, int fetch_width,
+              int fetch_queue, const APEX_Bpred_Config* bpred,
+              const APEX_Latency_Table* latency, const char* req_cyc)
+{
+  APEX_Multicore* mc = APEX_multicore_create(cpu->code_memory,
+                                             cpu->code_memory_size, config);
+  if (!mc) {
+    fprintf(stderr, "APEX_Error : Unable to create %d cores\n",
+            config->num_cores);
+    return 1;
+  }
+  /* Every core gets private caches in front of the shared memory, and
+   * its own branch predictor and latency table
+   */
+  for (int c = 0; c < config->num_cores; ++c) {
+    APEX_CPU* core = APEX_multicore_core(mc, c);
+    if (APEX_cpu_set_caches(core, caches, fetch_width, fetch_queue) < 0 ||
+        APEX_cpu_set_bpred(core, bpred) < 0 ||
+        APEX_cpu_set_latencies(core, latency) < 0) {
+      fprintf(stderr, "APEX_Error : Unable to create the caches of core %d\n",
+              c);
+      APEX_multicore_destroy(mc);
+      return 1;
+    }
+  }
+
+  int stop = APEX_multicore_run(mc, req_cyc ? atoi(req_cyc) : 0);
+  if (stop == CPU_STOP_DEADLOCK) {
+    fprintf(stderr, "APEX_Error : no core committed an instruction for "
+            "too long, stopping\n");
+  }
+  printf("(apex) >> Simulation %s\n",
+         stop == CPU_STOP_COMPLETE ? "Complete" :
+         stop == CPU_STOP_CYCLES ? "Stopped at cycle limit" : "Deadlocked");
+
+  if (APEX_TRACE_ON(cpu, TRACE_SUMMARY)) {
+    for (int c = 0; c < config->num_cores; ++c) {
+      const APEX_CPU* core = APEX_multicore_core(mc, c);
+      fprintf(stderr,
+        "APEX_CPU : core %d : %d cycles, %d instructions committed, "
+        "%d decode stall cycles, %d memory wait cycles\n",
+        c, core->clock, core->ins_completed, core->stall_cycles,
+        core->mem_stall_cycles);
+      if (core->dcache) {
+        APEX_cache_report(core->dcache, "", stderr, core->ins_completed);
+      }
+      if (core->icache) {
+        APEX_cache_report(core->icache, "I", stderr, core->ins_completed);
+      }
+      if (core->bpred) {
+        APEX_bpred_report(core->bpred, stderr);
+      }
+    }
+  }
+  APEX_multicore_dump(mc, stdout);
+
+  APEX_multicore_destroy(mc);
+  return stop == CPU_STOP_DEADLOCK;
+}
+
+/*
+ * Entry point of the "ooo" run type : runs the program on the in-order
+ * pipeline and then on the out-of-order core, each with its own copy of
+ * the caches and predictor, and compares the two. The final state
+ * printed is the out-of-order core's.
+ */
+static int
+run_ooo(APEX_CPU* cpu, const APEX_OoO_Config* config,
+        const APEX_Cache_Hierarchy* caches, int fetch_width,
+        int fetch_queue, const APEX_Bpred_Config* bpred,
+        const char* req_cyc)
+{
+  int cycles = req_cyc ? atoi(req_cyc) : 0;
+  APEX_CPU* inorder = APEX_cpu_create(cpu->code_memory,
+                                      cpu->code_memory_size);
+  if (!inorder ||
+      APEX_cpu_set_caches(inorder, caches, fetch_width, fetch_queue) < 0 ||
+      (bpred && APEX_cpu_set_bpred(inorder, bpred) < 0)) {
+    fprintf(stderr, "APEX_Error : Unable to create the in-order core\n");
+    if (inorder) {
+      APEX_cpu_stop(inorder);
+    }
+    return 1;
+  }
+  inorder->req_cyc = cycles;
+  APEX_cpu_simulate(inorder);
+
+  APEX_OoO* ooo = APEX_ooo_create(cpu, config);
+  if (!ooo) {
+    fprintf(stderr, "APEX_Error : Unable to create the out-of-order core\n");
+    APEX_cpu_stop(inorder);
+    return 1;
+  }
+  int stop = APEX_ooo_run(ooo, cycles);
+  printf("(apex) >> Simulation %s\n",
+         stop == CPU_STOP_COMPLETE ? "Complete" : "Stopped at cycle limit");
+
+  if (APEX_TRACE_ON(cpu, TRACE_SUMMARY)) {
+    APEX_ooo_report(ooo, stderr);
+    if (cpu->dcache) {
+      APEX_cache_report(cpu->dcache, "", stderr, cpu->ins_completed);
+    }
+    if (cpu->bpred) {
+      APEX_bpred_report(cpu->bpred, stderr);
+    }
+    fprintf(stderr,
+      "APEX_OOO : in-order pipeline %d cycles, %d instructions committed, "
+      "IPC %.2f : out-of-order IPC %.2f, %.2fx fewer cycles\n",
+      inorder->clock, inorder->ins_completed,
+      inorder->clock ? (double)inorder->ins_completed / inorder->clock : 0.0,
+      cpu->clock ? (double)cpu->ins_completed / cpu->clock : 0.0,
+      cpu->clock ? (double)inorder->clock / cpu->clock : 0.0);
+  }
+  APEX_cpu_dump(cpu);
+
+  APEX_ooo_destroy(ooo);
+  APEX_cpu_stop(inorder);
+  return 0;
+}
+
+/*
+ * Entry point of "simulate" with --width above 1 : runs the program on
+ * the W-wide in-order pipeline and prints its summary and final state
+ */
+static int
+run_superscalar(APEX_CPU* cpu, const APEX_Superscalar_Config* config,
+                const char* req_cyc)
+{
+  APEX_Superscalar* ss = APEX_superscalar_create(cpu, config);
+  if (!ss) {
+    fprintf(stderr, "APEX_Error : Unable to create the superscalar "
+            "pipeline\n");
+    return 1;
+  }
+  int stop = APEX_superscalar_run(ss, req_cyc ? atoi(req_cyc) : 0);
+  printf("(apex) >> Simulation %s\n",
+         stop == CPU_STOP_COMPLETE ? "Complete" : "Stopped at cycle limit");
+
+  if (APEX_TRACE_ON(cpu, TRACE_SUMMARY)) {
+    APEX_superscalar_report(ss, stderr);
+    if (cpu->dcache) {
+      APEX_cache_report(cpu->dcache, "", stderr, cpu->ins_completed);
+    }
+    if (cpu->bpred) {
+      APEX_bpred_report(cpu->bpred, stderr);
+    }
+  }
+  APEX_cpu_dump(cpu);
+
+  APEX_superscalar_destroy(ss);
+  return 0;
+}
 
 int
 main(int argc, char const* argv[])
 {
-  if (argc < 2) {
-    fprintf(stderr, "APEX_Help : Usage %s <input_file>\n", argv[0]);
+  if (argc < 4) {
+    fprintf(stderr,
+      "APEX_Help : Usage %s <input_file> "
+      "<display|simulate|functional|threaded|jit|bench|assemble|multicore|"
+      "ooo> "
+      "<count|output_file> "
+      "[none|summary|cycle|stage] [binary_trace_file] "
+      "[--until-pc <pc>] [--until-retired <n>] "
+      "[--restore <file>] [--checkpoint <file>] [--verify-image] "
+      "[--counters <file>] "
+      "[--cores <n>] [--mem-latency <cycles>] [--mem-ports <n>] "
+      "[--threads <n>] [--l1 <cache>] [--l2 <cache>] "
+      "[--dram-latency <cycles>] [--l1i <cache>] [--fetch-width <n>] "
+      "[--fetch-queue <n>] [--bpred <predictor>] [--btb <entries>] "
+      "[--latencies <file>] "
+      "[--width <n>] [--rob <n>] [--iq <n>] [--lsq <n>] [--prf <n>] "
+      "[--alu <n>] [--mul <n>] [--mem <n>] [--branch <n>]\n"
+      "APEX_Help : <cache> is size:assoc:line:latency[:lru|fifo|random]"
+      "[:wb|wt][:wa|nwa], sizes in bytes\n"
+      "APEX_Help : <predictor> is nottaken|bimodal|gshare|tage"
+      "[:table_bits[:history_bits]]\n",
+      argv[0]);
     exit(1);
   }
 
@@ -30,11 +230,344 @@ main(int argc, char const* argv[])
   const char *req_cyc;
   type=argv[2];req_cyc=argv[3];
 
+  /* Options may appear anywhere after the count, the trace level and
+   * trace file keep their order
+   */
+  const char* trace_level = NULL;
+  const char* trace_file = NULL;
+  const char* restore_file = NULL;
+  const char* checkpoint_file = NULL;
+  const char* counters_file = NULL;
+  int verify_image = 0;
+  APEX_Multicore_Config multicore = { 2, 8, 1, 0 };
+  APEX_Cache_Hierarchy caches = { .memory_latency = 20 };
+  const char* cache_specs[APEX_CACHE_MAX_LEVELS] = { NULL };
+  const char* l1i_spec = NULL;
+  int fetch_width = 1;
+  int fetch_queue = 4;
+  const char* bpred_spec = NULL;
+  int btb_entries = 0;
+  const char* latency_file = NULL;
+  int width = 1;
+  APEX_OoO_Config ooo = { 1, 32, 16, 16, 64 };
+  APEX_Superscalar_Config superscalar = { 1, { -1, -1, -1, -1 } };
+  for (int i = 4; i < argc; ++i) {
+    if (strcmp(argv[i], "--until-pc") == 0 && i + 1 < argc) {
+      cpu->until_pc = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--until-retired") == 0 && i + 1 < argc) {
+      cpu->until_retired = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      restore_file = argv[++i];
+    }
+    else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpoint_file = argv[++i];
+    }
+    else if (strcmp(argv[i], "--counters") == 0 && i + 1 < argc) {
+      counters_file = argv[++i];
+    }
+    else if (strcmp(argv[i], "--verify-image") == 0) {
+      verify_image = 1;
+    }
+    else if (strcmp(argv[i], "--cores") == 0 && i + 1 < argc) {
+      multicore.num_cores = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--mem-latency") == 0 && i + 1 < argc) {
+      multicore.latency = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--mem-ports") == 0 && i + 1 < argc) {
+      multicore.ports = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      multicore.threads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--l1") == 0 && i + 1 < argc) {
+      cache_specs[0] = argv[++i];
+    }
+    else if (strcmp(argv[i], "--l2") == 0 && i + 1 < argc) {
+      cache_specs[1] = argv[++i];
+    }
+    else if (strcmp(argv[i], "--dram-latency") == 0 && i + 1 < argc) {
+      caches.memory_latency = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--l1i") == 0 && i + 1 < argc) {
+      l1i_spec = argv[++i];
+    }
+    else if (strcmp(argv[i], "--fetch-width") == 0 && i + 1 < argc) {
+      fetch_width = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--fetch-queue") == 0 && i + 1 < argc) {
+      fetch_queue = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--bpred") == 0 && i + 1 < argc) {
+      bpred_spec = argv[++i];
+    }
+    else if (strcmp(argv[i], "--btb") == 0 && i + 1 < argc) {
+      btb_entries = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--latencies") == 0 && i + 1 < argc) {
+      latency_file = argv[++i];
+    }
+    else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+      width = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--rob") == 0 && i + 1 < argc) {
+      ooo.rob_size = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--iq") == 0 && i + 1 < argc) {
+      ooo.iq_size = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--lsq") == 0 && i + 1 < argc) {
+      ooo.lsq_size = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--prf") == 0 && i + 1 < argc) {
+      ooo.phys_regs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--alu") == 0 && i + 1 < argc) {
+      superscalar.units[SS_UNIT_ALU] = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--mul") == 0 && i + 1 < argc) {
+      superscalar.units[SS_UNIT_MUL] = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--mem") == 0 && i + 1 < argc) {
+      superscalar.units[SS_UNIT_MEM] = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--branch") == 0 && i + 1 < argc) {
+      superscalar.units[SS_UNIT_BRANCH] = atoi(argv[++i]);
+    }
+    else if (strncmp(argv[i], "--", 2) == 0) {
+      fprintf(stderr, "APEX_Error : Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+    else if (!trace_level) {
+      trace_level = argv[i];
+    }
+    else if (!trace_file) {
+      trace_file = argv[i];
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Unexpected argument %s\n", argv[i]);
+      exit(1);
+    }
+  }
 
-  APEX_cpu_run(cpu,type,req_cyc);
+  /* Levels are contiguous from L1 */
+  for (int l = 0; l < APEX_CACHE_MAX_LEVELS; ++l) {
+    if (!cache_specs[l]) {
+      continue;
+    }
+    if (l > caches.levels) {
+      fprintf(stderr, "APEX_Error : --l%d needs --l%d\n", l + 1, l);
+      exit(1);
+    }
+    if (APEX_cache_parse(cache_specs[l], &caches.level[l]) < 0) {
+      fprintf(stderr, "APEX_Error : Invalid cache %s\n", cache_specs[l]);
+      exit(1);
+    }
+    caches.levels = l + 1;
+  }
+  if (l1i_spec) {
+    if (APEX_cache_parse(l1i_spec, &caches.l1i) < 0) {
+      fprintf(stderr, "APEX_Error : Invalid cache %s\n", l1i_spec);
+      exit(1);
+    }
+    caches.has_l1i = 1;
+  }
+  if (caches.memory_latency < 1) {
+    fprintf(stderr, "APEX_Error : --dram-latency must be at least 1\n");
+    exit(1);
+  }
+  if (fetch_width < 1 || fetch_queue < fetch_width) {
+    fprintf(stderr, "APEX_Error : the fetch queue must hold at least "
+            "--fetch-width >= 1 instructions\n");
+    exit(1);
+  }
+  APEX_Bpred_Config bpred;
+  if (bpred_spec && APEX_bpred_parse(bpred_spec, &bpred) < 0) {
+    fprintf(stderr, "APEX_Error : Invalid branch predictor %s\n", bpred_spec);
+    exit(1);
+  }
+  if (btb_entries) {
+    if (!bpred_spec) {
+      fprintf(stderr, "APEX_Error : --btb needs --bpred\n");
+      exit(1);
+    }
+    if (btb_entries < 0 || (btb_entries & (btb_entries - 1)) != 0) {
+      fprintf(stderr, "APEX_Error : --btb must be a power of two\n");
+      exit(1);
+    }
+    bpred.btb_entries = btb_entries;
+  }
+  ooo.width = width;
+  if (ooo.width < 1 || ooo.rob_size < 1 || ooo.iq_size < 1 ||
+      ooo.lsq_size < 1 || ooo.phys_regs < APEX_OOO_ARCH_REGS + 2) {
+    fprintf(stderr, "APEX_Error : --width, --rob, --iq and --lsq must be at "
+            "least 1 and --prf at least %d\n", APEX_OOO_ARCH_REGS + 2);
+    exit(1);
+  }
+  /* Unset unit counts default to one ALU per lane and one of the rest */
+  static const char* const unit_options[NUM_SS_UNITS] = {
+    "--alu", "--mul", "--mem", "--branch"
+  };
+  superscalar.width = width;
+  for (int u = 0; u < NUM_SS_UNITS; ++u) {
+    if (superscalar.units[u] == -1) {
+      superscalar.units[u] = u == SS_UNIT_ALU ? width : 1;
+    }
+    if (superscalar.units[u] < 1) {
+      fprintf(stderr, "APEX_Error : %s must be at least 1\n",
+              unit_options[u]);
+      exit(1);
+    }
+  }
+  int wide = width > 1 && strcmp(type, "ooo") != 0;
+  if (wide && (strcmp(type, "simulate") != 0 ||
+               width > APEX_SUPERSCALAR_MAX_WIDTH)) {
+    fprintf(stderr, "APEX_Error : --width up to %d runs simulate "
+            "superscalar, or sets the ooo width\n",
+            APEX_SUPERSCALAR_MAX_WIDTH);
+    exit(1);
+  }
+  if (wide && (restore_file || checkpoint_file || trace_file || l1i_spec ||
+               latency_file || counters_file || cpu->until_pc ||
+               cpu->until_retired)) {
+    fprintf(stderr, "APEX_Error : superscalar runs take no checkpoint, "
+            "trace file, --l1i, --latencies, --counters or --until-* "
+            "condition\n");
+    exit(1);
+  }
+  APEX_Latency_Table latency;
+  if (latency_file && APEX_latency_load(latency_file, &latency, stderr) < 0) {
+    exit(1);
+  }
+  if (strcmp(type, "multicore") != 0 &&
+      APEX_cpu_set_caches(cpu, &caches, fetch_width, fetch_queue) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to create the caches\n");
+    exit(1);
+  }
+  if (strcmp(type, "multicore") != 0 && bpred_spec &&
+      APEX_cpu_set_bpred(cpu, &bpred) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to create the branch predictor\n");
+    exit(1);
+  }
+  if (strcmp(type, "multicore") != 0 && latency_file &&
+      APEX_cpu_set_latencies(cpu, &latency) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to create the latency table\n");
+    exit(1);
+  }
+
+  /* display shows every stage, the other run types only a summary */
+  cpu->trace_level = strcmp(type, "display") == 0 ? TRACE_STAGE : TRACE_SUMMARY;
+  if (trace_level) {
+    cpu->trace_level = APEX_trace_parse_level(trace_level);
+    if (cpu->trace_level < 0) {
+      fprintf(stderr, "APEX_Error : Unknown trace level %s\n", trace_level);
+      exit(1);
+    }
+  }
+  if (counters_file) {
+    if (strcmp(type, "display") != 0 && strcmp(type, "simulate") != 0) {
+      fprintf(stderr, "APEX_Error : --counters needs display or simulate\n");
+      exit(1);
+    }
+    cpu->counters_out = fopen(counters_file, "w");
+    if (!cpu->counters_out) {
+      fprintf(stderr, "APEX_Error : Unable to create counters file %s\n",
+              counters_file);
+      exit(1);
+    }
+  }
+  if (trace_file) {
+    cpu->trace_sink = APEX_trace_open(trace_file);
+    if (!cpu->trace_sink) {
+      fprintf(stderr, "APEX_Error : Unable to create trace file %s\n",
+              trace_file);
+      exit(1);
+    }
+  }
+  if (verify_image && cpu->code_memory_mapped &&
+      verify_code_image(cpu->code_memory, cpu->code_memory_size) < 0) {
+    fprintf(stderr, "APEX_Error : %s: image checksum mismatch\n", argv[1]);
+    exit(1);
+  }
+  if (APEX_TRACE_ON(cpu, TRACE_SUMMARY)) {
+    APEX_cpu_print_code(cpu);
+  }
+  if (restore_file && APEX_checkpoint_restore(cpu, restore_file) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to restore checkpoint %s\n",
+            restore_file);
+    exit(1);
+  }
+
+  int ret = 0;
+  if (strcmp(type, "functional") == 0) {
+    ret = APEX_functional_simulate(cpu, FUNC_ENGINE_SWITCH, req_cyc);
+  }
+  else if (strcmp(type, "threaded") == 0) {
+    ret = APEX_functional_simulate(cpu, FUNC_ENGINE_THREADED, req_cyc);
+  }
+  else if (strcmp(type, "jit") == 0) {
+    ret = APEX_functional_simulate(cpu, FUNC_ENGINE_JIT, req_cyc);
+  }
+  else if (strcmp(type, "bench") == 0) {
+    ret = APEX_functional_bench(cpu, req_cyc);
+  }
+  else if (strcmp(type, "assemble") == 0) {
+    /* The count argument names the image to write */
+    if (write_code_image(cpu->code_memory, cpu->code_memory_size,
+                         req_cyc) < 0) {
+      fprintf(stderr, "APEX_Error : Unable to write image %s\n", req_cyc);
+      ret = 1;
+    }
+  }
+  else if (strcmp(type, "multicore") == 0) {
+    if (restore_file || checkpoint_file || trace_file) {
+      fprintf(stderr, "APEX_Error : multicore runs take no checkpoint or "
+              "trace file\n");
+      exit(1);
+    }
+    ret = run_multicore(cpu, &multicore, &caches, fetch_width, fetch_queue,
+                        bpred_spec ? &bpred : NULL,
+                        latency_file ? &latency : NULL, req_cyc);
+  }
+  else if (strcmp(type, "ooo") == 0) {
+    if (restore_file || checkpoint_file || trace_file || latency_file) {
+      fprintf(stderr, "APEX_Error : ooo runs take no checkpoint, trace or "
+              "latency file\n");
+      exit(1);
+    }
+    ret = run_ooo(cpu, &ooo, &caches, fetch_width, fetch_queue,
+                  bpred_spec ? &bpred : NULL, req_cyc);
+  }
+  else if (wide) {
+    ret = run_superscalar(cpu, &superscalar, req_cyc);
+  }
+  else if (strcmp(type, "display") == 0 || strcmp(type, "simulate") == 0) {
+    APEX_cpu_run(cpu,type,req_cyc);
+  }
+  else {
+    fprintf(stderr, "APEX_Error : Unknown run type %s\n", type);
+    ret = 1;
+  }
+  if (checkpoint_file && APEX_checkpoint_save(cpu, checkpoint_file) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to write checkpoint %s\n",
+            checkpoint_file);
+    ret = 1;
+  }
+  if (APEX_trace_close(cpu->trace_sink) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to write trace file %s\n",
+            trace_file);
+    ret = 1;
+  }
+  if (cpu->counters_out && fclose(cpu->counters_out) != 0) {
+    fprintf(stderr, "APEX_Error : Unable to write counters file %s\n",
+            counters_file);
+    ret = 1;
+  }
   APEX_cpu_stop(cpu);
-  return 0;
+  return ret;
 }
 
 
-//references in readme.txt
\ No newline at end of file
+//references in readme.txt
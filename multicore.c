@@ -0,0 +1,460 @@
+/*
+ *  multicore.c
+ *  Multi-core APEX : N pipelines over one shared data memory.
+ *
+ *  Memory model. A store issued by a core in cycle t is seen by that
+ *  core from cycle t on and by every other core from cycle t + latency.
+ *  Stores are ordered by cycle, then core number. Shared memory has
+ *  ports access slots per cycle, handed out round robin (time-division)
+ *  : core c may access memory in cycle t when it holds one of the slots
+ *  of t, otherwise MEM1 holds the access until it does.
+ *
+ *  Both rules depend only on a core's own clock, so cores interact only
+ *  through stores that are at least latency cycles old. Time is cut into
+ *  windows of latency cycles and the cores of a window run in parallel,
+ *  with one barrier per window. latency 1 is lock-step, a barrier per
+ *  cycle. The outcome does not depend on the number of host threads.
+ *
+ *  Stores of a window are logged per core. During window k a load reads
+ *  shared memory, which holds every store up to window k - 2, then the
+ *  visible stores in the window k - 1 logs and its own core's window k
+ *  log. The last thread to reach the barrier of window k writes the
+ *  window k - 1 logs into shared memory and clears them for window k + 1.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "multicore.h"
+#include "trace.h"
+
+/* A run without a cycle limit is declared deadlocked once no core has
+ * committed an instruction for this many cycles
+ */
+#define MULTICORE_IDLE_CYCLES (1 << 16)
+
+typedef struct Multicore_Store
+{
+  int clock;
+  int address;
+  int value;
+} Multicore_Store;
+
+typedef struct Multicore_Log
+{
+  Multicore_Store* stores;    // In issue order, so by clock
+  int count;
+  int capacity;
+} Multicore_Log;
+
+/* pthread_barrier_t is optional in POSIX. This one also lets the last
+ * thread to arrive run the end of the window before releasing the rest.
+ */
+typedef struct Multicore_Barrier
+{
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  int parties;
+  int waiting;
+  unsigned generation;
+} Multicore_Barrier;
+
+struct APEX_Multicore
+{
+  APEX_Multicore_Config config;
+  APEX_CPU** cores;
+  int* stops;                 // CPU_STOP_* of each core, -1 while it runs
+
+  Multicore_Log* logs;        // See core_log()
+  int* merge_pos;             // Scratch for apply_logs()
+
+  int window;                 // Window being simulated
+  int req_cyc;                // Cycle limit of the run, 0 for none
+  atomic_int next_core;       // Next core of the window to hand out
+  int done;
+  int deadlocked;
+  long long committed;        // Instructions committed at last_progress
+  int last_progress;          // Clock at which an instruction last committed
+
+  Multicore_Barrier barrier;
+
+  int data_memory[DATA_MEMORY_SIZE];
+};
+
+static int
+barrier_wait(Multicore_Barrier* b, void (*last)(APEX_Multicore*),
+             APEX_Multicore* mc)
+{
+  pthread_mutex_lock(&b->lock);
+  unsigned generation = b->generation;
+  if (++b->waiting == b->parties) {
+    last(mc);
+    b->waiting = 0;
+    b->generation++;
+    pthread_cond_broadcast(&b->released);
+    pthread_mutex_unlock(&b->lock);
+    return 1;
+  }
+  while (generation == b->generation) {
+    pthread_cond_wait(&b->released, &b->lock);
+  }
+  pthread_mutex_unlock(&b->lock);
+  return 0;
+}
+
+/* Store log of core in window, two windows' worth are kept */
+static Multicore_Log*
+core_log(APEX_Multicore* mc, int window, int core)
+{
+  return &mc->logs[(window & 1) * mc->config.num_cores + core];
+}
+
+/*
+ * Creates config->num_cores cores running code, which they borrow, at
+ * reset with shared memory cleared. Core c starts with c in R15.
+ */
+APEX_Multicore*
+APEX_multicore_create(APEX_Instruction* code, int size,
+                      const APEX_Multicore_Config* config)
+{
+  if (config->num_cores < 1 || config->latency < 1) {
+    return NULL;
+  }
+
+  APEX_Multicore* mc = calloc(1, sizeof(*mc));
+  if (!mc) {
+    return NULL;
+  }
+  mc->config = *config;
+  pthread_mutex_init(&mc->barrier.lock, NULL);
+  pthread_cond_init(&mc->barrier.released, NULL);
+  int n = config->num_cores;
+  if (mc->config.threads <= 0) {
+    mc->config.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (mc->config.threads < 1 || mc->config.threads > n) {
+    mc->config.threads = n;
+  }
+
+  mc->cores = calloc(n, sizeof(*mc->cores));
+  mc->stops = calloc(n, sizeof(*mc->stops));
+  mc->logs = calloc(2 * n, sizeof(*mc->logs));
+  mc->merge_pos = calloc(n, sizeof(*mc->merge_pos));
+  if (!mc->cores || !mc->stops || !mc->logs || !mc->merge_pos) {
+    APEX_multicore_destroy(mc);
+    return NULL;
+  }
+
+  for (int c = 0; c < n; ++c) {
+    APEX_CPU* cpu = APEX_cpu_create(code, size);
+    if (!cpu) {
+      APEX_multicore_destroy(mc);
+      return NULL;
+    }
+    cpu->multicore = mc;
+    cpu->core_id = c;
+    cpu->regs[15] = c;
+    cpu->trace_level = TRACE_NONE;
+    mc->cores[c] = cpu;
+  }
+  return mc;
+}
+
+void
+APEX_multicore_destroy(APEX_Multicore* mc)
+{
+  if (!mc) {
+    return;
+  }
+  if (mc->cores) {
+    for (int c = 0; c < mc->config.num_cores; ++c) {
+      if (mc->cores[c]) {
+        APEX_cpu_stop(mc->cores[c]);
+      }
+    }
+  }
+  if (mc->logs) {
+    for (int i = 0; i < 2 * mc->config.num_cores; ++i) {
+      free(mc->logs[i].stores);
+    }
+  }
+  free(mc->merge_pos);
+  free(mc->logs);
+  free(mc->stops);
+  free(mc->cores);
+  pthread_cond_destroy(&mc->barrier.released);
+  pthread_mutex_destroy(&mc->barrier.lock);
+  free(mc);
+}
+
+APEX_CPU*
+APEX_multicore_core(APEX_Multicore* mc, int core)
+{
+  return mc->cores[core];
+}
+
+const int*
+APEX_multicore_memory(const APEX_Multicore* mc)
+{
+  return mc->data_memory;
+}
+
+/*
+ * Cycles core has to wait from clock for one of the memory slots
+ */
+int
+APEX_multicore_delay(APEX_Multicore* mc, int core, int clock)
+{
+  int n = mc->config.num_cores;
+  int ports = mc->config.ports;
+
+  if (ports <= 0 || ports >= n) {
+    return 0;
+  }
+  for (int d = 0; d < n; ++d) {
+    int first = (int)(((long long)clock + d) * ports % n);
+    if ((core - first + n) % n < ports) {
+      return d;
+    }
+  }
+  return 0;
+}
+
+/* Latest store to address in log issued no later than visible */
+static const Multicore_Store*
+find_store(const Multicore_Log* log, int address, int visible)
+{
+  for (int i = log->count - 1; i >= 0; --i) {
+    const Multicore_Store* st = &log->stores[i];
+    if (st->address == address && st->clock <= visible) {
+      return st;
+    }
+  }
+  return NULL;
+}
+
+int
+APEX_multicore_load(APEX_Multicore* mc, int core, int clock, int address)
+{
+  if ((unsigned)address >= DATA_MEMORY_SIZE) {
+    return 0;
+  }
+
+  int value = mc->data_memory[address];
+  int best_clock = -1;
+
+  /* Cores in order, so on a tie the later core wins as in apply_logs() */
+  for (int c = 0; c < mc->config.num_cores; ++c) {
+    const Multicore_Store* st;
+    if (c == core) {
+      st = find_store(core_log(mc, mc->window, c), address, clock);
+      if (!st) {
+        st = find_store(core_log(mc, mc->window - 1, c), address, clock);
+      }
+    }
+    else {
+      st = find_store(core_log(mc, mc->window - 1, c), address,
+                      clock - mc->config.latency);
+    }
+    if (st && st->clock >= best_clock) {
+      best_clock = st->clock;
+      value = st->value;
+    }
+  }
+  return value;
+}
+
+void
+APEX_multicore_store(APEX_Multicore* mc, int core, int clock, int address,
+                     int value)
+{
+  Multicore_Log* log = core_log(mc, mc->window, core);
+
+  if ((unsigned)address >= DATA_MEMORY_SIZE) {
+    return;
+  }
+  if (log->count == log->capacity) {
+    int capacity = log->capacity ? log->capacity * 2 : 64;
+    Multicore_Store* grown =
+      realloc(log->stores, sizeof(*grown) * capacity);
+    if (!grown) {
+      return;
+    }
+    log->stores = grown;
+    log->capacity = capacity;
+  }
+  log->stores[log->count++] = (Multicore_Store){ clock, address, value };
+}
+
+/* Writes the logs of window into shared memory in (clock, core) order
+ * and clears them
+ */
+static void
+apply_logs(APEX_Multicore* mc, int window)
+{
+  int n = mc->config.num_cores;
+
+  if (window < 0) {
+    return;
+  }
+  memset(mc->merge_pos, 0, sizeof(*mc->merge_pos) * n);
+  for (;;) {
+    int next = -1;
+    for (int c = 0; c < n; ++c) {
+      const Multicore_Log* log = core_log(mc, window, c);
+      if (mc->merge_pos[c] < log->count &&
+          (next < 0 || log->stores[mc->merge_pos[c]].clock <
+                       core_log(mc, window, next)->
+                         stores[mc->merge_pos[next]].clock)) {
+        next = c;
+      }
+    }
+    if (next < 0) {
+      break;
+    }
+    const Multicore_Store* st =
+      &core_log(mc, window, next)->stores[mc->merge_pos[next]++];
+    mc->data_memory[st->address] = st->value;
+  }
+  for (int c = 0; c < n; ++c) {
+    core_log(mc, window, c)->count = 0;
+  }
+}
+
+/* Run by the last thread to finish a window, with the others waiting */
+static void
+end_window(APEX_Multicore* mc)
+{
+  apply_logs(mc, mc->window - 1);
+  mc->window++;
+  atomic_store(&mc->next_core, 0);
+
+  long long committed = 0;
+  int running = 0;
+  for (int c = 0; c < mc->config.num_cores; ++c) {
+    committed += mc->cores[c]->ins_completed;
+    running += mc->stops[c] < 0;
+  }
+
+  int clock = mc->window * mc->config.latency;
+  if (committed != mc->committed) {
+    mc->committed = committed;
+    mc->last_progress = clock;
+  }
+  else if (mc->req_cyc <= 0 &&
+           clock - mc->last_progress >= MULTICORE_IDLE_CYCLES) {
+    mc->deadlocked = 1;
+  }
+  mc->done = !running || mc->deadlocked;
+}
+
+/* Simulates this window on the cores the thread can claim */
+static void
+run_window(APEX_Multicore* mc)
+{
+  int end = (mc->window + 1) * mc->config.latency;
+  if (mc->req_cyc > 0 && end > mc->req_cyc) {
+    end = mc->req_cyc;
+  }
+
+  int c;
+  while ((c = atomic_fetch_add(&mc->next_core, 1)) < mc->config.num_cores) {
+    if (mc->stops[c] >= 0) {
+      continue;
+    }
+    APEX_CPU* cpu = mc->cores[c];
+    cpu->req_cyc = end;
+    int stop = APEX_cpu_simulate(cpu);
+    if (stop != CPU_STOP_CYCLES ||
+        (mc->req_cyc > 0 && cpu->clock >= mc->req_cyc)) {
+      mc->stops[c] = stop;
+    }
+  }
+}
+
+static void*
+worker_main(void* arg)
+{
+  APEX_Multicore* mc = arg;
+
+  do {
+    run_window(mc);
+    barrier_wait(&mc->barrier, end_window, mc);
+  } while (!mc->done);
+  return NULL;
+}
+
+/*
+ * Runs every core until it completes or reaches req_cyc (0 for no
+ * limit). Returns CPU_STOP_DEADLOCK when no core made progress,
+ * CPU_STOP_CYCLES when some core hit the limit, else CPU_STOP_COMPLETE.
+ */
+int
+APEX_multicore_run(APEX_Multicore* mc, int req_cyc)
+{
+  int n = mc->config.num_cores;
+  pthread_t* threads = calloc(mc->config.threads, sizeof(*threads));
+  if (!threads) {
+    return -1;
+  }
+
+  for (int c = 0; c < n; ++c) {
+    mc->stops[c] = -1;
+  }
+  mc->req_cyc = req_cyc;
+  mc->done = 0;
+  mc->deadlocked = 0;
+
+  /* Cores are claimed window by window, so a thread that fails to
+   * start only costs parallelism. Holding the lock keeps the workers
+   * out of the barrier until the party count is known.
+   */
+  int started = 1;
+  pthread_mutex_lock(&mc->barrier.lock);
+  for (int t = 1; t < mc->config.threads; ++t) {
+    if (pthread_create(&threads[started], NULL, worker_main, mc) == 0) {
+      started++;
+    }
+  }
+  mc->barrier.parties = started;
+  pthread_mutex_unlock(&mc->barrier.lock);
+
+  worker_main(mc);
+  for (int t = 1; t < started; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+
+  /* Only the last window's stores are still in the logs */
+  apply_logs(mc, mc->window - 1);
+
+  if (mc->deadlocked) {
+    return CPU_STOP_DEADLOCK;
+  }
+  for (int c = 0; c < n; ++c) {
+    if (mc->stops[c] == CPU_STOP_CYCLES) {
+      return CPU_STOP_CYCLES;
+    }
+  }
+  return CPU_STOP_COMPLETE;
+}
+
+/*
+ * Prints the registers of every core, then shared data memory
+ */
+void
+APEX_multicore_dump(APEX_Multicore* mc, FILE* out)
+{
+  for (int c = 0; c < mc->config.num_cores; ++c) {
+    APEX_CPU* cpu = mc->cores[c];
+    fprintf(out, "\n----+++Core %d : %s, %d cycles, %d instructions+++----\n",
+            c, mc->stops[c] >= 0 ? APEX_cpu_stop_names[mc->stops[c]]
+                                 : "running",
+            cpu->clock, cpu->ins_completed);
+    cpu->out = out;
+    APEX_cpu_print_registers(cpu);
+  }
+  APEX_print_data_memory(out, mc->data_memory);
+}
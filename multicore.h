@@ -0,0 +1,52 @@
+#ifndef _APEX_MULTICORE_H_
+#define _APEX_MULTICORE_H_
+/**
+ *  multicore.h
+ *  Several APEX pipelines, each with its own registers and pc, over one
+ *  shared data memory, simulated on a pool of host threads
+ */
+#include "cpu.h"
+
+typedef struct APEX_Multicore APEX_Multicore;
+
+/* Shared memory settings */
+typedef struct APEX_Multicore_Config
+{
+  int num_cores;
+  int latency;    // Cycles before a store is seen by the other cores, >= 1
+  int ports;      // Accesses served per cycle, 0 for no contention
+  int threads;    // Host threads, 0 for one per host CPU
+} APEX_Multicore_Config;
+
+APEX_Multicore*
+APEX_multicore_create(APEX_Instruction* code, int size,
+                      const APEX_Multicore_Config* config);
+
+void
+APEX_multicore_destroy(APEX_Multicore* mc);
+
+int
+APEX_multicore_run(APEX_Multicore* mc, int req_cyc);
+
+APEX_CPU*
+APEX_multicore_core(APEX_Multicore* mc, int core);
+
+const int*
+APEX_multicore_memory(const APEX_Multicore* mc);
+
+void
+APEX_multicore_dump(APEX_Multicore* mc, FILE* out);
+
+/* Called by memory1 of a core */
+
+int
+APEX_multicore_delay(APEX_Multicore* mc, int core, int clock);
+
+int
+APEX_multicore_load(APEX_Multicore* mc, int core, int clock, int address);
+
+void
+APEX_multicore_store(APEX_Multicore* mc, int core, int clock, int address,
+                     int value);
+
+#endif
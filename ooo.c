@@ -0,0 +1,749 @@
+/*
+ *  ooo.c
+ *  Out-of-order APEX core. Each cycle runs, from the back of the machine
+ *  to the front :
+ *    commit    retires up to width finished instructions from the head
+ *              of the ROB in program order, writing stores to memory
+ *    complete  finishes the instructions whose latency has elapsed,
+ *              which makes their physical destinations ready
+ *    issue     starts up to width instructions of the issue queue whose
+ *              sources are ready, oldest first
+ *    dispatch  renames up to width fetched instructions into the ROB,
+ *              the issue queue and, for loads and stores, the LSQ
+ *    fetch     reads up to width instructions, following the branch
+ *              predictor of the CPU when it has one
+ *
+ *  Results are computed at issue with the semantics of functional.c, so
+ *  the committed state is the one the functional engines reach. Control
+ *  instructions resolve at commit : a mispredicted one squashes every
+ *  younger instruction and fetch restarts from the committed rename map.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+#include "cache.h"
+#include "ooo.h"
+
+/* Renamed register of the zero flag */
+#define OOO_ZERO_FLAG 16
+
+/* Cycles from issue until a result can be used : ALU operations, and
+ * loads, which compute their address and then spend MEM1 and MEM2 on
+ * the access
+ */
+enum
+{
+  OOO_ALU_LATENCY = 1,
+  OOO_LOAD_LATENCY = 3
+};
+
+typedef struct OoO_Fetched
+{
+  APEX_Instruction ins;
+  int pc;
+  int predicted_pc;     // pc fetched after it
+  int end;              // pc is outside code memory
+} OoO_Fetched;
+
+/* ROB entry */
+typedef struct OoO_Entry
+{
+  APEX_Instruction ins;
+  int pc;
+  int predicted_pc;
+  int next_pc;          // pc that really follows, once done
+  int src[3];           // Physical sources, -1 for none
+  int dest;             // Physical rd, -1 for none
+  int prev_dest;        // Previous mapping of rd, freed at commit
+  int flag;             // Physical zero flag, -1 for none
+  int prev_flag;
+  int result;
+  int zero;
+  int address;          // Data memory address of a load or store
+  int store_value;
+  int done_cycle;       // Cycle its result is ready, once issued
+  unsigned int issued : 1;
+  unsigned int done : 1;
+  unsigned int fault : 1;   // Data memory address out of range
+  unsigned int end : 1;
+} OoO_Entry;
+
+struct APEX_OoO
+{
+  APEX_OoO_Config config;
+  APEX_CPU* cpu;
+
+  /* Physical register file, its free list (a stack) and the rename
+   * maps : map for dispatch, committed_map as of the last commit
+   */
+  int* values;
+  uint8_t* ready;
+  int* free_regs;
+  int free_count;
+  int map[APEX_OOO_ARCH_REGS];
+  int committed_map[APEX_OOO_ARCH_REGS];
+
+  /* ROB, a ring in program order */
+  OoO_Entry* rob;
+  int rob_head;
+  int rob_count;
+
+  /* Issue queue : ROB slots waiting for their sources, oldest first */
+  int* iq;
+  int iq_count;
+
+  /* LSQ : ROB slots of loads and stores, a ring in program order */
+  int* lsq;
+  int lsq_head;
+  int lsq_count;
+
+  /* Fetch queue between fetch and dispatch */
+  OoO_Fetched* fetched;
+  int fetch_size;
+  int fetch_head;
+  int fetch_count;
+  int fetch_pc;
+  int fetch_stopped;    // Fetched a HALT or ran out of code memory
+
+  int finished;         // Committed a HALT, a fault or the end of code
+
+  /* Statistics */
+  long long committed;
+  long long mispredicts;
+  long long squashed;
+  long long forwarded;      // Loads served by an older store
+  long long rob_full;       // Dispatch stall cycles by the missing resource
+  long long iq_full;
+  long long lsq_full;
+  long long regs_full;
+};
+
+/* pc of the code memory slot pc falls in, as the functional engines
+ * round it
+ */
+static int
+code_pc(int pc)
+{
+  return 4000 + 4 * get_code_index(pc);
+}
+
+static int
+is_control(int opcode)
+{
+  return opcode == OP_JUMP || opcode == OP_BZ || opcode == OP_BNZ;
+}
+
+static int
+is_load(int opcode)
+{
+  return opcode == OP_LOAD || opcode == OP_LDR;
+}
+
+static int
+is_store(int opcode)
+{
+  return opcode == OP_STORE || opcode == OP_STR;
+}
+
+static int
+writes_rd(int opcode)
+{
+  return opcode == OP_MOVC || opcode == OP_LOAD || opcode == OP_LDR ||
+         opcode == OP_ADD || opcode == OP_ADDL || opcode == OP_SUB ||
+         opcode == OP_AND || opcode == OP_OR || opcode == OP_XOR ||
+         opcode == OP_MUL;
+}
+
+static int
+writes_flag(int opcode)
+{
+  return opcode == OP_ADD || opcode == OP_ADDL || opcode == OP_SUB ||
+         opcode == OP_MUL;
+}
+
+/* Architectural sources of ins in the order ooo_execute() reads them.
+ * Returns how many.
+ */
+static int
+arch_sources(const APEX_Instruction* ins, int* regs)
+{
+  switch (ins->opcode) {
+    case OP_STORE:
+    case OP_LDR:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_MUL:
+      regs[0] = ins->rs1;
+      regs[1] = ins->rs2;
+      return 2;
+
+    case OP_STR:
+      regs[0] = ins->rs1;
+      regs[1] = ins->rs2;
+      regs[2] = ins->rd;
+      return 3;
+
+    case OP_LOAD:
+    case OP_ADDL:
+    case OP_JUMP:
+      regs[0] = ins->rs1;
+      return 1;
+
+    case OP_BZ:
+    case OP_BNZ:
+      regs[0] = OOO_ZERO_FLAG;
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Creates an out-of-order core for the program and architectural state
+ * of cpu : its registers, zero flag, pc and data memory, which the run
+ * updates. Returns NULL on an invalid config or allocation failure.
+ */
+APEX_OoO*
+APEX_ooo_create(APEX_CPU* cpu, const APEX_OoO_Config* config)
+{
+  if (config->width < 1 || config->rob_size < 1 || config->iq_size < 1 ||
+      config->lsq_size < 1 || config->phys_regs < APEX_OOO_ARCH_REGS + 2) {
+    return NULL;
+  }
+
+  APEX_OoO* ooo = calloc(1, sizeof(*ooo));
+  if (!ooo) {
+    return NULL;
+  }
+  ooo->config = *config;
+  ooo->cpu = cpu;
+  ooo->fetch_size = 2 * config->width;
+  /* Branches are predicted at fetch and resolved as they commit */
+  if (cpu->bpred && APEX_bpred_reserve(cpu->bpred, ooo->fetch_size +
+                                       config->rob_size) < 0) {
+    free(ooo);
+    return NULL;
+  }
+  ooo->values = calloc(config->phys_regs, sizeof(*ooo->values));
+  ooo->ready = calloc(config->phys_regs, sizeof(*ooo->ready));
+  ooo->free_regs = calloc(config->phys_regs, sizeof(*ooo->free_regs));
+  ooo->rob = calloc(config->rob_size, sizeof(*ooo->rob));
+  ooo->iq = calloc(config->iq_size, sizeof(*ooo->iq));
+  ooo->lsq = calloc(config->lsq_size, sizeof(*ooo->lsq));
+  ooo->fetched = calloc(ooo->fetch_size, sizeof(*ooo->fetched));
+  if (!ooo->values || !ooo->ready || !ooo->free_regs || !ooo->rob ||
+      !ooo->iq || !ooo->lsq || !ooo->fetched) {
+    APEX_ooo_destroy(ooo);
+    return NULL;
+  }
+
+  /* Physical registers 0 - 16 start as the architectural state */
+  for (int r = 0; r < APEX_OOO_ARCH_REGS; ++r) {
+    ooo->values[r] = r == OOO_ZERO_FLAG ? cpu->zero : cpu->regs[r];
+    ooo->ready[r] = 1;
+    ooo->map[r] = ooo->committed_map[r] = r;
+  }
+  for (int p = config->phys_regs - 1; p >= APEX_OOO_ARCH_REGS; --p) {
+    ooo->free_regs[ooo->free_count++] = p;
+  }
+  ooo->fetch_pc = cpu->pc;
+  return ooo;
+}
+
+void
+APEX_ooo_destroy(APEX_OoO* ooo)
+{
+  if (!ooo) {
+    return;
+  }
+  free(ooo->values);
+  free(ooo->ready);
+  free(ooo->free_regs);
+  free(ooo->rob);
+  free(ooo->iq);
+  free(ooo->lsq);
+  free(ooo->fetched);
+  free(ooo);
+}
+
+/*
+ * Fetch : up to width instructions a cycle into the fetch queue. A
+ * control instruction predicted taken ends the group, and fetch stops
+ * after a HALT or the end of code memory until a misprediction
+ * redirects it.
+ */
+static void
+ooo_fetch(APEX_OoO* ooo)
+{
+  APEX_CPU* cpu = ooo->cpu;
+
+  for (int n = 0; n < ooo->config.width; ++n) {
+    if (ooo->fetch_stopped || ooo->fetch_count == ooo->fetch_size) {
+      return;
+    }
+    int slot = (ooo->fetch_head + ooo->fetch_count) % ooo->fetch_size;
+    OoO_Fetched* f = &ooo->fetched[slot];
+    int index = get_code_index(ooo->fetch_pc);
+    ooo->fetch_count++;
+
+    memset(f, 0, sizeof(*f));
+    f->pc = ooo->fetch_pc;
+    if (index < 0 || index >= cpu->code_memory_size) {
+      f->end = 1;
+      f->predicted_pc = f->pc;
+      ooo->fetch_stopped = 1;
+      return;
+    }
+    f->ins = cpu->code_memory[index];
+    f->predicted_pc = f->pc + 4;
+    if (cpu->bpred && is_control(f->ins.opcode)) {
+      if (APEX_bpred_full(cpu->bpred)) {
+        ooo->fetch_count--;
+        return;
+      }
+      f->predicted_pc = APEX_bpred_predict(cpu->bpred, f->pc,
+                                           f->ins.opcode != OP_JUMP);
+    }
+    ooo->fetch_pc = f->predicted_pc;
+    if (f->ins.opcode == OP_HALT) {
+      ooo->fetch_stopped = 1;
+    }
+    if (f->predicted_pc != f->pc + 4) {
+      return;
+    }
+  }
+}
+
+/* Maps arch to a free physical register, returning it */
+static int
+rename_dest(APEX_OoO* ooo, int arch, int* prev)
+{
+  int phys = ooo->free_regs[--ooo->free_count];
+  *prev = ooo->map[arch];
+  ooo->map[arch] = phys;
+  ooo->ready[phys] = 0;
+  return phys;
+}
+
+/*
+ * Dispatch : renames fetched instructions in order until one lacks a
+ * ROB entry, an issue queue entry, an LSQ entry or a free physical
+ * register. HALT and the end of code memory need no execution and are
+ * done at once.
+ */
+static void
+ooo_dispatch(APEX_OoO* ooo)
+{
+  const APEX_OoO_Config* config = &ooo->config;
+
+  for (int n = 0; n < config->width && ooo->fetch_count > 0; ++n) {
+    const OoO_Fetched* f = &ooo->fetched[ooo->fetch_head];
+    int opcode = f->ins.opcode;
+    int memory = is_load(opcode) || is_store(opcode);
+    int executes = !f->end && opcode != OP_HALT && opcode != OP_NONE;
+    int dests = writes_rd(opcode) + writes_flag(opcode);
+
+    if (ooo->rob_count == config->rob_size) {
+      ooo->rob_full++;
+      return;
+    }
+    if (executes && ooo->iq_count == config->iq_size) {
+      ooo->iq_full++;
+      return;
+    }
+    if (memory && ooo->lsq_count == config->lsq_size) {
+      ooo->lsq_full++;
+      return;
+    }
+    if (ooo->free_count < dests) {
+      ooo->regs_full++;
+      return;
+    }
+
+    int slot = (ooo->rob_head + ooo->rob_count) % config->rob_size;
+    OoO_Entry* e = &ooo->rob[slot];
+    ooo->rob_count++;
+
+    memset(e, 0, sizeof(*e));
+    e->ins = f->ins;
+    e->pc = f->pc;
+    e->predicted_pc = f->predicted_pc;
+    e->next_pc = f->pc + 4;
+    e->end = f->end;
+
+    int regs[3];
+    int count = arch_sources(&e->ins, regs);
+    for (int i = 0; i < 3; ++i) {
+      e->src[i] = i < count ? ooo->map[regs[i]] : -1;
+    }
+    e->dest = e->flag = -1;
+    if (writes_rd(opcode)) {
+      e->dest = rename_dest(ooo, e->ins.rd, &e->prev_dest);
+    }
+    if (writes_flag(opcode)) {
+      e->flag = rename_dest(ooo, OOO_ZERO_FLAG, &e->prev_flag);
+    }
+
+    if (executes) {
+      ooo->iq[ooo->iq_count++] = slot;
+    }
+    else {
+      e->done = 1;
+    }
+    if (memory) {
+      int tail = (ooo->lsq_head + ooo->lsq_count) % config->lsq_size;
+      ooo->lsq[tail] = slot;
+      ooo->lsq_count++;
+    }
+
+    ooo->fetch_head = (ooo->fetch_head + 1) % ooo->fetch_size;
+    ooo->fetch_count--;
+  }
+}
+
+static int
+sources_ready(const APEX_OoO* ooo, const OoO_Entry* e)
+{
+  for (int i = 0; i < 3; ++i) {
+    if (e->src[i] >= 0 && !ooo->ready[e->src[i]]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Memory disambiguation of the load in ROB slot. A load waits until
+ * every older store in the LSQ has its address and data, then takes
+ * the data of the youngest of them that writes its address, if any.
+ * Returns 0 while it has to wait, else 1 with *store the forwarding
+ * store or NULL to read data memory, which holds every committed store.
+ */
+static int
+older_stores_known(const APEX_OoO* ooo, int slot, const OoO_Entry** store)
+{
+  const OoO_Entry* load = &ooo->rob[slot];
+  *store = NULL;
+  for (int i = 0; i < ooo->lsq_count; ++i) {
+    int older = ooo->lsq[(ooo->lsq_head + i) % ooo->config.lsq_size];
+    if (older == slot) {
+      break;
+    }
+    const OoO_Entry* e = &ooo->rob[older];
+    if (!is_store(e->ins.opcode)) {
+      continue;
+    }
+    if (!e->issued) {
+      return 0;
+    }
+    if (!e->fault && e->address == load->address) {
+      *store = e;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Computes the result of the entry in ROB slot from its ready sources
+ * and when it will be done. Returns 0, leaving it unissued, for a load
+ * that has to wait on older stores.
+ */
+static int
+ooo_execute(APEX_OoO* ooo, int slot)
+{
+  APEX_CPU* cpu = ooo->cpu;
+  OoO_Entry* e = &ooo->rob[slot];
+  const APEX_Instruction* ins = &e->ins;
+  int a = e->src[0] >= 0 ? ooo->values[e->src[0]] : 0;
+  int b = e->src[1] >= 0 ? ooo->values[e->src[1]] : 0;
+  int latency = OOO_ALU_LATENCY;
+  unsigned int address = 0;
+
+  switch (ins->opcode) {
+    case OP_MOVC:
+      e->result = ins->imm;
+      break;
+    case OP_ADD:
+      e->result = a + b;
+      break;
+    case OP_ADDL:
+      e->result = a + ins->imm;
+      break;
+    case OP_SUB:
+      e->result = a - b;
+      break;
+    case OP_MUL:
+      e->result = a * b;
+      break;
+    case OP_AND:
+      e->result = a & b;
+      break;
+    case OP_OR:
+      e->result = a | b;
+      break;
+    case OP_XOR:
+      e->result = a ^ b;
+      break;
+    case OP_LOAD:
+    case OP_LDR:
+      address = a + (ins->opcode == OP_LOAD ? ins->imm : b);
+      break;
+    case OP_STORE:
+      address = b + ins->imm;
+      e->store_value = a;
+      break;
+    case OP_STR:
+      address = a + b;
+      e->store_value = ooo->values[e->src[2]];
+      break;
+    case OP_BZ:
+    case OP_BNZ:
+      if ((a != 0) == (ins->opcode == OP_BZ)) {
+        e->next_pc = code_pc(e->pc + ins->imm);
+      }
+      break;
+    case OP_JUMP:
+      e->next_pc = code_pc(a + ins->imm);
+      break;
+    default:
+      break;
+  }
+  e->zero = e->result == 0;
+
+  if (is_load(ins->opcode) || is_store(ins->opcode)) {
+    e->address = (int)address;
+    e->fault = address >= DATA_MEMORY_SIZE;
+  }
+  if (is_load(ins->opcode)) {
+    const OoO_Entry* store;
+    if (!older_stores_known(ooo, slot, &store)) {
+      return 0;
+    }
+    latency = OOO_LOAD_LATENCY;
+    if (store) {
+      e->result = store->store_value;
+      ooo->forwarded++;
+    }
+    else if (!e->fault) {
+      e->result = cpu->data_memory[e->address];
+      if (cpu->dcache) {
+        latency += APEX_cache_access(cpu->dcache, e->address, 0) - 1;
+      }
+    }
+  }
+
+  e->issued = 1;
+  e->done_cycle = cpu->clock + latency;
+  return 1;
+}
+
+/* Issue : up to width ready instructions, oldest first */
+static void
+ooo_issue(APEX_OoO* ooo)
+{
+  int issued = 0;
+  int i = 0;
+  while (i < ooo->iq_count && issued < ooo->config.width) {
+    int slot = ooo->iq[i];
+    if (!sources_ready(ooo, &ooo->rob[slot]) || !ooo_execute(ooo, slot)) {
+      ++i;
+      continue;
+    }
+    memmove(&ooo->iq[i], &ooo->iq[i + 1],
+            (ooo->iq_count - i - 1) * sizeof(*ooo->iq));
+    ooo->iq_count--;
+    issued++;
+  }
+}
+
+/* Complete : results whose latency has elapsed become ready */
+static void
+ooo_complete(APEX_OoO* ooo)
+{
+  for (int i = 0; i < ooo->rob_count; ++i) {
+    OoO_Entry* e = &ooo->rob[(ooo->rob_head + i) % ooo->config.rob_size];
+    if (!e->issued || e->done || e->done_cycle > ooo->cpu->clock) {
+      continue;
+    }
+    e->done = 1;
+    if (e->dest >= 0) {
+      ooo->values[e->dest] = e->result;
+      ooo->ready[e->dest] = 1;
+    }
+    if (e->flag >= 0) {
+      ooo->values[e->flag] = e->zero;
+      ooo->ready[e->flag] = 1;
+    }
+  }
+}
+
+/*
+ * Squashes every instruction after a mispredicted control instruction
+ * that has just committed : their physical registers go back on the
+ * free list, dispatch renames from the committed map again and fetch
+ * restarts at pc.
+ */
+static void
+ooo_squash(APEX_OoO* ooo, int pc)
+{
+  for (int i = 0; i < ooo->rob_count; ++i) {
+    const OoO_Entry* e =
+      &ooo->rob[(ooo->rob_head + i) % ooo->config.rob_size];
+    if (e->dest >= 0) {
+      ooo->free_regs[ooo->free_count++] = e->dest;
+    }
+    if (e->flag >= 0) {
+      ooo->free_regs[ooo->free_count++] = e->flag;
+    }
+  }
+  ooo->squashed += ooo->rob_count + ooo->fetch_count;
+  ooo->rob_count = 0;
+  ooo->iq_count = 0;
+  ooo->lsq_count = 0;
+  ooo->fetch_count = 0;
+  ooo->fetch_pc = pc;
+  ooo->fetch_stopped = 0;
+  memcpy(ooo->map, ooo->committed_map, sizeof(ooo->map));
+}
+
+/*
+ * Commit : retires done instructions from the head of the ROB. Stores
+ * write data memory here, and a control instruction checks the path
+ * fetch took after it.
+ */
+static void
+ooo_commit(APEX_OoO* ooo)
+{
+  APEX_CPU* cpu = ooo->cpu;
+
+  for (int n = 0; n < ooo->config.width && ooo->rob_count > 0; ++n) {
+    OoO_Entry* e = &ooo->rob[ooo->rob_head];
+    int opcode = e->ins.opcode;
+    if (!e->done) {
+      return;
+    }
+    if (e->end || e->fault) {
+      if (e->fault) {
+        fprintf(cpu->err,
+                "APEX_Error : data memory access out of range at pc(%d)\n",
+                e->pc);
+      }
+      cpu->pc = e->pc;
+      ooo->finished = 1;
+      return;
+    }
+
+    if (is_store(opcode)) {
+      cpu->data_memory[e->address] = e->store_value;
+      if (cpu->dcache) {
+        APEX_cache_access(cpu->dcache, e->address, 1);
+      }
+    }
+    if (e->dest >= 0) {
+      ooo->committed_map[e->ins.rd] = e->dest;
+      ooo->free_regs[ooo->free_count++] = e->prev_dest;
+    }
+    if (e->flag >= 0) {
+      ooo->committed_map[OOO_ZERO_FLAG] = e->flag;
+      ooo->free_regs[ooo->free_count++] = e->prev_flag;
+    }
+    if (is_load(opcode) || is_store(opcode)) {
+      ooo->lsq_head = (ooo->lsq_head + 1) % ooo->config.lsq_size;
+      ooo->lsq_count--;
+    }
+    ooo->rob_head = (ooo->rob_head + 1) % ooo->config.rob_size;
+    ooo->rob_count--;
+    ooo->committed++;
+    cpu->pc = e->next_pc;
+
+    if (opcode == OP_HALT) {
+      ooo->finished = 1;
+      return;
+    }
+    if (is_control(opcode)) {
+      int mispredicted = e->next_pc != e->predicted_pc;
+      if (cpu->bpred) {
+        mispredicted = APEX_bpred_resolve(cpu->bpred, e->pc,
+                                          opcode != OP_JUMP, e->next_pc,
+                                          e->predicted_pc);
+      }
+      if (mispredicted) {
+        ooo->mispredicts++;
+        ooo_squash(ooo, e->next_pc);
+        return;
+      }
+    }
+  }
+}
+
+/* Copies the committed registers and zero flag back into the CPU */
+static void
+write_back_state(APEX_OoO* ooo)
+{
+  APEX_CPU* cpu = ooo->cpu;
+  for (int r = 0; r < 16; ++r) {
+    cpu->regs[r] = ooo->values[ooo->committed_map[r]];
+  }
+  cpu->zero = ooo->values[ooo->committed_map[OOO_ZERO_FLAG]];
+  cpu->ins_completed = (int)ooo->committed;
+}
+
+/*
+ * Runs until a HALT, a data memory fault or the end of code memory
+ * commits, or for at most req_cyc cycles when it is positive. The CPU
+ * is left with the committed state and its clock. Returns
+ * CPU_STOP_COMPLETE or CPU_STOP_CYCLES.
+ */
+int
+APEX_ooo_run(APEX_OoO* ooo, int req_cyc)
+{
+  APEX_CPU* cpu = ooo->cpu;
+  int stop = CPU_STOP_COMPLETE;
+
+  while (!ooo->finished) {
+    if (req_cyc > 0 && cpu->clock >= req_cyc) {
+      stop = CPU_STOP_CYCLES;
+      break;
+    }
+    ooo_commit(ooo);
+    ooo_complete(ooo);
+    ooo_issue(ooo);
+    ooo_dispatch(ooo);
+    ooo_fetch(ooo);
+    cpu->clock++;
+  }
+
+  write_back_state(ooo);
+  return stop;
+}
+
+/* Prints the configuration, IPC and where the core lost cycles */
+void
+APEX_ooo_report(const APEX_OoO* ooo, FILE* out)
+{
+  const APEX_OoO_Config* config = &ooo->config;
+  int cycles = ooo->cpu->clock;
+  fprintf(out,
+          "APEX_OOO : %d-wide, %d-entry ROB, %d-entry issue queue, "
+          "%d-entry LSQ, %d physical registers\n",
+          config->width, config->rob_size, config->iq_size,
+          config->lsq_size, config->phys_regs);
+  fprintf(out,
+          "APEX_OOO : %d cycles, %lld instructions committed, IPC %.2f\n",
+          cycles, ooo->committed,
+          cycles ? (double)ooo->committed / cycles : 0.0);
+  fprintf(out,
+          "APEX_OOO : %lld mispredicted branches, %lld instructions "
+          "squashed, %lld loads forwarded from stores\n",
+          ooo->mispredicts, ooo->squashed, ooo->forwarded);
+  fprintf(out,
+          "APEX_OOO : dispatch stall cycles : ROB full %lld, issue queue "
+          "full %lld, LSQ full %lld, no free register %lld\n",
+          ooo->rob_full, ooo->iq_full, ooo->lsq_full, ooo->regs_full);
+}
@@ -0,0 +1,43 @@
+#ifndef _APEX_OOO_H_
+#define _APEX_OOO_H_
+/**
+ *  ooo.h
+ *  Out-of-order APEX core : register renaming onto a physical register
+ *  file, an issue queue, a reorder buffer (ROB) and a load / store queue
+ *  (LSQ). It runs the decoded program, data memory, caches and branch
+ *  predictor of an APEX_CPU in place of its in-order pipeline.
+ */
+#include <stdio.h>
+
+#include "cpu.h"
+
+/* Renamed architectural state : R0 - R15 and the zero flag */
+enum
+{
+  APEX_OOO_ARCH_REGS = 17
+};
+
+typedef struct APEX_OoO APEX_OoO;
+
+typedef struct APEX_OoO_Config
+{
+  int width;        // Fetched, renamed, issued and committed per cycle
+  int rob_size;     // ROB entries
+  int iq_size;      // Issue queue entries
+  int lsq_size;     // LSQ entries
+  int phys_regs;    // At least APEX_OOO_ARCH_REGS + 2
+} APEX_OoO_Config;
+
+APEX_OoO*
+APEX_ooo_create(APEX_CPU* cpu, const APEX_OoO_Config* config);
+
+void
+APEX_ooo_destroy(APEX_OoO* ooo);
+
+int
+APEX_ooo_run(APEX_OoO* ooo, int req_cyc);
+
+void
+APEX_ooo_report(const APEX_OoO* ooo, FILE* out);
+
+#endif
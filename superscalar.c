@@ -0,0 +1,699 @@
+/*
+ *  superscalar.c
+ *  W-wide in-order APEX pipeline. Every stage of cpu.c holds a group of
+ *  up to W instructions in program order, and a cycle runs the stages
+ *  from WB back to F as the scalar pipeline does :
+ *    F     fetches up to W instructions, ending a group after a control
+ *          instruction predicted taken, and hands decode what fits
+ *    DRF   issues the longest prefix of its group whose operands the
+ *          bypass network has, that reads no register written earlier in
+ *          the same group and that fits the functional units. The rest
+ *          waits in DRF for the next cycle.
+ *    EX1   computes results, addresses, the zero flag and branch outcomes
+ *    EX2   resolves control flow, squashing the younger groups and
+ *          refetching on a misprediction
+ *    MEM1  accesses data memory, held like the scalar MEM1 by a cache
+ *    MEM2  passes results on
+ *    WB    writes the register file and the zero flag
+ *  Results follow functional.c, so the final state matches the
+ *  functional engines.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpred.h"
+#include "cache.h"
+#include "superscalar.h"
+
+const char* const APEX_superscalar_unit_names[NUM_SS_UNITS] = {
+  [SS_UNIT_ALU]    = "ALU",
+  [SS_UNIT_MUL]    = "MUL",
+  [SS_UNIT_MEM]    = "memory",
+  [SS_UNIT_BRANCH] = "branch",
+};
+
+/* Why decode could not issue its whole group */
+enum
+{
+  SS_STALL_GROUP,     // Source written earlier in the same group
+  SS_STALL_OPERAND,   // Source loaded by an instruction before MEM2
+  SS_STALL_UNIT,      // No functional unit of its class left
+  NUM_SS_STALLS
+};
+
+enum
+{
+  SS_OPERAND_REGISTER_FILE = -1,
+  SS_OPERAND_WAIT = -2
+};
+
+typedef struct SS_Slot
+{
+  APEX_Instruction ins;
+  int pc;
+  int predicted_pc;     // pc fetched after it
+  int next_pc;          // pc that really follows, from EX1 on
+  int src[3];           // Source values, in sources() order
+  int result;
+  int zero;             // Zero flag it sets, for ADD, ADDL, SUB, MUL
+  int address;
+  int store_value;
+  unsigned int fault : 1;   // Data memory address out of range
+  unsigned int end : 1;     // pc outside code memory
+} SS_Slot;
+
+typedef struct SS_Group
+{
+  SS_Slot slot[APEX_SUPERSCALAR_MAX_WIDTH];
+  int count;
+} SS_Group;
+
+struct APEX_Superscalar
+{
+  APEX_Superscalar_Config config;
+  APEX_CPU* cpu;
+  SS_Group stage[NUM_STAGES];
+
+  int zero;             // Zero flag as EX1 sees it
+  int fetch_pc;
+  int fetch_stopped;    // Fetched a HALT, the end of code or a fault
+  int mem_wait;         // As APEX_CPU.mem_wait
+  int finished;         // Committed a HALT, a fault or the end of code
+
+  /* Statistics */
+  long long committed;
+  long long issued[APEX_SUPERSCALAR_MAX_WIDTH + 1];  // Cycles by issue count
+  long long stalls[NUM_SS_STALLS];  // Cycles decode held instructions
+  long long mem_wait_cycles;
+  long long mispredicts;
+  long long squashed;
+  long long forwarded;
+};
+
+/* pc of the code memory slot pc falls in, as the functional engines
+ * round it
+ */
+static int
+code_pc(int pc)
+{
+  return 4000 + 4 * get_code_index(pc);
+}
+
+static int
+is_control(int opcode)
+{
+  return opcode == OP_JUMP || opcode == OP_BZ || opcode == OP_BNZ;
+}
+
+static int
+is_load(int opcode)
+{
+  return opcode == OP_LOAD || opcode == OP_LDR;
+}
+
+static int
+is_store(int opcode)
+{
+  return opcode == OP_STORE || opcode == OP_STR;
+}
+
+static int
+writes_rd(int opcode)
+{
+  return opcode == OP_MOVC || opcode == OP_LOAD || opcode == OP_LDR ||
+         opcode == OP_ADD || opcode == OP_ADDL || opcode == OP_SUB ||
+         opcode == OP_AND || opcode == OP_OR || opcode == OP_XOR ||
+         opcode == OP_MUL;
+}
+
+static int
+unit_of(int opcode)
+{
+  switch (opcode) {
+    case OP_MOVC:
+    case OP_ADD:
+    case OP_ADDL:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+      return SS_UNIT_ALU;
+    case OP_MUL:
+      return SS_UNIT_MUL;
+    case OP_LOAD:
+    case OP_LDR:
+    case OP_STORE:
+    case OP_STR:
+      return SS_UNIT_MEM;
+    case OP_JUMP:
+    case OP_BZ:
+    case OP_BNZ:
+      return SS_UNIT_BRANCH;
+    default:
+      return -1;
+  }
+}
+
+/* Source registers of ins, STR storing rd. Returns how many. */
+static int
+sources(const APEX_Instruction* ins, int* regs)
+{
+  switch (ins->opcode) {
+    case OP_STR:
+      regs[2] = ins->rd;
+      /* fall through */
+    case OP_STORE:
+    case OP_LDR:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_MUL:
+      regs[0] = ins->rs1;
+      regs[1] = ins->rs2;
+      return ins->opcode == OP_STR ? 3 : 2;
+    case OP_LOAD:
+    case OP_ADDL:
+    case OP_JUMP:
+      regs[0] = ins->rs1;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Creates a W-wide pipeline for the program and architectural state of
+ * cpu, which the run updates. Returns NULL on an invalid config or
+ * allocation failure.
+ */
+APEX_Superscalar*
+APEX_superscalar_create(APEX_CPU* cpu, const APEX_Superscalar_Config* config)
+{
+  if (config->width < 1 || config->width > APEX_SUPERSCALAR_MAX_WIDTH) {
+    return NULL;
+  }
+  for (int u = 0; u < NUM_SS_UNITS; ++u) {
+    if (config->units[u] < 1) {
+      return NULL;
+    }
+  }
+
+  /* Branches are predicted in F and resolved in EX2 */
+  if (cpu->bpred &&
+      APEX_bpred_reserve(cpu->bpred, (EX2 - F + 1) * config->width) < 0) {
+    return NULL;
+  }
+  APEX_Superscalar* ss = calloc(1, sizeof(*ss));
+  if (!ss) {
+    return NULL;
+  }
+  ss->config = *config;
+  ss->cpu = cpu;
+  ss->zero = cpu->zero;
+  ss->fetch_pc = cpu->pc;
+  return ss;
+}
+
+void
+APEX_superscalar_destroy(APEX_Superscalar* ss)
+{
+  free(ss);
+}
+
+/* Empties the groups of F, DRF and EX1, behind a misprediction or a
+ * fault
+ */
+static void
+squash_front_end(APEX_Superscalar* ss)
+{
+  for (int i = F; i <= EX1; ++i) {
+    ss->squashed += ss->stage[i].count;
+    ss->stage[i].count = 0;
+  }
+}
+
+/*
+ * WB : commits the group in order. The run ends at a HALT, at the end
+ * of code memory and at a data memory fault, which like the functional
+ * engines commits nothing of the faulting instruction.
+ */
+static void
+ss_writeback(APEX_Superscalar* ss)
+{
+  APEX_CPU* cpu = ss->cpu;
+  SS_Group* group = &ss->stage[WB];
+
+  for (int k = 0; k < group->count && !ss->finished; ++k) {
+    const SS_Slot* s = &group->slot[k];
+    if (s->end || s->fault) {
+      if (s->fault) {
+        fprintf(cpu->err,
+                "APEX_Error : data memory access out of range at pc(%d)\n",
+                s->pc);
+      }
+      cpu->pc = s->pc;
+      ss->finished = 1;
+      break;
+    }
+    if (writes_rd(s->ins.opcode)) {
+      cpu->regs[s->ins.rd] = s->result;
+    }
+    if (s->ins.opcode == OP_ADD || s->ins.opcode == OP_ADDL ||
+        s->ins.opcode == OP_SUB || s->ins.opcode == OP_MUL) {
+      cpu->zero = s->zero;
+    }
+    ss->committed++;
+    cpu->pc = s->next_pc;
+    ss->finished = s->ins.opcode == OP_HALT;
+  }
+  group->count = 0;
+}
+
+static void
+ss_memory2(APEX_Superscalar* ss)
+{
+  ss->stage[WB] = ss->stage[MEM2];
+  ss->stage[MEM2].count = 0;
+}
+
+/* Cycles the group in MEM1 waits beyond the first : its slowest access */
+static int
+group_delay(APEX_Superscalar* ss, const SS_Group* group)
+{
+  int delay = 0;
+  if (!ss->cpu->dcache) {
+    return 0;
+  }
+  for (int k = 0; k < group->count; ++k) {
+    const SS_Slot* s = &group->slot[k];
+    int opcode = s->ins.opcode;
+    if ((is_load(opcode) || is_store(opcode)) && !s->fault) {
+      int latency = APEX_cache_access(ss->cpu->dcache, s->address,
+                                      is_store(opcode)) - 1;
+      if (latency > delay) {
+        delay = latency;
+      }
+    }
+  }
+  return delay;
+}
+
+/*
+ * MEM1 : performs the group's loads and stores in order. Returns 1 while
+ * the group waits on the cache, holding MEM1 and every stage behind it.
+ * A fault squashes everything younger and stops fetch, so nothing after
+ * it touches memory.
+ */
+static int
+ss_memory1(APEX_Superscalar* ss)
+{
+  APEX_CPU* cpu = ss->cpu;
+  SS_Group* group = &ss->stage[MEM1];
+
+  int wait;
+  if (ss->mem_wait > 0) {
+    wait = --ss->mem_wait > 0;
+  }
+  else {
+    ss->mem_wait = group_delay(ss, group);
+    wait = ss->mem_wait > 0;
+  }
+  if (wait) {
+    ss->stage[MEM2].count = 0;
+    ss->mem_wait_cycles++;
+    return 1;
+  }
+
+  for (int k = 0; k < group->count; ++k) {
+    SS_Slot* s = &group->slot[k];
+    if (s->fault) {
+      ss->squashed += group->count - k - 1 + ss->stage[EX2].count;
+      group->count = k + 1;
+      ss->stage[EX2].count = 0;
+      squash_front_end(ss);
+      ss->fetch_stopped = 1;
+      break;
+    }
+    if (is_load(s->ins.opcode)) {
+      s->result = cpu->data_memory[s->address];
+    }
+    else if (is_store(s->ins.opcode)) {
+      cpu->data_memory[s->address] = s->store_value;
+    }
+  }
+
+  ss->stage[MEM2] = *group;
+  group->count = 0;
+  return 0;
+}
+
+/*
+ * EX2 : resolves the group's control instructions in order, training
+ * the predictor. A misprediction squashes F, DRF and EX1 and refetches
+ * from the right pc this cycle.
+ */
+static void
+ss_execute2(APEX_Superscalar* ss)
+{
+  APEX_CPU* cpu = ss->cpu;
+  SS_Group* group = &ss->stage[EX2];
+
+  for (int k = 0; k < group->count; ++k) {
+    const SS_Slot* s = &group->slot[k];
+    if (!is_control(s->ins.opcode)) {
+      continue;
+    }
+    int mispredicted = s->next_pc != s->predicted_pc;
+    if (cpu->bpred) {
+      mispredicted = APEX_bpred_resolve(cpu->bpred, s->pc,
+                                        s->ins.opcode != OP_JUMP, s->next_pc,
+                                        s->predicted_pc);
+    }
+    if (mispredicted) {
+      ss->mispredicts++;
+      squash_front_end(ss);
+      ss->fetch_pc = s->next_pc;
+      ss->fetch_stopped = 0;
+      break;
+    }
+  }
+
+  ss->stage[MEM1] = *group;
+  group->count = 0;
+}
+
+/*
+ * EX1 : executes the group in order. Instructions after a control
+ * instruction that went another way than predicted are on the wrong
+ * path and are dropped before they can change the zero flag.
+ */
+static void
+ss_execute1(APEX_Superscalar* ss)
+{
+  SS_Group* group = &ss->stage[EX1];
+
+  for (int k = 0; k < group->count; ++k) {
+    SS_Slot* s = &group->slot[k];
+    const APEX_Instruction* ins = &s->ins;
+    int a = s->src[0];
+    int b = s->src[1];
+    unsigned int address = 0;
+
+    s->next_pc = s->pc + 4;
+    switch (ins->opcode) {
+      case OP_MOVC:
+        s->result = ins->imm;
+        break;
+      case OP_ADD:
+        s->result = a + b;
+        break;
+      case OP_ADDL:
+        s->result = a + ins->imm;
+        break;
+      case OP_SUB:
+        s->result = a - b;
+        break;
+      case OP_MUL:
+        s->result = a * b;
+        break;
+      case OP_AND:
+        s->result = a & b;
+        break;
+      case OP_OR:
+        s->result = a | b;
+        break;
+      case OP_XOR:
+        s->result = a ^ b;
+        break;
+      case OP_LOAD:
+        address = a + ins->imm;
+        break;
+      case OP_LDR:
+        address = a + b;
+        break;
+      case OP_STORE:
+        address = b + ins->imm;
+        s->store_value = a;
+        break;
+      case OP_STR:
+        address = a + b;
+        s->store_value = s->src[2];
+        break;
+      case OP_BZ:
+      case OP_BNZ:
+        if (ss->zero == (ins->opcode == OP_BZ)) {
+          s->next_pc = code_pc(s->pc + ins->imm);
+        }
+        break;
+      case OP_JUMP:
+        s->next_pc = code_pc(a + ins->imm);
+        break;
+      default:
+        break;
+    }
+
+    if (ins->opcode == OP_ADD || ins->opcode == OP_ADDL ||
+        ins->opcode == OP_SUB || ins->opcode == OP_MUL) {
+      s->zero = s->result == 0;
+      ss->zero = s->zero;
+    }
+    if (is_load(ins->opcode) || is_store(ins->opcode)) {
+      s->address = (int)address;
+      s->fault = address >= DATA_MEMORY_SIZE;
+    }
+    if (is_control(ins->opcode) && s->next_pc != s->predicted_pc) {
+      ss->squashed += group->count - k - 1;
+      group->count = k + 1;
+    }
+  }
+
+  ss->stage[EX2] = *group;
+  group->count = 0;
+}
+
+/*
+ * Bypass network, as in cpu.c : the youngest writer of reg from EX2
+ * down to WB, a load only from MEM2 on, else the register file. Returns
+ * the stage read or SS_OPERAND_*.
+ */
+static int
+read_operand(const APEX_Superscalar* ss, int reg, int* value)
+{
+  for (int i = EX2; i <= WB; ++i) {
+    const SS_Group* group = &ss->stage[i];
+    for (int k = group->count - 1; k >= 0; --k) {
+      const SS_Slot* w = &group->slot[k];
+      if (!writes_rd(w->ins.opcode) || w->ins.rd != reg) {
+        continue;
+      }
+      if (i < MEM2 && is_load(w->ins.opcode)) {
+        return SS_OPERAND_WAIT;
+      }
+      *value = w->result;
+      return i;
+    }
+  }
+  *value = ss->cpu->regs[reg];
+  return SS_OPERAND_REGISTER_FILE;
+}
+
+/* Whether an instruction before slot n of group writes reg */
+static int
+written_in_group(const SS_Group* group, int n, int reg)
+{
+  for (int k = 0; k < n; ++k) {
+    const SS_Slot* w = &group->slot[k];
+    if (writes_rd(w->ins.opcode) && w->ins.rd == reg) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * DRF : issues instructions in order until one has to wait. Returns
+ * the SS_STALL_* reason it stopped at, or -1 if it issued all.
+ */
+static int
+issue_prefix(APEX_Superscalar* ss, SS_Group* group, int* issued)
+{
+  int used[NUM_SS_UNITS] = { 0 };
+  int n = 0;
+
+  for (; n < group->count; ++n) {
+    SS_Slot* s = &group->slot[n];
+    int regs[3];
+    int values[3];
+    int from[3];
+    int count = sources(&s->ins, regs);
+
+    for (int i = 0; i < count; ++i) {
+      if (written_in_group(group, n, regs[i])) {
+        *issued = n;
+        return SS_STALL_GROUP;
+      }
+      from[i] = read_operand(ss, regs[i], &values[i]);
+      if (from[i] == SS_OPERAND_WAIT) {
+        *issued = n;
+        return SS_STALL_OPERAND;
+      }
+    }
+    int unit = unit_of(s->ins.opcode);
+    if (unit >= 0 && used[unit] == ss->config.units[unit]) {
+      *issued = n;
+      return SS_STALL_UNIT;
+    }
+
+    if (unit >= 0) {
+      used[unit]++;
+    }
+    for (int i = 0; i < count; ++i) {
+      s->src[i] = values[i];
+      ss->forwarded += from[i] != SS_OPERAND_REGISTER_FILE;
+    }
+  }
+  *issued = n;
+  return -1;
+}
+
+static void
+ss_decode(APEX_Superscalar* ss)
+{
+  SS_Group* group = &ss->stage[DRF];
+  SS_Group* next = &ss->stage[EX1];
+  int issued;
+  int stall = issue_prefix(ss, group, &issued);
+
+  memcpy(next->slot, group->slot, issued * sizeof(group->slot[0]));
+  next->count = issued;
+  memmove(group->slot, group->slot + issued,
+          (group->count - issued) * sizeof(group->slot[0]));
+  group->count -= issued;
+
+  ss->issued[issued]++;
+  if (stall >= 0) {
+    ss->stalls[stall]++;
+  }
+}
+
+/*
+ * F : fills its group from fetch_pc, then moves as much of it into DRF
+ * as DRF has room for. Fetch stops after a HALT or the end of code
+ * memory until a misprediction sends it elsewhere.
+ */
+static void
+ss_fetch(APEX_Superscalar* ss)
+{
+  APEX_CPU* cpu = ss->cpu;
+  SS_Group* group = &ss->stage[F];
+  SS_Group* next = &ss->stage[DRF];
+  int width = ss->config.width;
+
+  while (group->count < width && !ss->fetch_stopped) {
+    SS_Slot* s = &group->slot[group->count++];
+    int index = get_code_index(ss->fetch_pc);
+
+    memset(s, 0, sizeof(*s));
+    s->pc = ss->fetch_pc;
+    if (index < 0 || index >= cpu->code_memory_size) {
+      s->end = 1;
+      s->predicted_pc = s->next_pc = s->pc;
+      ss->fetch_stopped = 1;
+      break;
+    }
+    s->ins = cpu->code_memory[index];
+    s->predicted_pc = s->pc + 4;
+    if (cpu->bpred && is_control(s->ins.opcode)) {
+      if (APEX_bpred_full(cpu->bpred)) {
+        group->count--;
+        break;
+      }
+      s->predicted_pc = APEX_bpred_predict(cpu->bpred, s->pc,
+                                           s->ins.opcode != OP_JUMP);
+    }
+    ss->fetch_pc = s->predicted_pc;
+    if (s->ins.opcode == OP_HALT) {
+      ss->fetch_stopped = 1;
+    }
+    if (s->predicted_pc != s->pc + 4) {
+      break;
+    }
+  }
+
+  int moved = width - next->count;
+  if (moved > group->count) {
+    moved = group->count;
+  }
+  memcpy(next->slot + next->count, group->slot,
+         moved * sizeof(group->slot[0]));
+  next->count += moved;
+  memmove(group->slot, group->slot + moved,
+          (group->count - moved) * sizeof(group->slot[0]));
+  group->count -= moved;
+}
+
+/*
+ * Runs until a HALT, a data memory fault or the end of code memory
+ * commits, or for at most req_cyc cycles when it is positive. Returns
+ * CPU_STOP_COMPLETE or CPU_STOP_CYCLES.
+ */
+int
+APEX_superscalar_run(APEX_Superscalar* ss, int req_cyc)
+{
+  APEX_CPU* cpu = ss->cpu;
+
+  while (!ss->finished) {
+    if (req_cyc > 0 && cpu->clock >= req_cyc) {
+      cpu->ins_completed = (int)ss->committed;
+      return CPU_STOP_CYCLES;
+    }
+    ss_writeback(ss);
+    ss_memory2(ss);
+    if (ss_memory1(ss) == 0) {
+      ss_execute2(ss);
+      ss_execute1(ss);
+      ss_decode(ss);
+      ss_fetch(ss);
+    }
+    cpu->clock++;
+  }
+
+  cpu->ins_completed = (int)ss->committed;
+  return CPU_STOP_COMPLETE;
+}
+
+/* Prints IPC, how many instructions decode issued per cycle and what
+ * held the rest
+ */
+void
+APEX_superscalar_report(const APEX_Superscalar* ss, FILE* out)
+{
+  const APEX_Superscalar_Config* config = &ss->config;
+  int cycles = ss->cpu->clock;
+
+  fprintf(out, "APEX_SS  : %d-wide in-order, units", config->width);
+  for (int u = 0; u < NUM_SS_UNITS; ++u) {
+    fprintf(out, " %s %d", APEX_superscalar_unit_names[u], config->units[u]);
+  }
+  fprintf(out,
+          "\nAPEX_SS  : %d cycles, %lld instructions committed, IPC %.2f\n",
+          cycles, ss->committed,
+          cycles ? (double)ss->committed / cycles : 0.0);
+  fprintf(out, "APEX_SS  : cycles issuing");
+  for (int n = 0; n <= config->width; ++n) {
+    fprintf(out, " %d: %lld", n, ss->issued[n]);
+  }
+  fprintf(out,
+          "\nAPEX_SS  : decode held instructions on a same-group "
+          "dependency %lld, a load in flight %lld, a busy unit %lld "
+          "cycles\n",
+          ss->stalls[SS_STALL_GROUP], ss->stalls[SS_STALL_OPERAND],
+          ss->stalls[SS_STALL_UNIT]);
+  fprintf(out,
+          "APEX_SS  : %lld memory wait cycles, %lld mispredicted branches, "
+          "%lld instructions squashed, %lld operands forwarded\n",
+          ss->mem_wait_cycles, ss->mispredicts, ss->squashed,
+          ss->forwarded);
+}
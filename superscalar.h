@@ -0,0 +1,51 @@
+#ifndef _APEX_SUPERSCALAR_H_
+#define _APEX_SUPERSCALAR_H_
+/**
+ *  superscalar.h
+ *  W-wide in-order APEX pipeline : the seven stages of cpu.c, each
+ *  holding a group of up to W instructions in program order. It runs
+ *  the decoded program, data memory, caches and branch predictor of an
+ *  APEX_CPU in place of the scalar pipeline.
+ */
+#include <stdio.h>
+
+#include "cpu.h"
+
+enum
+{
+  APEX_SUPERSCALAR_MAX_WIDTH = 8
+};
+
+/* Functional units, the classes decode issues to */
+enum
+{
+  SS_UNIT_ALU,      // MOVC, ADD, ADDL, SUB, AND, OR, XOR
+  SS_UNIT_MUL,      // MUL
+  SS_UNIT_MEM,      // LOAD, LDR, STORE, STR
+  SS_UNIT_BRANCH,   // BZ, BNZ, JUMP
+  NUM_SS_UNITS
+};
+
+typedef struct APEX_Superscalar APEX_Superscalar;
+
+typedef struct APEX_Superscalar_Config
+{
+  int width;                // 1 .. APEX_SUPERSCALAR_MAX_WIDTH
+  int units[NUM_SS_UNITS];  // Instructions of each class issued a cycle
+} APEX_Superscalar_Config;
+
+extern const char* const APEX_superscalar_unit_names[NUM_SS_UNITS];
+
+APEX_Superscalar*
+APEX_superscalar_create(APEX_CPU* cpu, const APEX_Superscalar_Config* config);
+
+void
+APEX_superscalar_destroy(APEX_Superscalar* ss);
+
+int
+APEX_superscalar_run(APEX_Superscalar* ss, int req_cyc);
+
+void
+APEX_superscalar_report(const APEX_Superscalar* ss, FILE* out);
+
+#endif
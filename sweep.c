@@ -0,0 +1,725 @@
+/*
+ *  sweep.c
+ *  Batch driver : runs a list of independent jobs on a pool of threads
+ *  and writes one summary row per job, as CSV or JSON.
+ *
+ *  Each program is decoded once, before the workers start, and every
+ *  job on it gets its own APEX_CPU borrowing that read-only code memory.
+ *  Jobs are dealt out in contiguous ranges, one per worker. A worker
+ *  takes jobs from the front of its own range and, once it is empty,
+ *  steals from the back of the range with the most jobs left.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex.h"
+#include "jit.h"
+
+// ./apex_sweep jobs.txt
+// ./apex_sweep jobs.txt -j 8 -o summary.json
+//
+// Job list, one job per line, '#' starts a comment :
+//   <program> <type> <limit> [key=value ...]
+// type is simulate, functional, threaded or jit. limit is the cycle limit
+// of simulate and the instruction limit of the others, 0 for none.
+// Keys : until_pc, until_retired, restore (a checkpoint to start from,
+// e.g. one input dataset), and for simulate l1, l2, l1i, dram_latency,
+// fetch_width, fetch_queue, bpred, btb and latencies (as the --l1 ...
+// options of apex_sim).
+
+/* Longest line of the job list */
+#define SWEEP_LINE 1024
+
+enum
+{
+  JOB_PIPELINE,
+  JOB_FUNCTIONAL,
+  JOB_THREADED,
+  JOB_JIT,
+  NUM_JOB_TYPES
+};
+
+static const char* const job_type_names[NUM_JOB_TYPES] = {
+  [JOB_PIPELINE]   = "simulate",
+  [JOB_FUNCTIONAL] = "functional",
+  [JOB_THREADED]   = "threaded",
+  [JOB_JIT]        = "jit",
+};
+
+typedef int (*APEX_Functional_Engine)(APEX_CPU* cpu, long long max_ins,
+                                      long long* retired);
+
+static const APEX_Functional_Engine job_engines[NUM_JOB_TYPES] = {
+  [JOB_FUNCTIONAL] = APEX_functional_run,
+  [JOB_THREADED]   = APEX_threaded_run,
+  [JOB_JIT]        = APEX_jit_run,
+};
+
+/* A program shared by every job that runs it */
+typedef struct Sweep_Program
+{
+  char* filename;
+  APEX_Instruction* code;
+  int size;
+  int mapped;
+} Sweep_Program;
+
+typedef struct Sweep_Job
+{
+  int line;                 // Line of the job list
+  Sweep_Program* program;
+  int type;                 // JOB_*
+  long long limit;
+  int until_pc;
+  int until_retired;
+  char* restore;            // Checkpoint to start from, or NULL
+  APEX_Cache_Hierarchy caches;
+  int fetch_width;
+  int fetch_queue;
+  int has_bpred;
+  APEX_Bpred_Config bpred;
+  int btb_entries;          // 0 for the default of bpred
+  int has_latency;
+  APEX_Latency_Table latency;
+  char* config;             // The key=value fields, as written
+
+  /* Results, filled by the worker */
+  const char* status;
+  long long cycles;
+  long long retired;
+  long long stall_cycles;
+  long long fetch_stall_cycles;
+  double l1_hit_rate;       // Percent, 0 without caches
+  double l1_mpki;
+  double amat;              // Cycles per data access
+  double bpred_accuracy;    // Percent, 0 without a predictor
+  long long bpred_cycles_saved;
+  int pc;
+  double seconds;
+} Sweep_Job;
+
+/* Jobs [next, end) still waiting in one worker's range */
+typedef struct Sweep_Range
+{
+  pthread_mutex_t lock;
+  int next;
+  int end;
+} Sweep_Range;
+
+typedef struct Sweep
+{
+  Sweep_Program** programs;
+  int num_programs;
+  Sweep_Job* jobs;
+  int num_jobs;
+  Sweep_Range* ranges;
+  int num_workers;
+} Sweep;
+
+typedef struct Sweep_Worker
+{
+  Sweep* sweep;
+  int id;
+  pthread_t thread;
+} Sweep_Worker;
+
+static double
+elapsed_seconds(const struct timespec* start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+run_job(Sweep_Job* job)
+{
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  APEX_CPU* cpu = APEX_cpu_create(job->program->code, job->program->size);
+  if (!cpu) {
+    job->status = "error";
+    return;
+  }
+  cpu->trace_level = TRACE_NONE;
+  if (APEX_cpu_set_caches(cpu, &job->caches, job->fetch_width,
+                          job->fetch_queue) < 0 ||
+      APEX_cpu_set_bpred(cpu, job->has_bpred ? &job->bpred : NULL) < 0 ||
+      APEX_cpu_set_latencies(cpu, job->has_latency ? &job->latency
+                                                   : NULL) < 0) {
+    APEX_cpu_stop(cpu);
+    job->status = "error";
+    return;
+  }
+
+  if (job->restore && APEX_checkpoint_restore(cpu, job->restore) < 0) {
+    job->status = "bad checkpoint";
+  }
+  else if (job->type == JOB_PIPELINE) {
+    cpu->req_cyc = (int)job->limit;
+    cpu->until_pc = job->until_pc;
+    cpu->until_retired = job->until_retired;
+    job->status = APEX_cpu_stop_names[APEX_cpu_simulate(cpu)];
+    job->cycles = cpu->clock;
+    job->retired = cpu->ins_completed;
+    job->stall_cycles = cpu->stall_cycles;
+    job->fetch_stall_cycles = cpu->fetch_stall_cycles;
+    const APEX_Cache* l1 = cpu->dcache;
+    long long accesses = l1 ? l1->reads + l1->writes : 0;
+    if (accesses) {
+      long long misses = l1->read_misses + l1->write_misses;
+      job->l1_hit_rate = 100.0 * (accesses - misses) / accesses;
+      job->l1_mpki = job->retired ? 1000.0 * misses / job->retired : 0.0;
+      job->amat = (double)l1->cycles / accesses;
+    }
+    const APEX_Bpred* bp = cpu->bpred;
+    if (bp && bp->branches) {
+      job->bpred_accuracy = 100.0 * (bp->branches - bp->mispredicts) /
+                            bp->branches;
+      job->bpred_cycles_saved = APEX_bpred_cycles_saved(bp);
+    }
+  }
+  else {
+    long long retired = 0;
+    int stop = job_engines[job->type](cpu, job->limit, &retired);
+    job->status = APEX_functional_stop_names[stop];
+    job->retired = retired;
+  }
+  job->pc = cpu->pc;
+
+  APEX_cpu_stop(cpu);
+  job->seconds = elapsed_seconds(&start);
+}
+
+/* Takes the next job of range r from the front, or when stealing from
+ * the back. Returns -1 when the range is empty.
+ */
+static int
+take_job(Sweep_Range* r, int steal)
+{
+  int job = -1;
+
+  pthread_mutex_lock(&r->lock);
+  if (r->next < r->end) {
+    job = steal ? --r->end : r->next++;
+  }
+  pthread_mutex_unlock(&r->lock);
+  return job;
+}
+
+/* Steals from the worker with the most jobs left. Returns -1 once every
+ * range is empty.
+ */
+static int
+steal_job(Sweep* sweep)
+{
+  for (;;) {
+    int victim = -1;
+    int most = 0;
+
+    /* The counts only pick a victim, take_job() re-checks */
+    for (int w = 0; w < sweep->num_workers; ++w) {
+      Sweep_Range* r = &sweep->ranges[w];
+      pthread_mutex_lock(&r->lock);
+      int left = r->end - r->next;
+      pthread_mutex_unlock(&r->lock);
+      if (left > most) {
+        most = left;
+        victim = w;
+      }
+    }
+    if (victim < 0) {
+      return -1;
+    }
+    int job = take_job(&sweep->ranges[victim], 1);
+    if (job >= 0) {
+      return job;
+    }
+  }
+}
+
+static void*
+worker_main(void* arg)
+{
+  Sweep_Worker* worker = arg;
+  Sweep* sweep = worker->sweep;
+  int job;
+
+  while ((job = take_job(&sweep->ranges[worker->id], 0)) >= 0 ||
+         (job = steal_job(sweep)) >= 0) {
+    run_job(&sweep->jobs[job]);
+  }
+  return NULL;
+}
+
+static Sweep_Program*
+find_program(Sweep* sweep, const char* filename)
+{
+  for (int i = 0; i < sweep->num_programs; ++i) {
+    if (strcmp(sweep->programs[i]->filename, filename) == 0) {
+      return sweep->programs[i];
+    }
+  }
+
+  Sweep_Program** grown = realloc(sweep->programs,
+    sizeof(*grown) * (sweep->num_programs + 1));
+  if (!grown) {
+    return NULL;
+  }
+  sweep->programs = grown;
+
+  Sweep_Program* p = calloc(1, sizeof(*p));
+  if (!p) {
+    return NULL;
+  }
+  p->code = create_code_memory(filename, &p->size, &p->mapped, stderr);
+  p->filename = strdup(filename);
+  if (!p->code || !p->filename) {
+    if (p->code) {
+      destroy_code_memory(p->code, p->size, p->mapped);
+    }
+    free(p->filename);
+    free(p);
+    return NULL;
+  }
+  sweep->programs[sweep->num_programs++] = p;
+  return p;
+}
+
+/* Returns the value of field if it is "key=value", else NULL */
+static const char*
+config_value(const char* field, const char* key)
+{
+  size_t len = strlen(key);
+
+  if (strncmp(field, key, len) != 0 || field[len] != '=') {
+    return NULL;
+  }
+  return field + len + 1;
+}
+
+/* Applies one "key=value" field to job. Returns -1 on an unknown key or
+ * an invalid value.
+ */
+static int
+parse_config(Sweep_Job* job, const char* field)
+{
+  const char* value;
+
+  if ((value = config_value(field, "until_pc"))) {
+    job->until_pc = atoi(value);
+  }
+  else if ((value = config_value(field, "until_retired"))) {
+    job->until_retired = atoi(value);
+  }
+  else if ((value = config_value(field, "restore"))) {
+    free(job->restore);
+    job->restore = strdup(value);
+  }
+  else if ((value = config_value(field, "l1"))) {
+    if (APEX_cache_parse(value, &job->caches.level[0]) < 0) {
+      return -1;
+    }
+    if (job->caches.levels < 1) {
+      job->caches.levels = 1;
+    }
+  }
+  else if ((value = config_value(field, "l2"))) {
+    if (APEX_cache_parse(value, &job->caches.level[1]) < 0) {
+      return -1;
+    }
+    job->caches.levels = 2;
+  }
+  else if ((value = config_value(field, "l1i"))) {
+    if (APEX_cache_parse(value, &job->caches.l1i) < 0) {
+      return -1;
+    }
+    job->caches.has_l1i = 1;
+  }
+  else if ((value = config_value(field, "fetch_width"))) {
+    job->fetch_width = atoi(value);
+  }
+  else if ((value = config_value(field, "fetch_queue"))) {
+    job->fetch_queue = atoi(value);
+  }
+  else if ((value = config_value(field, "bpred"))) {
+    if (APEX_bpred_parse(value, &job->bpred) < 0) {
+      return -1;
+    }
+    job->has_bpred = 1;
+  }
+  else if ((value = config_value(field, "latencies"))) {
+    if (APEX_latency_load(value, &job->latency, stderr) < 0) {
+      return -1;
+    }
+    job->has_latency = 1;
+  }
+  else if ((value = config_value(field, "btb"))) {
+    job->btb_entries = atoi(value);
+    if (job->btb_entries < 1 ||
+        (job->btb_entries & (job->btb_entries - 1)) != 0) {
+      return -1;
+    }
+  }
+  else if ((value = config_value(field, "dram_latency"))) {
+    job->caches.memory_latency = atoi(value);
+    if (job->caches.memory_latency < 1) {
+      return -1;
+    }
+  }
+  else {
+    return -1;
+  }
+  return 0;
+}
+
+/* Reads the job list and decodes every program it names. Prints the
+ * offending line and returns -1 on error.
+ */
+static int
+read_jobs(Sweep* sweep, const char* filename)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open job list %s\n", filename);
+    return -1;
+  }
+
+  char line[SWEEP_LINE];
+  int line_no = 0;
+  int capacity = 0;
+  int ret = 0;
+
+  while (ret == 0 && fgets(line, sizeof(line), fp)) {
+    line_no++;
+    char* comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+
+    char* save;
+    char* program = strtok_r(line, " \t\r\n", &save);
+    if (!program) {
+      continue;
+    }
+    char* type = strtok_r(NULL, " \t\r\n", &save);
+    char* limit = strtok_r(NULL, " \t\r\n", &save);
+    if (!limit) {
+      fprintf(stderr, "APEX_Error : %s:%d: expected <program> <type> "
+              "<limit>\n", filename, line_no);
+      ret = -1;
+      break;
+    }
+
+    if (sweep->num_jobs == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      Sweep_Job* grown = realloc(sweep->jobs, sizeof(*grown) * capacity);
+      if (!grown) {
+        ret = -1;
+        break;
+      }
+      sweep->jobs = grown;
+    }
+    Sweep_Job* job = &sweep->jobs[sweep->num_jobs];
+    memset(job, 0, sizeof(*job));
+    job->line = line_no;
+    job->limit = atoll(limit);
+    job->type = -1;
+    job->caches.memory_latency = 20;
+    job->fetch_width = 1;
+    job->fetch_queue = 4;
+    for (int t = 0; t < NUM_JOB_TYPES; ++t) {
+      if (strcmp(type, job_type_names[t]) == 0) {
+        job->type = t;
+      }
+    }
+    if (job->type < 0) {
+      fprintf(stderr, "APEX_Error : %s:%d: unknown type %s\n", filename,
+              line_no, type);
+      ret = -1;
+      break;
+    }
+
+    char config[SWEEP_LINE] = "";
+    char* field;
+    while ((field = strtok_r(NULL, " \t\r\n", &save))) {
+      if (parse_config(job, field) < 0) {
+        fprintf(stderr, "APEX_Error : %s:%d: invalid setting %s\n", filename,
+                line_no, field);
+        ret = -1;
+        break;
+      }
+      if (config[0]) {
+        strcat(config, " ");
+      }
+      strcat(config, field);
+    }
+    if (ret == 0 && job->caches.levels && !job->caches.level[0].size) {
+      fprintf(stderr, "APEX_Error : %s:%d: l2 needs l1\n", filename,
+              line_no);
+      ret = -1;
+    }
+    if (ret == 0 && (job->fetch_width < 1 ||
+                     job->fetch_queue < job->fetch_width)) {
+      fprintf(stderr, "APEX_Error : %s:%d: fetch_queue must hold at least "
+              "fetch_width >= 1 instructions\n", filename, line_no);
+      ret = -1;
+    }
+    if (ret == 0 && job->btb_entries) {
+      if (!job->has_bpred) {
+        fprintf(stderr, "APEX_Error : %s:%d: btb needs bpred\n", filename,
+                line_no);
+        ret = -1;
+      }
+      job->bpred.btb_entries = job->btb_entries;
+    }
+    job->config = strdup(config);
+    sweep->num_jobs++;
+
+    if (ret == 0) {
+      job->program = find_program(sweep, program);
+      if (!job->program) {
+        fprintf(stderr, "APEX_Error : %s:%d: unable to load %s\n", filename,
+                line_no, program);
+        ret = -1;
+      }
+    }
+  }
+
+  fclose(fp);
+  return ret;
+}
+
+/* Writes s as a CSV field, quoted when it holds a separator */
+static void
+csv_string(FILE* fp, const char* s)
+{
+  if (!strpbrk(s, ",\"\n")) {
+    fputs(s, fp);
+    return;
+  }
+  fputc('"', fp);
+  for (; *s; ++s) {
+    if (*s == '"') {
+      fputc('"', fp);
+    }
+    fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void
+json_string(FILE* fp, const char* s)
+{
+  fputc('"', fp);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', fp);
+    }
+    fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static double
+job_cpi(const Sweep_Job* job)
+{
+  return job->retired ? (double)job->cycles / job->retired : 0.0;
+}
+
+static void
+write_csv(FILE* fp, const Sweep* sweep)
+{
+  fprintf(fp, "line,program,type,limit,config,status,cycles,instructions,"
+              "stall_cycles,fetch_stall_cycles,cpi,l1_hit_rate,l1_mpki,"
+              "amat,bpred_accuracy,bpred_cycles_saved,pc,seconds\n");
+  for (int i = 0; i < sweep->num_jobs; ++i) {
+    const Sweep_Job* job = &sweep->jobs[i];
+    fprintf(fp, "%d,", job->line);
+    csv_string(fp, job->program->filename);
+    fprintf(fp, ",%s,%lld,", job_type_names[job->type], job->limit);
+    csv_string(fp, job->config);
+    fprintf(fp, ",%s,%lld,%lld,%lld,%lld,%.4f,%.2f,%.2f,%.4f,%.2f,%lld,%d,"
+                "%.6f\n",
+            job->status, job->cycles, job->retired, job->stall_cycles,
+            job->fetch_stall_cycles, job_cpi(job), job->l1_hit_rate,
+            job->l1_mpki, job->amat, job->bpred_accuracy,
+            job->bpred_cycles_saved, job->pc, job->seconds);
+  }
+}
+
+static void
+write_json(FILE* fp, const Sweep* sweep)
+{
+  fprintf(fp, "[\n");
+  for (int i = 0; i < sweep->num_jobs; ++i) {
+    const Sweep_Job* job = &sweep->jobs[i];
+    fprintf(fp, "  {\"line\": %d, \"program\": ", job->line);
+    json_string(fp, job->program->filename);
+    fprintf(fp, ", \"type\": \"%s\", \"limit\": %lld, \"config\": ",
+            job_type_names[job->type], job->limit);
+    json_string(fp, job->config);
+    fprintf(fp, ", \"status\": \"%s\", \"cycles\": %lld, "
+                "\"instructions\": %lld, \"stall_cycles\": %lld, "
+                "\"fetch_stall_cycles\": %lld, "
+                "\"cpi\": %.4f, \"l1_hit_rate\": %.2f, \"l1_mpki\": %.2f, "
+                "\"amat\": %.4f, \"bpred_accuracy\": %.2f, "
+                "\"bpred_cycles_saved\": %lld, \"pc\": %d, "
+                "\"seconds\": %.6f}%s\n",
+            job->status, job->cycles, job->retired, job->stall_cycles,
+            job->fetch_stall_cycles, job_cpi(job), job->l1_hit_rate,
+            job->l1_mpki, job->amat, job->bpred_accuracy,
+            job->bpred_cycles_saved, job->pc, job->seconds,
+            i + 1 < sweep->num_jobs ? "," : "");
+  }
+  fprintf(fp, "]\n");
+}
+
+/* Deals the jobs out in contiguous ranges, runs the workers and waits
+ * for them. Returns -1 if no worker could be started.
+ */
+static int
+run_sweep(Sweep* sweep)
+{
+  if (sweep->num_workers > sweep->num_jobs) {
+    sweep->num_workers = sweep->num_jobs;
+  }
+  if (sweep->num_workers < 1) {
+    return 0;
+  }
+
+  sweep->ranges = calloc(sweep->num_workers, sizeof(*sweep->ranges));
+  Sweep_Worker* workers = calloc(sweep->num_workers, sizeof(*workers));
+  if (!sweep->ranges || !workers) {
+    free(workers);
+    return -1;
+  }
+
+  for (int w = 0; w < sweep->num_workers; ++w) {
+    Sweep_Range* r = &sweep->ranges[w];
+    pthread_mutex_init(&r->lock, NULL);
+    r->next = (long long)sweep->num_jobs * w / sweep->num_workers;
+    r->end = (long long)sweep->num_jobs * (w + 1) / sweep->num_workers;
+  }
+
+  /* Worker 0 runs on this thread, so a failed create only costs
+   * parallelism : the others' jobs get stolen
+   */
+  int started = 1;
+  for (int w = 0; w < sweep->num_workers; ++w) {
+    workers[w].sweep = sweep;
+    workers[w].id = w;
+    if (w > 0 &&
+        pthread_create(&workers[w].thread, NULL, worker_main,
+                       &workers[w]) == 0) {
+      started++;
+    }
+  }
+  worker_main(&workers[0]);
+  for (int w = 1; w < started; ++w) {
+    pthread_join(workers[w].thread, NULL);
+  }
+
+  for (int w = 0; w < sweep->num_workers; ++w) {
+    pthread_mutex_destroy(&sweep->ranges[w].lock);
+  }
+  free(workers);
+  return 0;
+}
+
+static void
+free_sweep(Sweep* sweep)
+{
+  for (int i = 0; i < sweep->num_jobs; ++i) {
+    free(sweep->jobs[i].restore);
+    free(sweep->jobs[i].config);
+  }
+  for (int i = 0; i < sweep->num_programs; ++i) {
+    Sweep_Program* p = sweep->programs[i];
+    destroy_code_memory(p->code, p->size, p->mapped);
+    free(p->filename);
+    free(p);
+  }
+  free(sweep->jobs);
+  free(sweep->programs);
+  free(sweep->ranges);
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr,
+      "APEX_Help : Usage %s <job_list> [-j <threads>] "
+      "[-o <summary.csv|summary.json>]\n",
+      argv[0]);
+    exit(1);
+  }
+
+  Sweep sweep;
+  memset(&sweep, 0, sizeof(sweep));
+  sweep.num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  const char* output = NULL;
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      sweep.num_workers = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    }
+    else {
+      fprintf(stderr, "APEX_Error : Unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+  if (sweep.num_workers < 1) {
+    sweep.num_workers = 1;
+  }
+
+  if (read_jobs(&sweep, argv[1]) < 0) {
+    free_sweep(&sweep);
+    exit(1);
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (run_sweep(&sweep) < 0) {
+    fprintf(stderr, "APEX_Error : Unable to start the workers\n");
+    free_sweep(&sweep);
+    exit(1);
+  }
+  fprintf(stderr, "APEX_SWEEP : %d jobs on %d programs, %d threads, %.3f s\n",
+          sweep.num_jobs, sweep.num_programs, sweep.num_workers,
+          elapsed_seconds(&start));
+
+  int ret = 0;
+  FILE* fp = output ? fopen(output, "w") : stdout;
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to create %s\n", output);
+    ret = 1;
+  }
+  else {
+    size_t len = output ? strlen(output) : 0;
+    if (len > 5 && strcmp(output + len - 5, ".json") == 0) {
+      write_json(fp, &sweep);
+    }
+    else {
+      write_csv(fp, &sweep);
+    }
+    if (fp != stdout && fclose(fp) != 0) {
+      fprintf(stderr, "APEX_Error : Unable to write %s\n", output);
+      ret = 1;
+    }
+  }
+
+  free_sweep(&sweep);
+  return ret;
+}
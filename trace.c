@@ -0,0 +1,374 @@
+/*
+ *  trace.c
+ *  Trace level names, the display layout shared with apex_trace, the
+ *  one-line-per-cycle trace and the binary trace sink.
+ *
+ *  The sink collects records in a ring buffer drained by a writer
+ *  thread. The simulator only copies a record into the ring each cycle
+ *  and takes the lock once per batch, so file I/O overlaps simulation.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* Records in the ring, a power of two */
+#define TRACE_RING_RECORDS (1 << 16)
+
+/* Records handed to the writer at a time */
+#define TRACE_BATCH_RECORDS 2048
+
+const char* const APEX_trace_level_names[NUM_TRACE_LEVELS] = {
+  [TRACE_NONE]    = "none",
+  [TRACE_SUMMARY] = "summary",
+  [TRACE_CYCLE]   = "cycle",
+  [TRACE_STAGE]   = "stage",
+};
+
+struct APEX_Trace_Sink
+{
+  FILE* fp;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;       // Signalled when head moves or on close
+  pthread_cond_t drained;     // Signalled when tail moves
+
+  APEX_Trace_Record* ring;
+  size_t produced;            // Records filled by the simulator
+  size_t head;                // Records handed to the writer (locked)
+  size_t tail;                // Records written to the file (locked)
+  int closing;                // No more records will come (locked)
+  int error;                  // A write failed (locked)
+
+  APEX_Trace_Record current;  // Record of the cycle being simulated
+};
+
+/* Label printed before a latch, as in the display layout */
+static const char* const stage_labels[NUM_STAGES] = {
+  [F]    = "Fetch",
+  [DRF]  = "Decode/RF",
+  [EX1]  = "Execute1",
+  [EX2]  = "Execute2",
+  [MEM1] = "Memory1",
+  [MEM2] = "Memory2",
+  [WB]   = "Writeback",
+};
+
+/* Line printed for a stage that did not process its latch. Fetch shows
+ * its latch either way.
+ */
+static const char* const stage_empty[NUM_STAGES] = {
+  [F]    = "Fetch          : EMPTY",
+  [DRF]  = "Decode/RF        : EMPTY",
+  [EX1]  = "Execute        : EMPTY",
+  [EX2]  = "Execute2        : EMPTY",
+  [MEM1] = "Memory1         : EMPTY",
+  [MEM2] = "Memory2         : EMPTY",
+  [WB]   = "Writeback      : EMPTY",
+};
+
+static const char* const stage_names[NUM_STAGES] = {
+  [F]    = "F",
+  [DRF]  = "DRF",
+  [EX1]  = "EX1",
+  [EX2]  = "EX2",
+  [MEM1] = "MEM1",
+  [MEM2] = "MEM2",
+  [WB]   = "WB",
+};
+
+/* Returns the TRACE_* level with this name, or -1 */
+int
+APEX_trace_parse_level(const char* name)
+{
+  for (int i = 0; i < NUM_TRACE_LEVELS; ++i) {
+    if (strcmp(name, APEX_trace_level_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void
+APEX_trace_print_banner(FILE* out, int clock)
+{
+  fprintf(out, "--------------------------------\n");
+  fprintf(out, "Clock Cycle #: %d\n", clock);
+  fprintf(out, "--------------------------------\n");
+}
+
+static void
+print_instruction(FILE* out, const APEX_Trace_Latch* latch)
+{
+  const APEX_Opcode_Info* info = &APEX_opcode_info[latch->opcode];
+
+  switch (info->format) {
+    case FMT_RD_IMM:
+      fprintf(out, info->display, info->name, latch->rd, latch->imm);
+      break;
+
+    case FMT_RS1_RS2_IMM:
+      fprintf(out, info->display, info->name, latch->rs1, latch->rs2, latch->imm);
+      break;
+
+    case FMT_RD_RS1_RS2:
+      fprintf(out, info->display, info->name, latch->rd, latch->rs1, latch->rs2);
+      break;
+
+    case FMT_RD_RS1_IMM:
+      fprintf(out, info->display, info->name, latch->rd, latch->rs1, latch->imm);
+      break;
+
+    case FMT_RS1_IMM:
+      fprintf(out, info->display, info->name, latch->rs1, latch->imm);
+      break;
+
+    case FMT_IMM:
+      fprintf(out, info->display, info->name, latch->imm);
+      break;
+
+    default:
+      fprintf(out, info->display, info->name);
+      break;
+  }
+}
+
+/* Prints one stage line of the display layout */
+void
+APEX_trace_print_latch(FILE* out, int stage, const APEX_Trace_Latch* latch)
+{
+  /* An idle fetch latch still holds its instruction, unless it is a
+   * bubble from an empty fetch queue
+   */
+  if (!(latch->flags & TRACE_ACTIVE) &&
+      (stage != F || (latch->flags & TRACE_BUSY))) {
+    fprintf(out, "%s\n", stage_empty[stage]);
+    return;
+  }
+  fprintf(out, "%-15s: pc(%d) ", stage_labels[stage], latch->pc);
+  print_instruction(out, latch);
+  fprintf(out, "\n");
+}
+
+static void
+fill_latch(APEX_Trace_Latch* latch, const CPU_Stage* stage, int active)
+{
+  latch->pc = stage->pc;
+  latch->imm = stage->imm;
+  latch->opcode = stage->opcode;
+  latch->rd = stage->rd;
+  latch->rs1 = stage->rs1;
+  latch->rs2 = stage->rs2;
+  latch->flags = (active ? TRACE_ACTIVE : 0) |
+                 (stage->busy ? TRACE_BUSY : 0) |
+                 (stage->stalled || active == TRACE_STAGE_HELD ?
+                  TRACE_STALLED : 0) |
+                 (stage->opcode == OP_FLUSH ? TRACE_FLUSH : 0);
+  memset(latch->reserved, 0, sizeof(latch->reserved));
+}
+
+/* Writes ring records [from, to) to the file, called without the lock */
+static int
+write_records(APEX_Trace_Sink* sink, size_t from, size_t to)
+{
+  while (from != to) {
+    size_t start = from & (TRACE_RING_RECORDS - 1);
+    size_t count = to - from;
+    if (count > TRACE_RING_RECORDS - start) {
+      count = TRACE_RING_RECORDS - start;
+    }
+    if (fwrite(&sink->ring[start], sizeof(sink->ring[0]), count, sink->fp) !=
+        count) {
+      return -1;
+    }
+    from += count;
+  }
+  return 0;
+}
+
+static void*
+writer_main(void* arg)
+{
+  APEX_Trace_Sink* sink = arg;
+
+  pthread_mutex_lock(&sink->lock);
+  for (;;) {
+    while (sink->head == sink->tail && !sink->closing) {
+      pthread_cond_wait(&sink->ready, &sink->lock);
+    }
+    if (sink->head == sink->tail) {
+      break;
+    }
+
+    size_t from = sink->tail;
+    size_t to = sink->head;
+    pthread_mutex_unlock(&sink->lock);
+    int ret = write_records(sink, from, to);
+    pthread_mutex_lock(&sink->lock);
+
+    if (ret < 0) {
+      sink->error = 1;
+    }
+    sink->tail = to;
+    pthread_cond_signal(&sink->drained);
+  }
+  pthread_mutex_unlock(&sink->lock);
+  return NULL;
+}
+
+/* Hands the filled records to the writer, then waits until the ring
+ * has room for another batch
+ */
+static void
+publish_records(APEX_Trace_Sink* sink)
+{
+  pthread_mutex_lock(&sink->lock);
+  sink->head = sink->produced;
+  pthread_cond_signal(&sink->ready);
+  while (sink->produced + TRACE_BATCH_RECORDS - sink->tail >
+         TRACE_RING_RECORDS) {
+    pthread_cond_wait(&sink->drained, &sink->lock);
+  }
+  pthread_mutex_unlock(&sink->lock);
+}
+
+/*
+ * Creates filename, writes the trace header and starts the writer
+ * thread. Returns NULL on error.
+ */
+APEX_Trace_Sink*
+APEX_trace_open(const char* filename)
+{
+  APEX_Trace_Sink* sink = calloc(1, sizeof(*sink));
+  if (!sink) {
+    return NULL;
+  }
+
+  sink->ring = malloc(sizeof(*sink->ring) * TRACE_RING_RECORDS);
+  sink->fp = fopen(filename, "wb");
+  if (!sink->ring || !sink->fp) {
+    goto fail;
+  }
+
+  APEX_Trace_Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, APEX_TRACE_MAGIC, sizeof(header.magic));
+  header.record_size = sizeof(APEX_Trace_Record);
+  header.num_stages = NUM_STAGES;
+  if (fwrite(&header, sizeof(header), 1, sink->fp) != 1) {
+    goto fail;
+  }
+
+  pthread_mutex_init(&sink->lock, NULL);
+  pthread_cond_init(&sink->ready, NULL);
+  pthread_cond_init(&sink->drained, NULL);
+  if (pthread_create(&sink->writer, NULL, writer_main, sink) != 0) {
+    pthread_cond_destroy(&sink->drained);
+    pthread_cond_destroy(&sink->ready);
+    pthread_mutex_destroy(&sink->lock);
+    goto fail;
+  }
+  return sink;
+
+fail:
+  if (sink->fp) {
+    fclose(sink->fp);
+  }
+  free(sink->ring);
+  free(sink);
+  return NULL;
+}
+
+/* Drains the ring, stops the writer and closes the file. Returns -1 if
+ * any write failed.
+ */
+int
+APEX_trace_close(APEX_Trace_Sink* sink)
+{
+  if (!sink) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&sink->lock);
+  sink->head = sink->produced;
+  sink->closing = 1;
+  pthread_cond_signal(&sink->ready);
+  pthread_mutex_unlock(&sink->lock);
+  pthread_join(sink->writer, NULL);
+
+  int ret = sink->error ? -1 : 0;
+  if (fclose(sink->fp) != 0) {
+    ret = -1;
+  }
+  pthread_cond_destroy(&sink->drained);
+  pthread_cond_destroy(&sink->ready);
+  pthread_mutex_destroy(&sink->lock);
+  free(sink->ring);
+  free(sink);
+  return ret;
+}
+
+void
+APEX_trace_stage_slow(APEX_CPU* cpu, int stage, int active)
+{
+  APEX_Trace_Latch latch;
+
+  fill_latch(&latch, &cpu->stage[stage], active);
+  if (cpu->trace_sink) {
+    cpu->trace_sink->current.latch[stage] = latch;
+  }
+  if (APEX_TRACE_ON(cpu, TRACE_STAGE)) {
+    APEX_trace_print_latch(cpu->out, stage, &latch);
+  }
+}
+
+void
+APEX_trace_forward_slow(APEX_CPU* cpu, int reg, int value)
+{
+  APEX_Trace_Record* rec = &cpu->trace_sink->current;
+
+  rec->events |= TRACE_FORWARD;
+  rec->forward_reg = reg;
+  rec->forward_value = value;
+}
+
+/* Prints "cycle N | F pc OP | DRF pc OP* | ..." with '-' for an idle
+ * latch and '*' for a stalled one
+ */
+static void
+print_cycle(const APEX_CPU* cpu)
+{
+  fprintf(cpu->out, "cycle %d", cpu->clock);
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    const CPU_Stage* stage = &cpu->stage[i];
+    if (stage->busy || stage->opcode == OP_NONE) {
+      fprintf(cpu->out, " | %s -", stage_names[i]);
+    }
+    else {
+      fprintf(cpu->out, " | %s %d %s%s", stage_names[i], stage->pc,
+             APEX_opcode_info[stage->opcode].name,
+             stage->stalled ? "*" : "");
+    }
+  }
+  fprintf(cpu->out, "\n");
+}
+
+void
+APEX_trace_cycle_slow(APEX_CPU* cpu)
+{
+  APEX_Trace_Sink* sink = cpu->trace_sink;
+
+  if (sink) {
+    sink->current.clock = cpu->clock;
+    sink->ring[sink->produced & (TRACE_RING_RECORDS - 1)] = sink->current;
+    memset(&sink->current, 0, sizeof(sink->current));
+    if (++sink->produced - sink->head >= TRACE_BATCH_RECORDS) {
+      publish_records(sink);
+    }
+  }
+  if (APEX_TRACE_MAX >= TRACE_CYCLE && cpu->trace_level == TRACE_CYCLE) {
+    print_cycle(cpu);
+  }
+}
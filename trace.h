@@ -0,0 +1,154 @@
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+/**
+ *  trace.h
+ *  Run-time trace levels for the pipeline model, and the binary
+ *  pipeline trace read back by apex_trace
+ */
+#include <stdint.h>
+
+#include "cpu.h"
+
+/* Trace levels, each one includes the levels below it. TRACE_STAGE
+ * prints its own cycle banner in place of the TRACE_CYCLE line.
+ */
+enum
+{
+  TRACE_NONE,     // Final state dump only
+  TRACE_SUMMARY,  // Code memory listing and end-of-run statistics
+  TRACE_CYCLE,    // One line per cycle
+  TRACE_STAGE,    // Every stage every cycle (the "display" layout)
+  NUM_TRACE_LEVELS
+};
+
+/* Highest level compiled in. Building with -DAPEX_TRACE_MAX=0 removes
+ * every trace call from the cycle loop.
+ */
+#ifndef APEX_TRACE_MAX
+#define APEX_TRACE_MAX TRACE_STAGE
+#endif
+
+#define APEX_TRACE_ON(cpu, level) \
+  (APEX_TRACE_MAX >= (level) && (cpu)->trace_level >= (level))
+
+extern const char* const APEX_trace_level_names[NUM_TRACE_LEVELS];
+
+/* Binary trace file : an APEX_Trace_Header, then one APEX_Trace_Record
+ * per simulated cycle, in host byte order
+ */
+#define APEX_TRACE_MAGIC "APEXTRC2"
+
+typedef struct APEX_Trace_Header
+{
+  char magic[8];          // APEX_TRACE_MAGIC
+  uint32_t record_size;   // sizeof(APEX_Trace_Record)
+  uint32_t num_stages;    // NUM_STAGES
+} APEX_Trace_Header;
+
+/* How a stage handled its latch in a cycle, the active argument of
+ * APEX_trace_stage()
+ */
+enum
+{
+  TRACE_STAGE_IDLE,     // Did not process it
+  TRACE_STAGE_ACTIVE,   // Processed it
+  TRACE_STAGE_HELD      // Kept it, held behind a waiting memory access
+                        // or execute result
+};
+
+/* Latch flags */
+enum
+{
+  TRACE_ACTIVE  = 1 << 0,   // Stage processed its latch this cycle
+  TRACE_BUSY    = 1 << 1,
+  TRACE_STALLED = 1 << 2,
+  TRACE_FLUSH   = 1 << 3    // Latch squashed by a taken branch
+};
+
+/* Cycle events */
+enum
+{
+  TRACE_FORWARD = 1 << 0    // Decode picked up a forwarded value
+};
+
+/* A latch as its stage saw it during the cycle */
+typedef struct APEX_Trace_Latch
+{
+  int32_t pc;
+  int32_t imm;
+  uint8_t opcode;   // OP_*
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  uint8_t flags;    // TRACE_ACTIVE | TRACE_BUSY | ...
+  uint8_t reserved[3];
+} APEX_Trace_Latch;
+
+typedef struct APEX_Trace_Record
+{
+  int32_t clock;              // Cycle number, from 1
+  uint8_t events;             // TRACE_FORWARD
+  uint8_t forward_reg;        // Register forwarded into decode
+  uint16_t reserved;
+  int32_t forward_value;      // Value forwarded into decode
+  APEX_Trace_Latch latch[NUM_STAGES];
+} APEX_Trace_Record;
+
+typedef struct APEX_Trace_Sink APEX_Trace_Sink;
+
+int
+APEX_trace_parse_level(const char* name);
+
+APEX_Trace_Sink*
+APEX_trace_open(const char* filename);
+
+int
+APEX_trace_close(APEX_Trace_Sink* sink);
+
+void
+APEX_trace_print_banner(FILE* out, int clock);
+
+void
+APEX_trace_print_latch(FILE* out, int stage, const APEX_Trace_Latch* latch);
+
+void
+APEX_trace_stage_slow(APEX_CPU* cpu, int stage, int active);
+
+void
+APEX_trace_forward_slow(APEX_CPU* cpu, int reg, int value);
+
+void
+APEX_trace_cycle_slow(APEX_CPU* cpu);
+
+/* The hooks below are called from the stage functions and the cycle
+ * loop. Each costs one branch when nothing is being traced.
+ */
+
+/* Stage stage has run, active is a TRACE_STAGE_* value */
+static inline void
+APEX_trace_stage(APEX_CPU* cpu, int stage, int active)
+{
+  if (cpu->trace_sink || APEX_TRACE_ON(cpu, TRACE_STAGE)) {
+    APEX_trace_stage_slow(cpu, stage, active);
+  }
+}
+
+/* Decode applied a forwarded register value */
+static inline void
+APEX_trace_forward(APEX_CPU* cpu, int reg, int value)
+{
+  if (cpu->trace_sink) {
+    APEX_trace_forward_slow(cpu, reg, value);
+  }
+}
+
+/* The cycle has completed */
+static inline void
+APEX_trace_cycle(APEX_CPU* cpu)
+{
+  if (cpu->trace_sink || APEX_TRACE_ON(cpu, TRACE_CYCLE)) {
+    APEX_trace_cycle_slow(cpu);
+  }
+}
+
+#endif